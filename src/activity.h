@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Coordinate::time of track points without a timestamp.
+constexpr std::int64_t kNoTime = std::numeric_limits<std::int64_t>::min();
+
+struct Coordinate {
+  double lat;
+  double lon;
+  double alt;
+  // Milliseconds since the Unix epoch or kNoTime.
+  std::int64_t time = kNoTime;
+};
+
+using Coordinates = std::vector<Coordinate>;
+
+// Numeric values of a GPX track point extension, e.g. the heart rate "hr" of
+// Garmin's TrackPointExtension, named by the element's local name. One value
+// per coordinate, NaN for points without the extension.
+struct PointExtension {
+  std::string name;
+  std::vector<double> values = {};
+};
+
+// A single parsed GPX track.
+struct Activity {
+  std::string name;
+  std::tm time;
+  Coordinates coordinates;
+  std::vector<PointExtension> extensions;
+};
+
+// Receives every converted activity of a run, e.g. to write a single combined
+// output file. Add() is called concurrently from the worker threads.
+class ActivitySink {
+ public:
+  virtual ~ActivitySink() = default;
+
+  virtual void Add(const Activity& activity) = 0;
+  // Called once after the last Add().
+  virtual void Finish() = 0;
+};
+
+}  // namespace gpx_to_kml
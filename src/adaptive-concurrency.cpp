@@ -0,0 +1,156 @@
+#include "adaptive-concurrency.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace gpx_to_kml {
+namespace {
+
+// Throughput is measured over at least this long and this many files, which
+// keeps single slow files from steering the search.
+constexpr std::chrono::milliseconds kMinInterval(500);
+constexpr std::uint64_t kMinCompletedPerInterval = 16;
+// Changes within this fraction of the previous throughput count as noise and
+// don't reverse the search.
+constexpr double kTolerance = 0.03;
+
+}  // namespace
+
+void ConcurrencyLimit::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  slot_available_.wait(lock, [this]() { return active_ < limit_; });
+  ++active_;
+}
+
+void ConcurrencyLimit::Release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --active_;
+  }
+  slot_available_.notify_one();
+}
+
+std::size_t ConcurrencyLimit::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+void ConcurrencyLimit::set_limit(std::size_t limit) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_ = limit;
+  }
+  slot_available_.notify_all();
+}
+
+AdaptiveConcurrency::AdaptiveConcurrency(
+    std::vector<Dimension> dimensions, std::function<std::uint64_t()> completed)
+    : completed_(std::move(completed)),
+      dimensions_(std::move(dimensions)),
+      weighted_sums_(dimensions_.size(), 0),
+      directions_(dimensions_.size(), 1) {
+  for (const Dimension& dimension : dimensions_) {
+    const std::size_t limit = dimension.limit->limit();
+    summaries_.push_back(Summary{
+        .name = dimension.name, .min = limit, .max = limit, .last = limit});
+  }
+  thread_ = std::thread([this]() { Run(); });
+}
+
+AdaptiveConcurrency::~AdaptiveConcurrency() { Stop(); }
+
+void AdaptiveConcurrency::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_requested_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+std::vector<AdaptiveConcurrency::Summary> AdaptiveConcurrency::summaries()
+    const {
+  std::vector<Summary> summaries = summaries_;
+  for (std::size_t i = 0; i < summaries.size(); ++i) {
+    summaries[i].last = dimensions_[i].limit->limit();
+    summaries[i].mean = total_seconds_ > 0
+                            ? weighted_sums_[i] / total_seconds_
+                            : static_cast<double>(summaries[i].last);
+  }
+  return summaries;
+}
+
+void AdaptiveConcurrency::Run() {
+  Clock::time_point interval_start = Clock::now();
+  std::uint64_t interval_completed = completed_();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_requested_.wait_for(lock, kMinInterval,
+                                   [this]() { return stop_; })) {
+    const Clock::time_point now = Clock::now();
+    const std::uint64_t completed = completed_();
+    if (completed - interval_completed < kMinCompletedPerInterval) {
+      continue;
+    }
+    const std::chrono::duration<double> elapsed = now - interval_start;
+    Account(now - interval_start);
+    Step(static_cast<double>(completed - interval_completed) /
+         elapsed.count());
+    interval_start = now;
+    interval_completed = completed;
+  }
+  Account(Clock::now() - interval_start);
+}
+
+void AdaptiveConcurrency::Account(Clock::duration elapsed) {
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  total_seconds_ += seconds;
+  for (std::size_t i = 0; i < dimensions_.size(); ++i) {
+    weighted_sums_[i] +=
+        static_cast<double>(dimensions_[i].limit->limit()) * seconds;
+  }
+}
+
+void AdaptiveConcurrency::Step(double throughput) {
+  if (dimensions_.empty()) {
+    return;
+  }
+  if (last_throughput_ >= 0 &&
+      throughput < last_throughput_ * (1 - kTolerance)) {
+    // The last move hurt: undo it, search the other way next time and measure
+    // the next dimension from here.
+    Move(current_, -directions_[current_]);
+    directions_[current_] = -directions_[current_];
+    current_ = (current_ + 1) % dimensions_.size();
+    last_throughput_ = -1;
+    return;
+  }
+  last_throughput_ = throughput;
+  // Turn around at the bounds, every dimension has room in one direction.
+  for (std::size_t i = 0; i < dimensions_.size(); ++i) {
+    const Dimension& dimension = dimensions_[current_];
+    const std::size_t limit = dimension.limit->limit();
+    if (directions_[current_] > 0 ? limit < dimension.max
+                                  : limit > dimension.min) {
+      Move(current_, directions_[current_]);
+      return;
+    }
+    directions_[current_] = -directions_[current_];
+    current_ = (current_ + 1) % dimensions_.size();
+  }
+}
+
+void AdaptiveConcurrency::Move(std::size_t dimension, int direction) {
+  const Dimension& moved = dimensions_[dimension];
+  const std::size_t limit = moved.limit->limit();
+  const std::size_t next =
+      direction > 0 ? std::min(limit + 1, moved.max)
+                    : std::max(limit, moved.min + 1) - 1;
+  moved.limit->set_limit(next);
+  Summary& summary = summaries_[dimension];
+  summary.min = std::min(summary.min, next);
+  summary.max = std::max(summary.max, next);
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Caps the number of threads doing one kind of work at the same time. The cap
+// may change while threads are waiting for it. Thread-safe.
+class ConcurrencyLimit {
+ public:
+  explicit ConcurrencyLimit(std::size_t limit) : limit_(limit) {}
+
+  ConcurrencyLimit(const ConcurrencyLimit&) = delete;
+  ConcurrencyLimit& operator=(const ConcurrencyLimit&) = delete;
+
+  // Blocks until fewer than limit() threads hold a slot and takes one.
+  void Acquire();
+  void Release();
+
+  std::size_t limit() const;
+  void set_limit(std::size_t limit);
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable slot_available_;
+  std::size_t limit_;
+  std::size_t active_ = 0;
+};
+
+// Holds a slot of a ConcurrencyLimit for its lifetime.
+class ConcurrencySlot {
+ public:
+  explicit ConcurrencySlot(ConcurrencyLimit& limit) : limit_(limit) {
+    limit_.Acquire();
+  }
+  ~ConcurrencySlot() { limit_.Release(); }
+
+  ConcurrencySlot(const ConcurrencySlot&) = delete;
+  ConcurrencySlot& operator=(const ConcurrencySlot&) = delete;
+
+ private:
+  ConcurrencyLimit& limit_;
+};
+
+// Tunes concurrency limits at runtime by hill climbing on the measured
+// throughput. Limits are tuned one at a time: a limit keeps moving by one in
+// its direction while throughput holds up. A drop undoes the last move,
+// reverses that limit's direction and continues with the next limit.
+class AdaptiveConcurrency {
+ public:
+  struct Dimension {
+    std::string name;
+    ConcurrencyLimit* limit;
+    std::size_t min;
+    std::size_t max;
+  };
+
+  // The limits a dimension took during the run, the mean weighted by time.
+  struct Summary {
+    std::string name;
+    std::size_t min = 0;
+    std::size_t max = 0;
+    double mean = 0;
+    std::size_t last = 0;
+  };
+
+  // Samples `completed`, the number of finished work items so far, on a
+  // thread of its own until Stop() is called.
+  AdaptiveConcurrency(std::vector<Dimension> dimensions,
+                      std::function<std::uint64_t()> completed);
+  ~AdaptiveConcurrency();
+
+  AdaptiveConcurrency(const AdaptiveConcurrency&) = delete;
+  AdaptiveConcurrency& operator=(const AdaptiveConcurrency&) = delete;
+
+  void Stop();
+  // Only valid after Stop().
+  std::vector<Summary> summaries() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void Run();
+  // Moves one limit based on the throughput at the current limits.
+  void Step(double throughput);
+  void Move(std::size_t dimension, int direction);
+  // Accounts for the time the current limits have been in effect.
+  void Account(Clock::duration elapsed);
+
+  const std::function<std::uint64_t()> completed_;
+  std::vector<Dimension> dimensions_;
+  std::vector<Summary> summaries_;
+  // Sum of limit times seconds for the time-weighted mean of each dimension.
+  std::vector<double> weighted_sums_;
+  double total_seconds_ = 0;
+
+  // The dimension tuned at the moment and the direction of each.
+  std::size_t current_ = 0;
+  std::vector<int> directions_;
+  double last_throughput_ = -1;
+
+  std::mutex mutex_;
+  std::condition_variable stop_requested_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,307 @@
+#include "arrow-ipc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "flatbuffer-writer.h"
+#include "parallel.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Rows per record batch. Large enough to amortize the per-batch metadata,
+// small enough that the builders of all threads comfortably fit in memory.
+constexpr std::size_t kBatchRows = 64 * 1024;
+
+// Values from the Arrow format's Schema.fbs and Message.fbs.
+constexpr std::int16_t kMetadataVersionV5 = 4;
+constexpr std::uint8_t kMessageHeaderSchema = 1;
+constexpr std::uint8_t kMessageHeaderRecordBatch = 3;
+constexpr std::uint8_t kTypeInt = 2;
+constexpr std::uint8_t kTypeFloatingPoint = 3;
+constexpr std::uint8_t kTypeTimestamp = 10;
+constexpr std::int16_t kPrecisionDouble = 2;
+constexpr std::int16_t kTimeUnitMillisecond = 1;
+
+constexpr std::string_view kMagic("ARROW1\0\0", 8);
+
+struct FieldNode {
+  std::int64_t length;
+  std::int64_t null_count;
+};
+
+struct Buffer {
+  std::int64_t offset;
+  std::int64_t length;
+};
+
+template <typename T>
+void AppendRaw(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Prefixes a Message flatbuffer with the continuation marker and its length
+// and pads it, so that the following body is 8-byte aligned.
+std::string FrameMessage(const std::string& metadata) {
+  const std::size_t padded = (metadata.size() + 7) / 8 * 8;
+  std::string framed;
+  AppendRaw<std::uint32_t>(framed, 0xFFFFFFFF);
+  AppendRaw(framed, static_cast<std::int32_t>(padded));
+  framed += metadata;
+  framed.append(padded - metadata.size(), '\0');
+  return framed;
+}
+
+// Accumulates the buffers of a record batch body.
+class BodyBuilder {
+ public:
+  template <typename T>
+  void AddColumn(const std::vector<T>& values,
+                 const std::function<bool(std::size_t)>& is_null) {
+    std::int64_t null_count = 0;
+    std::string validity;
+    if (is_null) {
+      validity.assign((values.size() + 7) / 8, '\xFF');
+      for (std::size_t i = 0; i < values.size(); ++i) {
+        if (is_null(i)) {
+          validity[i / 8] &= static_cast<char>(~(1 << (i % 8)));
+          ++null_count;
+        }
+      }
+    }
+    nodes_.push_back(FieldNode{.length = static_cast<std::int64_t>(values.size()),
+                               .null_count = null_count});
+    // Without nulls the validity buffer may be omitted.
+    AddBuffer(validity.data(), null_count > 0 ? validity.size() : 0);
+    AddBuffer(values.data(), values.size() * sizeof(T));
+  }
+
+  const std::vector<FieldNode>& nodes() const { return nodes_; }
+  const std::vector<Buffer>& buffers() const { return buffers_; }
+  const std::string& body() const { return body_; }
+
+ private:
+  void AddBuffer(const void* data, std::size_t size) {
+    buffers_.push_back(Buffer{.offset = static_cast<std::int64_t>(body_.size()),
+                              .length = static_cast<std::int64_t>(size)});
+    body_.append(static_cast<const char*>(data), size);
+    body_.append((8 - body_.size() % 8) % 8, '\0');
+  }
+
+  std::vector<FieldNode> nodes_;
+  std::vector<Buffer> buffers_;
+  std::string body_;
+};
+
+void WriteField(FlatBufferWriter& writer, std::size_t at, std::string_view name,
+                bool nullable, std::uint8_t type) {
+  const FlatBufferWriter::TableRef field = writer.WriteTable(
+      FlatBufferWriter::Table()
+          .Offset(0)
+          .Scalar<bool>(1, nullable)
+          .Scalar<std::uint8_t>(2, type)
+          .Offset(3)
+          .Offset(5));
+  writer.SetOffset(at, field.position());
+  writer.SetOffset(field.field(0), writer.WriteString(name));
+
+  FlatBufferWriter::Table type_table;
+  switch (type) {
+    case kTypeInt:
+      type_table.Scalar<std::int32_t>(0, 32).Scalar<bool>(1, true);
+      break;
+    case kTypeFloatingPoint:
+      type_table.Scalar<std::int16_t>(0, kPrecisionDouble);
+      break;
+    case kTypeTimestamp:
+      type_table.Scalar<std::int16_t>(0, kTimeUnitMillisecond).Offset(1);
+      break;
+  }
+  const FlatBufferWriter::TableRef type_ref = writer.WriteTable(type_table);
+  writer.SetOffset(field.field(3), type_ref.position());
+  if (type == kTypeTimestamp) {
+    writer.SetOffset(type_ref.field(1), writer.WriteString("UTC"));
+  }
+  // Readers insist on the children vector, even for primitive types.
+  writer.SetOffset(field.field(5), writer.WriteOffsetVector(0));
+}
+
+}  // namespace
+
+ArrowWriter::ArrowWriter(const boost::filesystem::path& path,
+                         std::vector<std::string> extensions,
+                         Durability durability)
+    : extensions_(std::move(extensions)), file_(path, durability) {
+  for (std::size_t i = 0; i < NumParallelThreads(); ++i) {
+    builders_.push_back(std::make_unique<Builder>());
+    builders_.back()->batch = NewBatch();
+  }
+
+  FlatBufferWriter writer;
+  const FlatBufferWriter::TableRef message = writer.WriteTable(
+      FlatBufferWriter::Table()
+          .Scalar<std::int16_t>(0, kMetadataVersionV5)
+          .Scalar<std::uint8_t>(1, kMessageHeaderSchema)
+          .Offset(2)
+          .Scalar<std::int64_t>(3, 0));
+  writer.SetRoot(message);
+  WriteSchema(writer, message.field(2));
+
+  const std::string schema = FrameMessage(writer.buffer());
+  file_.Write(kMagic);
+  file_.Write(schema);
+  file_size_ = kMagic.size() + schema.size();
+}
+
+void ArrowWriter::Add(const Activity& activity) {
+  const std::int32_t activity_id = next_activity_id_++;
+  const std::size_t count = activity.coordinates.size();
+  Builder& builder =
+      *builders_[std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                 builders_.size()];
+  Batch full;
+  {
+    std::lock_guard<std::mutex> lock(builder.mutex);
+    Batch& batch = builder.batch;
+    batch.activity_ids.insert(batch.activity_ids.end(), count, activity_id);
+    for (const Coordinate& coordinate : activity.coordinates) {
+      batch.lats.push_back(coordinate.lat);
+      batch.lons.push_back(coordinate.lon);
+      batch.eles.push_back(coordinate.alt);
+      batch.times.push_back(coordinate.time);
+    }
+    for (std::size_t i = 0; i < extensions_.size(); ++i) {
+      std::vector<double>& column = batch.extensions[i];
+      const auto extension = std::find_if(
+          activity.extensions.begin(), activity.extensions.end(),
+          [&](const PointExtension& e) { return e.name == extensions_[i]; });
+      if (extension == activity.extensions.end()) {
+        column.insert(column.end(), count,
+                      std::numeric_limits<double>::quiet_NaN());
+      } else {
+        column.insert(column.end(), extension->values.begin(),
+                      extension->values.end());
+      }
+    }
+    if (batch.lats.size() < kBatchRows) {
+      return;
+    }
+    full = std::exchange(batch, NewBatch());
+  }
+  WriteBatch(full);
+}
+
+void ArrowWriter::Finish() {
+  for (const std::unique_ptr<Builder>& builder : builders_) {
+    std::lock_guard<std::mutex> lock(builder->mutex);
+    if (!builder->batch.lats.empty()) {
+      WriteBatch(builder->batch);
+    }
+  }
+
+  FlatBufferWriter writer;
+  const FlatBufferWriter::TableRef footer = writer.WriteTable(
+      FlatBufferWriter::Table()
+          .Scalar<std::int16_t>(0, kMetadataVersionV5)
+          .Offset(1)
+          .Offset(2)
+          .Offset(3));
+  writer.SetRoot(footer);
+  WriteSchema(writer, footer.field(1));
+  writer.SetOffset(footer.field(2), writer.WriteOffsetVector(0));
+  writer.SetOffset(footer.field(3),
+                   blocks_.empty()
+                       ? writer.WriteOffsetVector(0)
+                       : writer.WriteVector(blocks_.data(), blocks_.size()));
+
+  std::string trailer;
+  // End-of-stream marker, so that the file can also be read as a stream.
+  AppendRaw<std::uint32_t>(trailer, 0xFFFFFFFF);
+  AppendRaw<std::int32_t>(trailer, 0);
+  trailer += writer.buffer();
+  AppendRaw(trailer, static_cast<std::int32_t>(writer.buffer().size()));
+  trailer += kMagic.substr(0, 6);
+
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  file_.Write(trailer);
+  file_.Commit();
+}
+
+void ArrowWriter::WriteBatch(const Batch& batch) {
+  BodyBuilder body;
+  body.AddColumn(batch.activity_ids, nullptr);
+  body.AddColumn(batch.lats, nullptr);
+  body.AddColumn(batch.lons, nullptr);
+  body.AddColumn(batch.eles, nullptr);
+  body.AddColumn(batch.times,
+                 [&](std::size_t i) { return batch.times[i] == kNoTime; });
+  for (const std::vector<double>& column : batch.extensions) {
+    body.AddColumn(column,
+                   [&](std::size_t i) { return std::isnan(column[i]); });
+  }
+
+  FlatBufferWriter writer;
+  const FlatBufferWriter::TableRef message = writer.WriteTable(
+      FlatBufferWriter::Table()
+          .Scalar<std::int16_t>(0, kMetadataVersionV5)
+          .Scalar<std::uint8_t>(1, kMessageHeaderRecordBatch)
+          .Offset(2)
+          .Scalar<std::int64_t>(3, body.body().size()));
+  writer.SetRoot(message);
+  const FlatBufferWriter::TableRef record_batch = writer.WriteTable(
+      FlatBufferWriter::Table()
+          .Scalar<std::int64_t>(0, batch.lats.size())
+          .Offset(1)
+          .Offset(2));
+  writer.SetOffset(message.field(2), record_batch.position());
+  writer.SetOffset(record_batch.field(1),
+                   writer.WriteVector(body.nodes().data(), body.nodes().size()));
+  writer.SetOffset(
+      record_batch.field(2),
+      writer.WriteVector(body.buffers().data(), body.buffers().size()));
+  const std::string metadata = FrameMessage(writer.buffer());
+
+  std::lock_guard<std::mutex> lock(file_mutex_);
+  blocks_.push_back(
+      Block{.offset = file_size_,
+            .metadata_length = static_cast<std::int32_t>(metadata.size()),
+            .padding = 0,
+            .body_length = static_cast<std::int64_t>(body.body().size())});
+  file_.Write(metadata);
+  file_.Write(body.body());
+  file_size_ += metadata.size() + body.body().size();
+}
+
+void ArrowWriter::WriteSchema(FlatBufferWriter& writer, std::size_t at) const {
+  // Endianness defaults to little.
+  const FlatBufferWriter::TableRef schema =
+      writer.WriteTable(FlatBufferWriter::Table().Offset(1));
+  writer.SetOffset(at, schema.position());
+  const std::size_t fields = writer.WriteOffsetVector(5 + extensions_.size());
+  writer.SetOffset(schema.field(1), fields);
+  const auto element = [&](std::size_t i) {
+    return FlatBufferWriter::OffsetVectorElement(fields, i);
+  };
+  WriteField(writer, element(0), "activity_id", false, kTypeInt);
+  WriteField(writer, element(1), "lat", false, kTypeFloatingPoint);
+  WriteField(writer, element(2), "lon", false, kTypeFloatingPoint);
+  WriteField(writer, element(3), "ele", false, kTypeFloatingPoint);
+  WriteField(writer, element(4), "time", true, kTypeTimestamp);
+  for (std::size_t i = 0; i < extensions_.size(); ++i) {
+    WriteField(writer, element(5 + i), extensions_[i], true,
+               kTypeFloatingPoint);
+  }
+}
+
+ArrowWriter::Batch ArrowWriter::NewBatch() const {
+  Batch batch;
+  batch.extensions.resize(extensions_.size());
+  return batch;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+class FlatBufferWriter;
+
+// Writes every track point of all activities into a single Arrow IPC file
+// (Feather V2) for columnar analytics. Columns are activity_id, lat, lon, ele,
+// time (UTC milliseconds, null if the point has none) and one nullable double
+// column per requested GPX extension, e.g. "hr" or "cad".
+//
+// Workers append points to one of several record batch builders, picked by
+// thread so they rarely contend. A builder which reaches the batch size is
+// encoded on the calling worker, only appending the finished record batch to
+// the file is serialized. Finish() flushes the partial batches and writes the
+// footer, which makes the file randomly accessible and memory-mappable.
+class ArrowWriter : public ActivitySink {
+ public:
+  ArrowWriter(const boost::filesystem::path& path,
+              std::vector<std::string> extensions, Durability durability);
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  struct Batch {
+    std::vector<std::int32_t> activity_ids;
+    std::vector<double> lats;
+    std::vector<double> lons;
+    std::vector<double> eles;
+    std::vector<std::int64_t> times;
+    // Parallel to extensions_, NaN for missing values.
+    std::vector<std::vector<double>> extensions;
+  };
+
+  struct Builder {
+    std::mutex mutex;
+    Batch batch;
+  };
+
+  // Location of a record batch message, as referenced by the footer.
+  struct Block {
+    std::int64_t offset;
+    std::int32_t metadata_length;
+    std::int32_t padding;
+    std::int64_t body_length;
+  };
+
+  void WriteBatch(const Batch& batch);
+  // Encodes the Schema table and points the offset at `at` to it.
+  void WriteSchema(FlatBufferWriter& writer, std::size_t at) const;
+  Batch NewBatch() const;
+
+  const std::vector<std::string> extensions_;
+  std::vector<std::unique_ptr<Builder>> builders_;
+  std::atomic<std::int32_t> next_activity_id_ = 0;
+
+  std::mutex file_mutex_;
+  AtomicFile file_;
+  std::int64_t file_size_ = 0;
+  std::vector<Block> blocks_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,143 @@
+#include "coroutine.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace gpx_to_kml {
+namespace {
+
+// A coroutine which starts when its handle is resumed and frees itself once
+// it has finished.
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() {
+      return DetachedTask{
+          std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    // RunDetached() catches everything.
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+DetachedTask RunDetached(Task task,
+                         std::function<void(std::exception_ptr)> done) {
+  std::exception_ptr error;
+  try {
+    co_await std::move(task);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  done(error);
+}
+
+}  // namespace
+
+Executor::Executor(std::size_t num_threads) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(1, num_threads); ++i) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  ready_available_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void Executor::Post(std::coroutine_handle<> handle) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.push_back(handle);
+  }
+  ready_available_.notify_one();
+}
+
+void Executor::Post(const std::vector<std::coroutine_handle<>>& handles) {
+  if (handles.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.insert(ready_.end(), handles.begin(), handles.end());
+  }
+  if (handles.size() == 1) {
+    ready_available_.notify_one();
+  } else {
+    ready_available_.notify_all();
+  }
+}
+
+void Executor::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    ready_available_.wait(lock, [this]() { return !ready_.empty() || stop_; });
+    if (ready_.empty()) {
+      return;
+    }
+    const std::coroutine_handle<> handle = ready_.front();
+    ready_.pop_front();
+    lock.unlock();
+    handle.resume();
+    lock.lock();
+  }
+}
+
+TaskGroup::TaskGroup(Executor& executor, std::size_t limit)
+    : executor_(executor), limit_(std::max<std::size_t>(1, limit)) {}
+
+TaskGroup::~TaskGroup() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return running_ == 0; });
+}
+
+void TaskGroup::Spawn(Task task) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return running_ < limit_; });
+    max_running_ = std::max(max_running_, ++running_);
+  }
+  executor_.Post(
+      RunDetached(std::move(task),
+                  [this](std::exception_ptr error) { Done(error); })
+          .handle);
+}
+
+void TaskGroup::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return running_ == 0; });
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+std::size_t TaskGroup::running() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_;
+}
+
+std::size_t TaskGroup::max_running() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_running_;
+}
+
+void TaskGroup::Done(std::exception_ptr error) {
+  // Notifies under the lock, a woken Wait() may destroy the group.
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (error && !error_) {
+    error_ = error;
+  }
+  --running_;
+  changed_.notify_all();
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// A lazily started coroutine without a result. Awaiting a Task runs it and
+// resumes the awaiting coroutine once it has finished, rethrowing anything it
+// threw.
+class Task {
+ public:
+  class promise_type {
+   public:
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept {
+      // Continues with the awaiting coroutine without growing the stack.
+      struct Continue {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<promise_type> finished) noexcept {
+          const std::coroutine_handle<> continuation =
+              finished.promise().continuation_;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return Continue{};
+    }
+    void return_void() {}
+    void unhandled_exception() { error_ = std::current_exception(); }
+
+   private:
+    friend class Task;
+
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr error_;
+  };
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  Task& operator=(Task&&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<> awaiting) noexcept {
+    handle_.promise().continuation_ = awaiting;
+    return handle_;
+  }
+  void await_resume() const {
+    if (handle_.promise().error_) {
+      std::rethrow_exception(handle_.promise().error_);
+    }
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Resumes coroutines on a fixed group of threads. Coroutines waiting for I/O
+// hold no thread, so a few threads can keep many of them going.
+class Executor {
+ public:
+  explicit Executor(std::size_t num_threads);
+  // Finishes the coroutines posted so far.
+  ~Executor();
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  std::size_t num_threads() const { return threads_.size(); }
+
+  // Resumes `handle` on one of the threads. Never blocks, so I/O completions
+  // may be posted from any thread.
+  void Post(std::coroutine_handle<> handle);
+  void Post(const std::vector<std::coroutine_handle<>>& handles);
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable ready_available_;
+  std::deque<std::coroutine_handle<>> ready_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// Runs tasks on an executor, at most a given number at the same time.
+class TaskGroup {
+ public:
+  TaskGroup(Executor& executor, std::size_t limit);
+  // Waits for the running tasks, their exceptions are lost.
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // Blocks while `limit` tasks are running, then starts `task`.
+  void Spawn(Task task);
+  // Blocks until all tasks have finished and rethrows the first exception any
+  // of them threw.
+  void Wait();
+
+  // Tasks running at the moment.
+  std::size_t running() const;
+  // The most tasks which were running at the same time.
+  std::size_t max_running() const;
+
+ private:
+  void Done(std::exception_ptr error);
+
+  Executor& executor_;
+  const std::size_t limit_;
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  std::size_t running_ = 0;
+  std::size_t max_running_ = 0;
+  std::exception_ptr error_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,212 @@
+#include "deflate.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr int kHashBits = 15;
+constexpr std::size_t kWindowSize = 32768;
+constexpr std::size_t kMinMatch = 4;
+constexpr std::size_t kMaxMatch = 258;
+
+constexpr std::array<std::uint32_t, 256> MakeCrc32Table() {
+  std::array<std::uint32_t, 256> table = {};
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    std::uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<std::uint32_t, 256> kCrc32Table = MakeCrc32Table();
+
+// Length and distance symbols of RFC 1951 section 3.2.5.
+constexpr std::uint16_t kLengthBase[] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::uint8_t kLengthExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                         1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                         4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::uint16_t kDistanceBase[] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+constexpr std::uint8_t kDistanceExtra[] = {0, 0, 0,  0,  1,  1,  2,  2,  3,  3,
+                                           4, 4, 5,  5,  6,  6,  7,  7,  8,  8,
+                                           9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+constexpr std::uint32_t ReverseBits(std::uint32_t code, int length) {
+  std::uint32_t reversed = 0;
+  for (int i = 0; i < length; ++i) {
+    reversed = reversed << 1 | ((code >> i) & 1);
+  }
+  return reversed;
+}
+
+// Fixed Huffman code of a literal/length symbol, reversed since DEFLATE packs
+// Huffman codes starting with their most significant bit.
+struct Code {
+  std::uint16_t bits;
+  std::uint8_t length;
+};
+
+constexpr std::array<Code, 288> MakeFixedCodes() {
+  std::array<Code, 288> codes = {};
+  for (std::uint32_t symbol = 0; symbol < 288; ++symbol) {
+    std::uint32_t code;
+    int length;
+    if (symbol < 144) {
+      code = 0x30 + symbol;
+      length = 8;
+    } else if (symbol < 256) {
+      code = 0x190 + symbol - 144;
+      length = 9;
+    } else if (symbol < 280) {
+      code = symbol - 256;
+      length = 7;
+    } else {
+      code = 0xC0 + symbol - 280;
+      length = 8;
+    }
+    codes[symbol] = Code{static_cast<std::uint16_t>(ReverseBits(code, length)),
+                         static_cast<std::uint8_t>(length)};
+  }
+  return codes;
+}
+
+constexpr std::array<Code, 288> kFixedCodes = MakeFixedCodes();
+
+std::uint32_t Hash(const char* data) {
+  std::uint32_t value;
+  std::memcpy(&value, data, 4);
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+void AppendLittleEndian(std::string& out, std::uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out += static_cast<char>((value >> (8 * i)) & 0xFF);
+  }
+}
+
+}  // namespace
+
+std::uint32_t Crc32(std::string_view data, std::uint32_t crc) {
+  crc = ~crc;
+  for (unsigned char c : data) {
+    crc = kCrc32Table[(crc ^ c) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+std::uint32_t Adler32(std::string_view data, std::uint32_t adler) {
+  // Largest number of bytes before the sums need to be reduced.
+  constexpr std::size_t kMaxRun = 5552;
+  constexpr std::uint32_t kModulus = 65521;
+  std::uint32_t a = adler & 0xFFFF;
+  std::uint32_t b = adler >> 16;
+  while (!data.empty()) {
+    const std::size_t run = std::min(data.size(), kMaxRun);
+    for (unsigned char c : data.substr(0, run)) {
+      a += c;
+      b += a;
+    }
+    a %= kModulus;
+    b %= kModulus;
+    data.remove_prefix(run);
+  }
+  return b << 16 | a;
+}
+
+DeflateEncoder::DeflateEncoder() : head_(std::size_t{1} << kHashBits) {}
+
+void DeflateEncoder::Compress(std::string_view data, bool final,
+                              std::string& out) {
+  std::fill(head_.begin(), head_.end(), 0);
+  // BFINAL, then BTYPE 01 for fixed Huffman codes.
+  WriteBits(final ? 1 : 0, 1, out);
+  WriteBits(1, 2, out);
+  std::size_t i = 0;
+  while (i < data.size()) {
+    std::size_t length = 0;
+    std::size_t distance = 0;
+    if (i + kMinMatch <= data.size()) {
+      std::uint32_t& head = head_[Hash(data.data() + i)];
+      if (head != 0 && i - (head - 1) <= kWindowSize) {
+        const std::size_t candidate = head - 1;
+        const std::size_t max_length =
+            std::min(kMaxMatch, data.size() - i);
+        while (length < max_length &&
+               data[candidate + length] == data[i + length]) {
+          ++length;
+        }
+        distance = i - candidate;
+      }
+      head = static_cast<std::uint32_t>(i + 1);
+    }
+    if (length >= kMinMatch) {
+      WriteMatch(length, distance, out);
+      i += length;
+    } else {
+      WriteLiteral(static_cast<unsigned char>(data[i]), out);
+      ++i;
+    }
+  }
+  WriteBits(kFixedCodes[256].bits, kFixedCodes[256].length, out);
+  if (final && num_bits_ > 0) {
+    WriteBits(0, 8 - num_bits_, out);
+  }
+}
+
+void DeflateEncoder::WriteBits(std::uint32_t bits, int count,
+                               std::string& out) {
+  bits_ |= static_cast<std::uint64_t>(bits) << num_bits_;
+  num_bits_ += count;
+  while (num_bits_ >= 8) {
+    out += static_cast<char>(bits_ & 0xFF);
+    bits_ >>= 8;
+    num_bits_ -= 8;
+  }
+}
+
+void DeflateEncoder::WriteLiteral(unsigned char literal, std::string& out) {
+  WriteBits(kFixedCodes[literal].bits, kFixedCodes[literal].length, out);
+}
+
+void DeflateEncoder::WriteMatch(std::size_t length, std::size_t distance,
+                                std::string& out) {
+  const std::size_t length_index =
+      std::upper_bound(std::begin(kLengthBase), std::end(kLengthBase),
+                       length) -
+      std::begin(kLengthBase) - 1;
+  const Code& code = kFixedCodes[257 + length_index];
+  WriteBits(code.bits, code.length, out);
+  WriteBits(static_cast<std::uint32_t>(length - kLengthBase[length_index]),
+            kLengthExtra[length_index], out);
+  const std::size_t distance_index =
+      std::upper_bound(std::begin(kDistanceBase), std::end(kDistanceBase),
+                       distance) -
+      std::begin(kDistanceBase) - 1;
+  WriteBits(ReverseBits(static_cast<std::uint32_t>(distance_index), 5), 5,
+            out);
+  WriteBits(
+      static_cast<std::uint32_t>(distance - kDistanceBase[distance_index]),
+      kDistanceExtra[distance_index], out);
+}
+
+std::string Gzip(std::string_view data) {
+  // Magic, DEFLATE, no flags, no modification time, no extra flags, unknown
+  // operating system.
+  std::string out("\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\xFF", 10);
+  DeflateEncoder().Compress(data, true, out);
+  AppendLittleEndian(out, Crc32(data));
+  AppendLittleEndian(out, static_cast<std::uint32_t>(data.size()));
+  return out;
+}
+
+}  // namespace gpx_to_kml
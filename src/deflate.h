@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// CRC-32 as used by gzip and PNG. Pass the previous result as `crc` to
+// continue a running checksum.
+std::uint32_t Crc32(std::string_view data, std::uint32_t crc = 0);
+
+// Adler-32 as used by zlib streams, continued from `adler`.
+std::uint32_t Adler32(std::string_view data, std::uint32_t adler = 1);
+
+// Minimal streaming DEFLATE compressor: greedy LZ77 matching through a single
+// entry hash table, coded with the fixed Huffman tables. It compresses far
+// worse than zlib on text but handles the long runs of our rasters and the
+// repetitive vector tiles well, without adding a zlib dependency.
+class DeflateEncoder {
+ public:
+  DeflateEncoder();
+
+  // Appends `data` as one block to `out`. Matches never reach back into
+  // earlier calls. The last call passes `final`, which also pads the stream
+  // to a byte boundary.
+  void Compress(std::string_view data, bool final, std::string& out);
+
+ private:
+  void WriteBits(std::uint32_t bits, int count, std::string& out);
+  void WriteLiteral(unsigned char literal, std::string& out);
+  void WriteMatch(std::size_t length, std::size_t distance, std::string& out);
+
+  std::uint64_t bits_ = 0;
+  int num_bits_ = 0;
+  // Most recent position + 1 of each hashed 4 byte sequence, 0 if none.
+  std::vector<std::uint32_t> head_;
+};
+
+// Compresses `data` into a single gzip member.
+std::string Gzip(std::string_view data);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,135 @@
+#include "directory-walker.h"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace gpx_to_kml {
+namespace {
+
+// Directories waiting to be listed, shared by all walker threads. The list is
+// unbounded as walkers add subdirectories while holding one to be listed.
+class DirectoryList {
+ public:
+  DirectoryList(const boost::filesystem::path& root, bool recursive,
+                const FileCallback& on_file, const WalkErrorCallback& on_error)
+      : root_(root),
+        recursive_(recursive),
+        on_file_(on_file),
+        on_error_(on_error),
+        pending_({root}) {}
+
+  // Lists directories until all have been listed or a walker failed.
+  void Run() {
+    try {
+      while (std::optional<boost::filesystem::path> directory = Next()) {
+        List(*directory);
+        Done();
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+      pending_.clear();
+      --num_listing_;
+      directory_available_.notify_all();
+    }
+  }
+
+  void RethrowError() const {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  // Blocks until a directory is available, returns std::nullopt once the walk
+  // has finished.
+  std::optional<boost::filesystem::path> Next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    directory_available_.wait(lock, [this]() {
+      return !pending_.empty() || num_listing_ == 0 || error_;
+    });
+    if (pending_.empty() || error_) {
+      return std::nullopt;
+    }
+    boost::filesystem::path directory = std::move(pending_.back());
+    pending_.pop_back();
+    ++num_listing_;
+    return directory;
+  }
+
+  void Done() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--num_listing_ == 0 && pending_.empty()) {
+      directory_available_.notify_all();
+    }
+  }
+
+  void Add(boost::filesystem::path directory) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.push_back(std::move(directory));
+    }
+    directory_available_.notify_one();
+  }
+
+  void List(const boost::filesystem::path& directory) {
+    boost::system::error_code error;
+    boost::filesystem::directory_iterator it(directory, error);
+    for (; !error && it != boost::filesystem::directory_iterator();
+         it.increment(error)) {
+      const boost::filesystem::directory_entry& entry = *it;
+      if (recursive_ &&
+          boost::filesystem::is_directory(entry.symlink_status())) {
+        Add(entry.path());
+      } else if (boost::filesystem::is_regular_file(entry.status())) {
+        on_file_(entry);
+      }
+    }
+    if (!error) {
+      return;
+    }
+    const boost::filesystem::filesystem_error failure(
+        "Failed listing directory", directory, error);
+    if (directory == root_) {
+      throw failure;
+    }
+    on_error_(failure.what());
+  }
+
+  const boost::filesystem::path root_;
+  const bool recursive_;
+  const FileCallback& on_file_;
+  const WalkErrorCallback& on_error_;
+  std::mutex mutex_;
+  std::condition_variable directory_available_;
+  std::vector<boost::filesystem::path> pending_;
+  // Directories taken by walkers which are not done yet.
+  std::size_t num_listing_ = 0;
+  std::exception_ptr error_;
+};
+
+}  // namespace
+
+void WalkDirectory(const boost::filesystem::path& root, bool recursive,
+                   std::size_t num_threads, const FileCallback& on_file,
+                   const WalkErrorCallback& on_error) {
+  DirectoryList directories(root, recursive, on_file, on_error);
+  // The calling thread walks as well. A flat directory has nothing to share.
+  std::vector<std::thread> helpers;
+  for (std::size_t i = 1; recursive && i < num_threads; ++i) {
+    helpers.emplace_back([&directories]() { directories.Run(); });
+  }
+  directories.Run();
+  for (std::thread& helper : helpers) {
+    helper.join();
+  }
+  directories.RethrowError();
+}
+
+}  // namespace gpx_to_kml
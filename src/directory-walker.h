@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Called for every file as soon as its directory entry has been read.
+using FileCallback =
+    std::function<void(const boost::filesystem::directory_entry& entry)>;
+// Called with a description of a subdirectory which could not be listed.
+using WalkErrorCallback = std::function<void(const std::string& error)>;
+
+// Calls `on_file` for every regular file in `root` and, if `recursive`, in all
+// of its subdirectories. Directories are listed by `num_threads` threads in
+// parallel, which call `on_file` concurrently. Symbolic links to directories
+// are not followed, so cycles are impossible.
+//
+// Failing to list `root` throws, failing to list a subdirectory is reported to
+// `on_error` and skips it. Exceptions thrown by `on_file` stop the walk and are
+// rethrown.
+void WalkDirectory(const boost::filesystem::path& root, bool recursive,
+                   std::size_t num_threads, const FileCallback& on_file,
+                   const WalkErrorCallback& on_error);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,190 @@
+#include "directory-watcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace gpx_to_kml {
+
+#ifdef __linux__
+
+namespace {
+
+// Closed after writing or moved in, a file may be complete. Modified, it is
+// still being written. Created or moved in directories are watched too.
+constexpr std::uint32_t kEvents =
+    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE | IN_ONLYDIR;
+
+}  // namespace
+
+DirectoryWatcher::DirectoryWatcher(const boost::filesystem::path& root,
+                                   bool recursive,
+                                   std::chrono::milliseconds settle)
+    : recursive_(recursive), settle_(settle) {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "inotify_init1");
+  }
+  try {
+    // The caller lists the files present, they aren't reported.
+    Watch(root, /*add_files=*/false);
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() { close(fd_); }
+
+void DirectoryWatcher::Watch(const boost::filesystem::path& directory,
+                             bool add_files) {
+  const int watch = inotify_add_watch(fd_, directory.c_str(), kEvents);
+  if (watch < 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "inotify_add_watch " + directory.string());
+  }
+  directories_[watch] = directory;
+  if (!recursive_ && !add_files) {
+    return;
+  }
+  boost::system::error_code error;
+  for (boost::filesystem::directory_iterator it(directory, error), end;
+       !error && it != end; it.increment(error)) {
+    const boost::filesystem::file_status status = it->symlink_status(error);
+    if (error) {
+      break;
+    }
+    if (recursive_ && boost::filesystem::is_directory(status)) {
+      Watch(it->path(), add_files);
+    } else if (add_files && boost::filesystem::is_regular_file(status)) {
+      pending_[it->path().string()] = Clock::now() + settle_;
+    }
+  }
+}
+
+void DirectoryWatcher::ReadEvents() {
+  alignas(inotify_event) char buffer[64 * 1024];
+  while (true) {
+    const ssize_t size = read(fd_, buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        return;
+      }
+      throw std::system_error(errno, std::system_category(), "read inotify");
+    }
+    const Clock::time_point settled = Clock::now() + settle_;
+    for (const char* p = buffer; p < buffer + size;) {
+      const auto& event = *reinterpret_cast<const inotify_event*>(p);
+      p += sizeof(inotify_event) + event.len;
+
+      if (event.mask & IN_Q_OVERFLOW) {
+        // Events were lost, every file may have changed.
+        for (const auto& [watch, directory] : directories_) {
+          boost::system::error_code error;
+          for (boost::filesystem::directory_iterator it(directory, error), end;
+               !error && it != end; it.increment(error)) {
+            const boost::filesystem::file_status status =
+                it->symlink_status(error);
+            if (!error && boost::filesystem::is_regular_file(status)) {
+              pending_[it->path().string()] = settled;
+            }
+          }
+        }
+        continue;
+      }
+      if (event.mask & IN_IGNORED) {
+        // The directory is gone.
+        directories_.erase(event.wd);
+        continue;
+      }
+      const auto directory = directories_.find(event.wd);
+      if (directory == directories_.end() || event.len == 0) {
+        continue;
+      }
+      const boost::filesystem::path path = directory->second / event.name;
+      if (event.mask & IN_ISDIR) {
+        if (recursive_ && (event.mask & (IN_CREATE | IN_MOVED_TO))) {
+          try {
+            Watch(path, /*add_files=*/true);
+          } catch (const std::system_error&) {
+            // Removed again already.
+          }
+        }
+      } else if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        pending_[path.string()] = settled;
+      } else if (event.mask & IN_MODIFY) {
+        // Written again after a close, it settles later.
+        if (const auto pending = pending_.find(path.string());
+            pending != pending_.end()) {
+          pending->second = settled;
+        }
+      }
+    }
+  }
+}
+
+std::vector<boost::filesystem::path> DirectoryWatcher::Wait(
+    std::chrono::milliseconds timeout) {
+  const Clock::time_point deadline = Clock::now() + timeout;
+  std::vector<boost::filesystem::path> settled;
+  while (true) {
+    const Clock::time_point now = Clock::now();
+    Clock::time_point next = deadline;
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (it->second <= now) {
+        settled.emplace_back(it->first);
+        it = pending_.erase(it);
+      } else {
+        next = std::min(next, it->second);
+        ++it;
+      }
+    }
+    if (!settled.empty() || now >= deadline) {
+      return settled;
+    }
+    // Rounded up, waking early would only spin.
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - now);
+    pollfd poll_fd{.fd = fd_, .events = POLLIN, .revents = 0};
+    const int ready = poll(&poll_fd, 1, static_cast<int>(wait.count()));
+    if (ready < 0) {
+      if (errno == EINTR) {
+        return settled;
+      }
+      throw std::system_error(errno, std::system_category(), "poll inotify");
+    }
+    if (ready > 0) {
+      ReadEvents();
+    }
+  }
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher(const boost::filesystem::path&, bool,
+                                   std::chrono::milliseconds)
+    : recursive_(false), settle_() {
+  throw std::invalid_argument(
+      "Watching directories is only supported on Linux");
+}
+
+DirectoryWatcher::~DirectoryWatcher() = default;
+
+std::vector<boost::filesystem::path> DirectoryWatcher::Wait(
+    std::chrono::milliseconds) {
+  return {};
+}
+
+#endif  // __linux__
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Reports files as they are written into a directory. A file is reported once
+// it has been closed after writing, or moved in, and then left alone for a
+// while, so writers which close and reopen a file aren't caught halfway.
+// Only supported on Linux, where it uses inotify. Not thread-safe.
+class DirectoryWatcher {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Watches `root` and, if `recursive`, its subdirectories, including the ones
+  // created later. Files are reported after `settle` without changes. Throws
+  // if the watches can't be set up.
+  DirectoryWatcher(const boost::filesystem::path& root, bool recursive,
+                   std::chrono::milliseconds settle);
+  ~DirectoryWatcher();
+
+  DirectoryWatcher(const DirectoryWatcher&) = delete;
+  DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+  // Returns the files which have settled, waiting up to `timeout` for the
+  // first one. Returns none on timeout or if a signal interrupted the wait.
+  std::vector<boost::filesystem::path> Wait(std::chrono::milliseconds timeout);
+
+ private:
+  // Watches `directory` and, if recursive, its subdirectories. With
+  // `add_files` the files found are reported too, for directories which may
+  // have been filled before they were watched.
+  void Watch(const boost::filesystem::path& directory, bool add_files);
+  // Handles the events which are ready without blocking.
+  void ReadEvents();
+
+  const bool recursive_;
+  const Clock::duration settle_;
+  int fd_ = -1;
+  // Watched directories by watch descriptor.
+  std::unordered_map<int, boost::filesystem::path> directories_;
+  // When each changed file settles, by path.
+  std::unordered_map<std::string, Clock::time_point> pending_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,163 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace gpx_to_kml {
+namespace {
+
+// 1e-5 degrees are about a meter.
+constexpr double kCoordinateScale = 1e5;
+// Consecutive points hashed together into a sample candidate. Shorter runs
+// match by chance, longer ones break at every point the copies differ in.
+constexpr std::size_t kWindow = 8;
+// One in 2^kSampleBits candidates is kept, chosen by its hash so copies keep
+// the same ones wherever they start.
+constexpr int kSampleBits = 4;
+// Near duplicates share this fraction of the shorter track's samples.
+constexpr double kNearDuplicateOverlap = 0.8;
+// Fewer samples than this are too few to compare tracks by.
+constexpr std::size_t kMinSamples = 4;
+
+// The finalizer of SplitMix64, spreads every input bit over the result.
+std::uint64_t Mix(std::uint64_t value) {
+  value ^= value >> 30;
+  value *= 0xBF58476D1CE4E5B9;
+  value ^= value >> 27;
+  value *= 0x94D049BB133111EB;
+  value ^= value >> 31;
+  return value;
+}
+
+std::uint64_t HashPoint(const Coordinate& coordinate) {
+  const std::int64_t lat = std::llround(coordinate.lat * kCoordinateScale);
+  const std::int64_t lon = std::llround(coordinate.lon * kCoordinateScale);
+  // Floored, times before the epoch round the same way as after it.
+  const std::int64_t seconds =
+      coordinate.time == kNoTime
+          ? kNoTime
+          : (coordinate.time >= 0 ? coordinate.time
+                                  : coordinate.time - 999) / 1000;
+  return Mix(static_cast<std::uint64_t>(lat) ^
+             Mix(static_cast<std::uint64_t>(lon) ^
+                 Mix(static_cast<std::uint64_t>(seconds))));
+}
+
+}  // namespace
+
+ActivityFingerprint Fingerprint(const Activity& activity) {
+  // Base of the rolling window hash and its power leaving the window.
+  constexpr std::uint64_t kBase = 0x100000001B3;
+  std::uint64_t outgoing_factor = 1;
+  for (std::size_t i = 1; i < kWindow; ++i) {
+    outgoing_factor *= kBase;
+  }
+
+  ActivityFingerprint fingerprint;
+  std::uint64_t window[kWindow];
+  std::uint64_t window_hash = 0;
+  std::uint64_t previous = 0;
+  for (const Coordinate& coordinate : activity.coordinates) {
+    const std::uint64_t point = HashPoint(coordinate);
+    if (fingerprint.num_points > 0 && point == previous) {
+      continue;
+    }
+    previous = point;
+    fingerprint.points_hash = Mix(fingerprint.points_hash + point);
+
+    std::uint64_t& slot = window[fingerprint.num_points % kWindow];
+    if (fingerprint.num_points >= kWindow) {
+      window_hash -= slot * outgoing_factor;
+    }
+    window_hash = window_hash * kBase + point;
+    slot = point;
+    ++fingerprint.num_points;
+    if (fingerprint.num_points >= kWindow) {
+      const std::uint64_t sample = Mix(window_hash);
+      if ((sample & ((1 << kSampleBits) - 1)) == 0) {
+        fingerprint.samples.push_back(sample);
+      }
+    }
+  }
+  std::sort(fingerprint.samples.begin(), fingerprint.samples.end());
+  fingerprint.samples.erase(
+      std::unique(fingerprint.samples.begin(), fingerprint.samples.end()),
+      fingerprint.samples.end());
+  return fingerprint;
+}
+
+std::optional<DuplicateIndex::Duplicate> DuplicateIndex::Add(
+    const ActivityFingerprint& fingerprint, const std::string& input) {
+  if (fingerprint.num_points == 0) {
+    return std::nullopt;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (const auto exact = by_points_hash_.find(fingerprint.points_hash);
+      exact != by_points_hash_.end()) {
+    std::string& original = originals_[exact->second].input;
+    if (input < original) {
+      // Later copies are reported as copies of this one.
+      return Duplicate{.kind = Kind::kExact,
+                       .copy = std::exchange(original, input),
+                       .original = input,
+                       .overlap = 1};
+    }
+    return Duplicate{.kind = Kind::kExact,
+                     .copy = input,
+                     .original = original,
+                     .overlap = 1};
+  }
+
+  std::optional<Duplicate> duplicate;
+  if (fingerprint.samples.size() >= kMinSamples) {
+    // Shared samples by original.
+    std::unordered_map<std::size_t, std::size_t> shared;
+    for (std::uint64_t sample : fingerprint.samples) {
+      if (const auto original = by_sample_.find(sample);
+          original != by_sample_.end()) {
+        ++shared[original->second];
+      }
+    }
+    for (const auto& [index, count] : shared) {
+      const Original& original = originals_[index];
+      if (original.num_samples < kMinSamples) {
+        continue;
+      }
+      const bool contained =
+          fingerprint.samples.size() <= original.num_samples;
+      const double overlap =
+          static_cast<double>(count) /
+          static_cast<double>(contained ? fingerprint.samples.size()
+                                        : original.num_samples);
+      // Ties go to the original sorting first, the map's order is arbitrary.
+      if (overlap >= kNearDuplicateOverlap &&
+          (!duplicate || overlap > duplicate->overlap ||
+           (overlap == duplicate->overlap &&
+            original.input < duplicate->original))) {
+        duplicate = Duplicate{
+            .kind = contained ? Kind::kContained : Kind::kContains,
+            .copy = input,
+            .original = original.input,
+            .overlap = overlap};
+      }
+    }
+  }
+
+  const std::size_t index = originals_.size();
+  originals_.push_back(
+      Original{.input = input, .num_samples = fingerprint.samples.size()});
+  by_points_hash_.emplace(fingerprint.points_hash, index);
+  for (std::uint64_t sample : fingerprint.samples) {
+    by_sample_.emplace(sample, index);
+  }
+  // The earlier copy keeps its entry, it has a track of its own.
+  if (duplicate && input < duplicate->original) {
+    std::swap(duplicate->copy, duplicate->original);
+    duplicate->kind = duplicate->kind == Kind::kContained ? Kind::kContains
+                                                          : Kind::kContained;
+  }
+  return duplicate;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "activity.h"
+
+namespace gpx_to_kml {
+
+// Identifies the track of an activity independently of how it was exported:
+// coordinates are rounded to about a meter, times to seconds, and repeated
+// points dropped, so names, elevations, extensions and the number of decimals
+// don't matter.
+struct ActivityFingerprint {
+  std::uint64_t points_hash = 0;
+  std::size_t num_points = 0;
+  // Hashes of a content defined subset of the runs of consecutive points,
+  // sorted. Copies with trimmed ends share most of them.
+  std::vector<std::uint64_t> samples;
+};
+
+ActivityFingerprint Fingerprint(const Activity& activity);
+
+// Finds activities whose tracks repeat those of others, exactly or with trimmed
+// ends. Of the copies of a track the one whose input sorts first counts as the
+// original, whatever the order of the calls. Thread-safe.
+class DuplicateIndex {
+ public:
+  enum class Kind {
+    // Same track.
+    kExact,
+    // Most of the track is part of the original's, e.g. a trimmed copy.
+    kContained,
+    // Most of the original's track is part of this one, e.g. the original is
+    // a trimmed copy.
+    kContains,
+  };
+
+  struct Duplicate {
+    Kind kind;
+    // The added input, or an earlier one if the added input sorts before the
+    // original it had, which makes it the original instead.
+    std::string copy;
+    std::string original;
+    // Of the shorter track, in [0, 1].
+    double overlap;
+  };
+
+  // Returns the duplicate the activity of `input` makes of an earlier one or
+  // the earlier one of it, if any, and adds it unless it's an exact duplicate.
+  // Activities without points never match.
+  std::optional<Duplicate> Add(const ActivityFingerprint& fingerprint,
+                               const std::string& input);
+
+ private:
+  struct Original {
+    std::string input;
+    std::size_t num_samples;
+  };
+
+  std::mutex mutex_;
+  std::vector<Original> originals_;
+  // Indices into originals_, by points hash and by sample. A sample shared by
+  // several originals only points to the first added.
+  std::unordered_map<std::uint64_t, std::size_t> by_points_hash_;
+  std::unordered_map<std::uint64_t, std::size_t> by_sample_;
+};
+
+}  // namespace gpx_to_kml
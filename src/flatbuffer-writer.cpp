@@ -0,0 +1,113 @@
+#include "flatbuffer-writer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace gpx_to_kml {
+
+std::size_t FlatBufferWriter::TableRef::field(std::uint16_t id) const {
+  for (const auto& [field_id, position] : offset_fields_) {
+    if (field_id == id) {
+      return position;
+    }
+  }
+  throw std::logic_error("No such offset field");
+}
+
+FlatBufferWriter::FlatBufferWriter() : buffer_(4, '\0') {}
+
+FlatBufferWriter::TableRef FlatBufferWriter::WriteTable(Table table) {
+  // Lay out the fields by descending size to minimize padding. The table
+  // starts with the 4 byte offset to its vtable.
+  std::stable_sort(table.fields_.begin(), table.fields_.end(),
+                   [](const Table::Field& a, const Table::Field& b) {
+                     return a.size > b.size;
+                   });
+  std::size_t alignment = 4;
+  std::size_t table_size = 4;
+  std::uint16_t num_slots = 0;
+  for (Table::Field& field : table.fields_) {
+    alignment = std::max(alignment, field.size);
+    table_size = (table_size + field.size - 1) / field.size * field.size;
+    field.position = table_size;
+    table_size += field.size;
+    num_slots = std::max<std::uint16_t>(num_slots, field.id + 1);
+  }
+
+  std::vector<std::uint16_t> vtable(2 + num_slots, 0);
+  vtable[0] = static_cast<std::uint16_t>(vtable.size() * 2);
+  vtable[1] = static_cast<std::uint16_t>(table_size);
+  for (const Table::Field& field : table.fields_) {
+    vtable[2 + field.id] = static_cast<std::uint16_t>(field.position);
+  }
+  Align(2);
+  const std::size_t vtable_position = buffer_.size();
+  Append(vtable.data(), vtable.size() * 2);
+
+  Align(alignment);
+  TableRef ref;
+  ref.position_ = buffer_.size();
+  const std::int32_t vtable_offset =
+      static_cast<std::int32_t>(ref.position_ - vtable_position);
+  std::string bytes(table_size, '\0');
+  std::memcpy(bytes.data(), &vtable_offset, 4);
+  for (const Table::Field& field : table.fields_) {
+    std::memcpy(bytes.data() + field.position, field.value, field.size);
+    if (field.is_offset) {
+      ref.offset_fields_.emplace_back(field.id,
+                                      ref.position_ + field.position);
+    }
+  }
+  buffer_ += bytes;
+  return ref;
+}
+
+std::size_t FlatBufferWriter::WriteString(std::string_view value) {
+  const std::size_t position = BeginVector(value.size(), 1);
+  buffer_ += value;
+  buffer_ += '\0';
+  return position;
+}
+
+std::size_t FlatBufferWriter::WriteBytes(std::string_view bytes) {
+  const std::size_t position = BeginVector(bytes.size(), 1);
+  buffer_ += bytes;
+  return position;
+}
+
+std::size_t FlatBufferWriter::WriteOffsetVector(std::size_t count) {
+  const std::size_t position = BeginVector(count, 4);
+  buffer_.append(count * 4, '\0');
+  return position;
+}
+
+void FlatBufferWriter::SetOffset(std::size_t at, std::size_t target) {
+  if (target <= at) {
+    throw std::logic_error("FlatBuffers offsets must point forward");
+  }
+  const std::uint32_t offset = static_cast<std::uint32_t>(target - at);
+  std::memcpy(buffer_.data() + at, &offset, 4);
+}
+
+void FlatBufferWriter::Align(std::size_t alignment) {
+  buffer_.append((alignment - buffer_.size() % alignment) % alignment, '\0');
+}
+
+void FlatBufferWriter::Append(const void* data, std::size_t size) {
+  buffer_.append(static_cast<const char*>(data), size);
+}
+
+std::size_t FlatBufferWriter::BeginVector(std::size_t count,
+                                          std::size_t element_size) {
+  Align(4);
+  // The elements directly follow the 4 byte length.
+  while ((buffer_.size() + 4) % std::max<std::size_t>(element_size, 4) != 0) {
+    buffer_.append(4, '\0');
+  }
+  const std::size_t position = buffer_.size();
+  const std::uint32_t length = static_cast<std::uint32_t>(count);
+  Append(&length, 4);
+  return position;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Minimal FlatBuffers serializer, just enough for the FlatGeobuf and Arrow
+// schemas. Unlike the official builder it writes front to back: a table is
+// written with placeholder offsets for its strings, vectors and sub-tables,
+// which are appended afterwards and linked with SetOffset(). All offsets
+// therefore point forward, as the format requires. Little-endian hosts only.
+class FlatBufferWriter {
+ public:
+  // Describes the fields of a table before it is written.
+  class Table {
+   public:
+    template <typename T>
+    Table& Scalar(std::uint16_t id, T value) {
+      Field field{.id = id, .size = sizeof(T)};
+      std::memcpy(field.value, &value, sizeof(T));
+      fields_.push_back(field);
+      return *this;
+    }
+
+    // A string, vector or table linked later via SetOffset().
+    Table& Offset(std::uint16_t id) {
+      fields_.push_back(Field{.id = id, .size = 4, .is_offset = true});
+      return *this;
+    }
+
+   private:
+    friend class FlatBufferWriter;
+
+    struct Field {
+      std::uint16_t id;
+      std::size_t size;
+      bool is_offset = false;
+      char value[8] = {};
+      // Position within the buffer once written.
+      std::size_t position = 0;
+    };
+
+    std::vector<Field> fields_;
+  };
+
+  // Position of a written table and its offset fields.
+  class TableRef {
+   public:
+    std::size_t position() const { return position_; }
+    // Position of the offset field `id`, to be passed to SetOffset().
+    std::size_t field(std::uint16_t id) const;
+
+   private:
+    friend class FlatBufferWriter;
+
+    std::size_t position_;
+    std::vector<std::pair<std::uint16_t, std::size_t>> offset_fields_;
+  };
+
+  // Reserves the root offset.
+  FlatBufferWriter();
+
+  TableRef WriteTable(Table table);
+  std::size_t WriteString(std::string_view value);
+  std::size_t WriteBytes(std::string_view bytes);
+
+  template <typename T>
+  std::size_t WriteVector(const T* data, std::size_t count) {
+    const std::size_t position = BeginVector(count, sizeof(T));
+    Append(data, count * sizeof(T));
+    return position;
+  }
+
+  // Vector of `count` offsets, element i lives at OffsetVectorElement(i).
+  std::size_t WriteOffsetVector(std::size_t count);
+  static std::size_t OffsetVectorElement(std::size_t vector, std::size_t i) {
+    return vector + 4 + 4 * i;
+  }
+
+  // Makes the offset stored at `at` point to `target`.
+  void SetOffset(std::size_t at, std::size_t target);
+  void SetRoot(const TableRef& table) { SetOffset(0, table.position()); }
+
+  const std::string& buffer() const { return buffer_; }
+  std::string Release() { return std::move(buffer_); }
+
+ private:
+  void Align(std::size_t alignment);
+  void Append(const void* data, std::size_t size);
+  // Aligns so that the length prefix is 4- and the elements are
+  // `element_size`-aligned, then writes the length.
+  std::size_t BeginVector(std::size_t count, std::size_t element_size);
+
+  std::string buffer_;
+};
+
+}  // namespace gpx_to_kml
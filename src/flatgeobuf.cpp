@@ -0,0 +1,399 @@
+#include "flatgeobuf.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "boost/format.hpp"
+#include "boost/nowide/cstdio.hpp"
+#include "flatbuffer-writer.h"
+#include "format.h"
+#include "parallel.h"
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr char kMagic[] = {'f', 'g', 'b', 3, 'f', 'g', 'b', 0};
+constexpr std::uint16_t kIndexNodeSize = 16;
+
+// Enum values from the FlatGeobuf schema.
+constexpr std::uint8_t kLineString = 2;
+constexpr std::uint8_t kColumnString = 11;
+constexpr std::uint8_t kColumnDateTime = 13;
+
+// Property columns, the index is the column id within the properties blob.
+constexpr std::uint16_t kNameColumn = 0;
+constexpr std::uint16_t kDateColumn = 1;
+
+// Table field ids from header.fbs and feature.fbs.
+namespace header {
+constexpr std::uint16_t kName = 0;
+constexpr std::uint16_t kEnvelope = 1;
+constexpr std::uint16_t kGeometryType = 2;
+constexpr std::uint16_t kHasZ = 3;
+constexpr std::uint16_t kColumns = 7;
+constexpr std::uint16_t kFeaturesCount = 8;
+constexpr std::uint16_t kIndexNodeSize = 9;
+constexpr std::uint16_t kCrs = 10;
+}  // namespace header
+namespace column {
+constexpr std::uint16_t kName = 0;
+constexpr std::uint16_t kType = 1;
+}  // namespace column
+namespace crs {
+constexpr std::uint16_t kOrg = 0;
+constexpr std::uint16_t kCode = 1;
+}  // namespace crs
+namespace geometry {
+constexpr std::uint16_t kXy = 1;
+constexpr std::uint16_t kZ = 2;
+constexpr std::uint16_t kType = 6;
+}  // namespace geometry
+namespace feature {
+constexpr std::uint16_t kGeometry = 0;
+constexpr std::uint16_t kProperties = 1;
+}  // namespace feature
+
+// Packed R-tree node as stored in the index.
+struct Node {
+  double min_x = std::numeric_limits<double>::infinity();
+  double min_y = std::numeric_limits<double>::infinity();
+  double max_x = -std::numeric_limits<double>::infinity();
+  double max_y = -std::numeric_limits<double>::infinity();
+  // Byte offset of the feature for leaves, index of the first child node
+  // otherwise.
+  std::uint64_t offset = 0;
+
+  void Expand(const Node& other) {
+    min_x = std::min(min_x, other.min_x);
+    min_y = std::min(min_y, other.min_y);
+    max_x = std::max(max_x, other.max_x);
+    max_y = std::max(max_y, other.max_y);
+  }
+};
+static_assert(sizeof(Node) == 40);
+
+// Maps a position on a 2^16 x 2^16 grid to its distance along the Hilbert
+// curve, see https://github.com/rawrunprotected/hilbert_curves.
+std::uint32_t Hilbert(std::uint32_t x, std::uint32_t y) {
+  std::uint32_t a = x ^ y;
+  std::uint32_t b = 0xFFFF ^ a;
+  std::uint32_t c = 0xFFFF ^ (x | y);
+  std::uint32_t d = x & (y ^ 0xFFFF);
+
+  std::uint32_t A = a | (b >> 1);
+  std::uint32_t B = (a >> 1) ^ a;
+  std::uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+  std::uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+
+  a = A;
+  b = B;
+  c = C;
+  d = D;
+  A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+  B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+  C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+  D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+
+  a = A;
+  b = B;
+  c = C;
+  d = D;
+  A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+  B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+  C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+  D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+
+  a = A;
+  b = B;
+  c = C;
+  d = D;
+  C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+  D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+
+  a = C ^ (C >> 1);
+  b = D ^ (D >> 1);
+
+  std::uint32_t i0 = x ^ y;
+  std::uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+  i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+  i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+  i0 = (i0 | (i0 << 2)) & 0x33333333;
+  i0 = (i0 | (i0 << 1)) & 0x55555555;
+
+  i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+  i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+  i1 = (i1 | (i1 << 2)) & 0x33333333;
+  i1 = (i1 | (i1 << 1)) & 0x55555555;
+
+  return (i1 << 1) | i0;
+}
+
+void AppendStringProperty(std::string& out, std::uint16_t column,
+                          std::string_view value) {
+  const std::uint32_t size = static_cast<std::uint32_t>(value.size());
+  out.append(reinterpret_cast<const char*>(&column), sizeof(column));
+  out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  out += value;
+}
+
+std::string SerializeHeader(const std::string& name, const Node& extent,
+                            std::uint64_t num_features) {
+  FlatBufferWriter writer;
+  FlatBufferWriter::Table table;
+  table.Offset(header::kName)
+      .Scalar<std::uint8_t>(header::kGeometryType, kLineString)
+      .Scalar<bool>(header::kHasZ, true)
+      .Offset(header::kColumns)
+      .Scalar<std::uint64_t>(header::kFeaturesCount, num_features)
+      .Scalar<std::uint16_t>(header::kIndexNodeSize,
+                             num_features > 0 ? kIndexNodeSize : 0)
+      .Offset(header::kCrs);
+  if (num_features > 0) {
+    table.Offset(header::kEnvelope);
+  }
+  const FlatBufferWriter::TableRef root = writer.WriteTable(table);
+  writer.SetRoot(root);
+
+  writer.SetOffset(root.field(header::kName), writer.WriteString(name));
+  if (num_features > 0) {
+    const double envelope[] = {extent.min_x, extent.min_y, extent.max_x,
+                               extent.max_y};
+    writer.SetOffset(root.field(header::kEnvelope),
+                     writer.WriteVector(envelope, 4));
+  }
+
+  const std::pair<std::string_view, std::uint8_t> columns[] = {
+      {"name", kColumnString}, {"date", kColumnDateTime}};
+  const std::size_t column_vector = writer.WriteOffsetVector(2);
+  writer.SetOffset(root.field(header::kColumns), column_vector);
+  for (std::size_t i = 0; i < 2; ++i) {
+    const FlatBufferWriter::TableRef column = writer.WriteTable(
+        FlatBufferWriter::Table()
+            .Offset(column::kName)
+            .Scalar<std::uint8_t>(column::kType, columns[i].second));
+    writer.SetOffset(FlatBufferWriter::OffsetVectorElement(column_vector, i),
+                     column.position());
+    writer.SetOffset(column.field(column::kName),
+                     writer.WriteString(columns[i].first));
+  }
+
+  const FlatBufferWriter::TableRef crs =
+      writer.WriteTable(FlatBufferWriter::Table()
+                            .Offset(crs::kOrg)
+                            .Scalar<std::int32_t>(crs::kCode, 4326));
+  writer.SetOffset(root.field(header::kCrs), crs.position());
+  writer.SetOffset(crs.field(crs::kOrg), writer.WriteString("EPSG"));
+  return writer.Release();
+}
+
+// Returns the size prefixed feature.
+std::string SerializeFeature(const Activity& activity) {
+  std::vector<double> xy;
+  std::vector<double> z;
+  xy.reserve(activity.coordinates.size() * 2);
+  z.reserve(activity.coordinates.size());
+  for (const Coordinate& coordinate : activity.coordinates) {
+    xy.push_back(coordinate.lon);
+    xy.push_back(coordinate.lat);
+    z.push_back(coordinate.alt);
+  }
+  std::string properties;
+  AppendStringProperty(properties, kNameColumn, activity.name);
+  std::string date;
+  AppendIsoTime(date, activity.time);
+  AppendStringProperty(properties, kDateColumn, date);
+
+  FlatBufferWriter writer;
+  const FlatBufferWriter::TableRef root =
+      writer.WriteTable(FlatBufferWriter::Table()
+                            .Offset(feature::kGeometry)
+                            .Offset(feature::kProperties));
+  writer.SetRoot(root);
+  const FlatBufferWriter::TableRef geometry =
+      writer.WriteTable(FlatBufferWriter::Table()
+                            .Offset(geometry::kXy)
+                            .Offset(geometry::kZ)
+                            .Scalar<std::uint8_t>(geometry::kType, kLineString));
+  writer.SetOffset(root.field(feature::kGeometry), geometry.position());
+  writer.SetOffset(geometry.field(geometry::kXy),
+                   writer.WriteVector(xy.data(), xy.size()));
+  writer.SetOffset(geometry.field(geometry::kZ),
+                   writer.WriteVector(z.data(), z.size()));
+  writer.SetOffset(root.field(feature::kProperties),
+                   writer.WriteBytes(properties));
+
+  const std::uint32_t size = static_cast<std::uint32_t>(writer.buffer().size());
+  std::string prefixed(reinterpret_cast<const char*>(&size), sizeof(size));
+  prefixed += writer.buffer();
+  return prefixed;
+}
+
+bool Seek(FILE* file, std::uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Builds the packed R-tree over `leaves`, which must already be in Hilbert
+// order. Levels are stored root first, the leaves come last.
+std::vector<Node> BuildIndex(const std::vector<Node>& leaves) {
+  std::vector<std::size_t> level_sizes = {leaves.size()};
+  std::size_t num_nodes = leaves.size();
+  for (std::size_t n = leaves.size(); n != 1;) {
+    n = (n + kIndexNodeSize - 1) / kIndexNodeSize;
+    level_sizes.push_back(n);
+    num_nodes += n;
+  }
+  // Offsets of each level, starting with the leaves.
+  std::vector<std::size_t> level_offsets;
+  for (std::size_t i = 0, end = num_nodes; i < level_sizes.size(); ++i) {
+    end -= level_sizes[i];
+    level_offsets.push_back(end);
+  }
+
+  std::vector<Node> nodes(num_nodes);
+  std::copy(leaves.begin(), leaves.end(), nodes.begin() + level_offsets[0]);
+  for (std::size_t level = 0; level + 1 < level_sizes.size(); ++level) {
+    const std::size_t children = level_offsets[level];
+    const std::size_t num_children = level_sizes[level];
+    const std::size_t parents = level_offsets[level + 1];
+    ParallelChunks(level_sizes[level + 1], [&](std::size_t begin,
+                                               std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        Node& parent = nodes[parents + i];
+        const std::size_t first = i * kIndexNodeSize;
+        parent.offset = children + first;
+        for (std::size_t j = first;
+             j < std::min<std::size_t>(first + kIndexNodeSize, num_children);
+             ++j) {
+          parent.Expand(nodes[children + j]);
+        }
+      }
+    });
+  }
+  return nodes;
+}
+
+}  // namespace
+
+FlatGeobufWriter::FlatGeobufWriter(const boost::filesystem::path& path,
+                                   Durability durability)
+    : file_(path, durability),
+      spill_path_(path.string() + ".features"),
+      spill_(boost::nowide::fopen(spill_path_.string().data(), "w+b")) {
+  if (!spill_) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Failed opening \"%s\"") % spill_path_.string()));
+  }
+}
+
+FlatGeobufWriter::~FlatGeobufWriter() {
+  fclose(spill_);
+  boost::system::error_code error;
+  boost::filesystem::remove(spill_path_, error);
+}
+
+void FlatGeobufWriter::Add(const Activity& activity) {
+  if (activity.coordinates.empty()) {
+    return;
+  }
+  Feature feature;
+  feature.min_x = feature.min_y = std::numeric_limits<double>::infinity();
+  feature.max_x = feature.max_y = -std::numeric_limits<double>::infinity();
+  for (const Coordinate& coordinate : activity.coordinates) {
+    feature.min_x = std::min(feature.min_x, coordinate.lon);
+    feature.min_y = std::min(feature.min_y, coordinate.lat);
+    feature.max_x = std::max(feature.max_x, coordinate.lon);
+    feature.max_y = std::max(feature.max_y, coordinate.lat);
+  }
+  const std::string serialized = SerializeFeature(activity);
+  feature.size = static_cast<std::uint32_t>(serialized.size());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fwrite(serialized.data(), 1, serialized.size(), spill_) !=
+      serialized.size()) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Failed writing to \"%s\"") % spill_path_.string()));
+  }
+  feature.spill_offset = spill_size_;
+  spill_size_ += serialized.size();
+  features_.push_back(feature);
+}
+
+void FlatGeobufWriter::Finish() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Node extent;
+  for (const Feature& feature : features_) {
+    extent.Expand(Node{.min_x = feature.min_x,
+                       .min_y = feature.min_y,
+                       .max_x = feature.max_x,
+                       .max_y = feature.max_y});
+  }
+  const double width = extent.max_x - extent.min_x;
+  const double height = extent.max_y - extent.min_y;
+  constexpr double kHilbertMax = (1 << 16) - 1;
+  ParallelChunks(features_.size(), [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      Feature& feature = features_[i];
+      const double x = width > 0 ? ((feature.min_x + feature.max_x) / 2 -
+                                    extent.min_x) / width
+                                 : 0;
+      const double y = height > 0 ? ((feature.min_y + feature.max_y) / 2 -
+                                     extent.min_y) / height
+                                  : 0;
+      feature.hilbert_value =
+          Hilbert(static_cast<std::uint32_t>(kHilbertMax * x),
+                  static_cast<std::uint32_t>(kHilbertMax * y));
+    }
+  });
+  ParallelSort(features_.begin(), features_.end(),
+               [](const Feature& a, const Feature& b) {
+                 return a.hilbert_value != b.hilbert_value
+                            ? a.hilbert_value > b.hilbert_value
+                            : a.spill_offset < b.spill_offset;
+               });
+
+  file_.Write(std::string_view(kMagic, sizeof(kMagic)));
+  const std::string header =
+      SerializeHeader(file_.path().stem().string(), extent, features_.size());
+  const std::uint32_t header_size = static_cast<std::uint32_t>(header.size());
+  file_.Write(std::string_view(reinterpret_cast<const char*>(&header_size),
+                               sizeof(header_size)));
+  file_.Write(header);
+
+  if (!features_.empty()) {
+    std::vector<Node> leaves(features_.size());
+    std::uint64_t offset = 0;
+    for (std::size_t i = 0; i < features_.size(); ++i) {
+      leaves[i] = Node{.min_x = features_[i].min_x,
+                       .min_y = features_[i].min_y,
+                       .max_x = features_[i].max_x,
+                       .max_y = features_[i].max_y,
+                       .offset = offset};
+      offset += features_[i].size;
+    }
+    const std::vector<Node> index = BuildIndex(leaves);
+    file_.Write(std::string_view(reinterpret_cast<const char*>(index.data()),
+                                 index.size() * sizeof(Node)));
+  }
+
+  std::string buffer;
+  for (const Feature& feature : features_) {
+    buffer.resize(feature.size);
+    if (!Seek(spill_, feature.spill_offset) ||
+        fread(buffer.data(), 1, buffer.size(), spill_) != buffer.size()) {
+      throw std::invalid_argument(boost::str(
+          boost::format("Failed reading \"%s\"") % spill_path_.string()));
+    }
+    file_.Write(buffer);
+  }
+  file_.Commit();
+}
+
+}  // namespace gpx_to_kml
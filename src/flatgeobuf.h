@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// Writes all activities into a single FlatGeobuf file, one LineString feature
+// with name and date properties per activity, spatially indexed by a packed
+// Hilbert R-tree.
+//
+// The index dictates the order of the features in the file, which is only
+// known once all activities have been added. Add() therefore serializes each
+// feature on the calling worker thread and appends it to a spill file, while
+// Finish() sorts and indexes the bounding boxes in parallel and then copies
+// the features behind the index in Hilbert order.
+class FlatGeobufWriter : public ActivitySink {
+ public:
+  FlatGeobufWriter(const boost::filesystem::path& path, Durability durability);
+  ~FlatGeobufWriter() override;
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  struct Feature {
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    // Size prefixed feature in the spill file.
+    std::uint64_t spill_offset;
+    std::uint32_t size;
+    std::uint32_t hilbert_value;
+  };
+
+  std::mutex mutex_;
+  std::vector<Feature> features_;
+  AtomicFile file_;
+  const boost::filesystem::path spill_path_;
+  FILE* spill_;
+  std::uint64_t spill_size_ = 0;
+};
+
+}  // namespace gpx_to_kml
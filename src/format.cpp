@@ -0,0 +1,100 @@
+#include "format.h"
+
+#include <charconv>
+#include <cstdio>
+
+#include "iso-time.h"
+
+namespace gpx_to_kml {
+
+void AppendFixed(std::string& out, double value, int precision) {
+  char buffer[64];
+  const std::to_chars_result result =
+      std::to_chars(buffer, buffer + sizeof(buffer), value,
+                    std::chars_format::fixed, precision);
+  if (result.ec == std::errc()) {
+    out.append(buffer, result.ptr);
+  } else {
+    // Only reachable for huge magnitudes which do not fit the buffer.
+    out += std::to_string(value);
+  }
+}
+
+void AppendIsoTime(std::string& out, const std::tm& time) {
+  char buffer[32];
+  out.append(buffer, std::strftime(buffer, sizeof(buffer),
+                                   "%Y-%m-%dT%H:%M:%SZ", &time));
+}
+
+void AppendIsoTime(std::string& out, std::int64_t epoch_milliseconds) {
+  constexpr std::int64_t kMillisecondsPerDay = 86400000;
+  std::int64_t days = epoch_milliseconds / kMillisecondsPerDay;
+  std::int64_t remainder = epoch_milliseconds % kMillisecondsPerDay;
+  if (remainder < 0) {
+    --days;
+    remainder += kMillisecondsPerDay;
+  }
+  const CivilDate date = CivilFromDays(days);
+  const auto digits = [](char* at, std::int64_t value, int count) {
+    for (int i = count - 1; i >= 0; --i) {
+      at[i] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    }
+  };
+  if (date.year >= 0 && date.year <= 9999) {
+    char year[4];
+    digits(year, date.year, 4);
+    out.append(year, 4);
+  } else {
+    // Never seen in real tracks, but keep the result unambiguous.
+    out += std::to_string(date.year);
+  }
+  char buffer[] = "-00-00T00:00:00.000";
+  digits(buffer + 1, date.month, 2);
+  digits(buffer + 4, date.day, 2);
+  digits(buffer + 7, remainder / 3600000, 2);
+  digits(buffer + 10, remainder / 60000 % 60, 2);
+  digits(buffer + 13, remainder / 1000 % 60, 2);
+  const std::int64_t milliseconds = remainder % 1000;
+  if (milliseconds == 0) {
+    out.append(buffer, 15);
+  } else {
+    digits(buffer + 16, milliseconds, 3);
+    out.append(buffer, 19);
+  }
+  out += 'Z';
+}
+
+void AppendJsonString(std::string& out, std::string_view value) {
+  out += '"';
+  for (char c : value) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+namespace gpx_to_kml {
+
+// Decimals written for latitude, longitude and altitude.
+constexpr int kCoordinatePrecision = 7;
+
+// Appends `value` with exactly `precision` decimals, like printf("%.*f").
+void AppendFixed(std::string& out, double value, int precision);
+
+// Appends `time` as an ISO 8601 UTC timestamp, e.g. "2022-01-10T08:00:00Z".
+void AppendIsoTime(std::string& out, const std::tm& time);
+
+// Appends milliseconds since the Unix epoch as an ISO 8601 UTC timestamp, with
+// a fraction only if there are milliseconds. Meant for per-point times, it
+// neither allocates nor goes through the locale like std::put_time.
+void AppendIsoTime(std::string& out, std::int64_t epoch_milliseconds);
+
+// Appends `value` as a quoted JSON string.
+void AppendJsonString(std::string& out, std::string_view value);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,63 @@
+#include "geojson.h"
+
+#include <cmath>
+
+#include "format.h"
+
+namespace gpx_to_kml {
+
+void AppendGeoJsonFeature(const Activity& activity, std::string& out) {
+  out += R"({"type":"Feature","properties":{"name":)";
+  AppendJsonString(out, activity.name);
+  out += R"(,"time":")";
+  AppendIsoTime(out, activity.time);
+  out += R"("},"geometry":{"type":"LineString","coordinates":[)";
+  bool first = true;
+  for (const Coordinate& coordinate : activity.coordinates) {
+    // JSON has no NaN or infinity. Positions without a place are left out,
+    // ones without a usable altitude are written without it.
+    if (!std::isfinite(coordinate.lon) || !std::isfinite(coordinate.lat)) {
+      continue;
+    }
+    if (!first) {
+      out += ',';
+    }
+    first = false;
+    out += '[';
+    AppendFixed(out, coordinate.lon, kCoordinatePrecision);
+    out += ',';
+    AppendFixed(out, coordinate.lat, kCoordinatePrecision);
+    if (std::isfinite(coordinate.alt)) {
+      out += ',';
+      AppendFixed(out, coordinate.alt, kCoordinatePrecision);
+    }
+    out += ']';
+  }
+  out += "]}}";
+}
+
+std::string FormatGeoJson(const Activity& activity) {
+  std::string out = R"({"type":"FeatureCollection","features":[)";
+  AppendGeoJsonFeature(activity, out);
+  out += "]}\n";
+  return out;
+}
+
+NdjsonWriter::NdjsonWriter(const boost::filesystem::path& path,
+                           Durability durability)
+    : file_(path, durability) {}
+
+void NdjsonWriter::Add(const Activity& activity) {
+  std::string line;
+  AppendGeoJsonFeature(activity, line);
+  line += '\n';
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_.Write(line);
+}
+
+void NdjsonWriter::Finish() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_.Commit();
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// Appends a GeoJSON Feature with a LineString geometry and the name and start
+// time of the activity as properties.
+void AppendGeoJsonFeature(const Activity& activity, std::string& out);
+
+// Formats a GeoJSON FeatureCollection containing only `activity`.
+std::string FormatGeoJson(const Activity& activity);
+
+// Writes all activities into a single newline-delimited GeoJSON file, one
+// Feature per line. Features are formatted on the calling thread, only the
+// append is serialized.
+class NdjsonWriter : public ActivitySink {
+ public:
+  NdjsonWriter(const boost::filesystem::path& path, Durability durability);
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  std::mutex mutex_;
+  AtomicFile file_;
+};
+
+}  // namespace gpx_to_kml
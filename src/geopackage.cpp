@@ -0,0 +1,358 @@
+#include "geopackage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "boost/format.hpp"
+#include "format.h"
+#include "sqlite3/sqlite3.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Rows queued between the workers and the writer thread.
+constexpr std::size_t kMaxQueuedRows = 1024;
+constexpr std::size_t kRowsPerTransaction = 50000;
+
+constexpr std::int32_t kSrsId = 4326;
+// ISO WKB geometry type of a LineString with Z coordinates.
+constexpr std::uint32_t kWkbLineStringZ = 1002;
+
+constexpr char kSchema[] = R"sql(
+PRAGMA application_id = 1196444487;
+PRAGMA user_version = 10300;
+
+CREATE TABLE gpkg_spatial_ref_sys (
+  srs_name TEXT NOT NULL,
+  srs_id INTEGER NOT NULL PRIMARY KEY,
+  organization TEXT NOT NULL,
+  organization_coordsys_id INTEGER NOT NULL,
+  definition TEXT NOT NULL,
+  description TEXT);
+INSERT INTO gpkg_spatial_ref_sys VALUES
+  ('Undefined cartesian SRS', -1, 'NONE', -1, 'undefined',
+   'undefined cartesian coordinate reference system'),
+  ('Undefined geographic SRS', 0, 'NONE', 0, 'undefined',
+   'undefined geographic coordinate reference system'),
+  ('WGS 84 geodetic', 4326, 'EPSG', 4326,
+   'GEOGCS["WGS 84",DATUM["WGS_1984",SPHEROID["WGS 84",6378137,298.257223563,AUTHORITY["EPSG","7030"]],AUTHORITY["EPSG","6326"]],PRIMEM["Greenwich",0,AUTHORITY["EPSG","8901"]],UNIT["degree",0.0174532925199433,AUTHORITY["EPSG","9122"]],AUTHORITY["EPSG","4326"]]',
+   'longitude/latitude coordinates in decimal degrees on the WGS 84 spheroid');
+
+CREATE TABLE gpkg_contents (
+  table_name TEXT NOT NULL PRIMARY KEY,
+  data_type TEXT NOT NULL,
+  identifier TEXT UNIQUE,
+  description TEXT DEFAULT '',
+  last_change DATETIME NOT NULL DEFAULT (strftime('%Y-%m-%dT%H:%M:%fZ','now')),
+  min_x DOUBLE,
+  min_y DOUBLE,
+  max_x DOUBLE,
+  max_y DOUBLE,
+  srs_id INTEGER,
+  CONSTRAINT fk_gc_r_srs_id FOREIGN KEY (srs_id)
+    REFERENCES gpkg_spatial_ref_sys(srs_id));
+INSERT INTO gpkg_contents (table_name, data_type, identifier, srs_id)
+  VALUES ('activities', 'features', 'activities', 4326);
+
+CREATE TABLE gpkg_geometry_columns (
+  table_name TEXT NOT NULL,
+  column_name TEXT NOT NULL,
+  geometry_type_name TEXT NOT NULL,
+  srs_id INTEGER NOT NULL,
+  z TINYINT NOT NULL,
+  m TINYINT NOT NULL,
+  CONSTRAINT pk_geom_cols PRIMARY KEY (table_name, column_name),
+  CONSTRAINT fk_gc_tn FOREIGN KEY (table_name)
+    REFERENCES gpkg_contents(table_name),
+  CONSTRAINT fk_gc_srs FOREIGN KEY (srs_id)
+    REFERENCES gpkg_spatial_ref_sys (srs_id));
+INSERT INTO gpkg_geometry_columns
+  VALUES ('activities', 'geom', 'LINESTRING', 4326, 1, 0);
+
+CREATE TABLE gpkg_extensions (
+  table_name TEXT,
+  column_name TEXT,
+  extension_name TEXT NOT NULL,
+  definition TEXT NOT NULL,
+  scope TEXT NOT NULL,
+  CONSTRAINT ge_tce UNIQUE (table_name, column_name, extension_name));
+INSERT INTO gpkg_extensions VALUES ('activities', 'geom', 'gpkg_rtree_index',
+  'http://www.geopackage.org/spec120/#extension_rtree', 'write-only');
+
+CREATE TABLE activities (
+  fid INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,
+  geom LINESTRINGZ,
+  name TEXT,
+  date DATETIME);
+CREATE VIRTUAL TABLE rtree_activities_geom
+  USING rtree(id, minx, maxx, miny, maxy);
+)sql";
+
+// Keeps the R-tree in sync with later edits by other tools. The ST_ functions
+// are provided by GeoPackage aware clients, which is why these triggers are
+// only created once this writer is done inserting.
+constexpr char kSpatialIndexTriggers[] = R"sql(
+CREATE TRIGGER rtree_activities_geom_insert AFTER INSERT ON activities
+  WHEN (new.geom NOT NULL AND NOT ST_IsEmpty(NEW.geom))
+BEGIN
+  INSERT OR REPLACE INTO rtree_activities_geom VALUES (NEW.fid,
+    ST_MinX(NEW.geom), ST_MaxX(NEW.geom), ST_MinY(NEW.geom), ST_MaxY(NEW.geom));
+END;
+CREATE TRIGGER rtree_activities_geom_update1 AFTER UPDATE OF geom ON activities
+  WHEN OLD.fid = NEW.fid AND (NEW.geom NOTNULL AND NOT ST_IsEmpty(NEW.geom))
+BEGIN
+  INSERT OR REPLACE INTO rtree_activities_geom VALUES (NEW.fid,
+    ST_MinX(NEW.geom), ST_MaxX(NEW.geom), ST_MinY(NEW.geom), ST_MaxY(NEW.geom));
+END;
+CREATE TRIGGER rtree_activities_geom_update2 AFTER UPDATE OF geom ON activities
+  WHEN OLD.fid = NEW.fid AND (NEW.geom ISNULL OR ST_IsEmpty(NEW.geom))
+BEGIN
+  DELETE FROM rtree_activities_geom WHERE id = OLD.fid;
+END;
+CREATE TRIGGER rtree_activities_geom_update3 AFTER UPDATE ON activities
+  WHEN OLD.fid != NEW.fid AND (NEW.geom NOTNULL AND NOT ST_IsEmpty(NEW.geom))
+BEGIN
+  DELETE FROM rtree_activities_geom WHERE id = OLD.fid;
+  INSERT OR REPLACE INTO rtree_activities_geom VALUES (NEW.fid,
+    ST_MinX(NEW.geom), ST_MaxX(NEW.geom), ST_MinY(NEW.geom), ST_MaxY(NEW.geom));
+END;
+CREATE TRIGGER rtree_activities_geom_update4 AFTER UPDATE ON activities
+  WHEN OLD.fid != NEW.fid AND (NEW.geom ISNULL OR ST_IsEmpty(NEW.geom))
+BEGIN
+  DELETE FROM rtree_activities_geom WHERE id IN (OLD.fid, NEW.fid);
+END;
+CREATE TRIGGER rtree_activities_geom_delete AFTER DELETE ON activities
+  WHEN old.geom NOT NULL
+BEGIN
+  DELETE FROM rtree_activities_geom WHERE id = OLD.fid;
+END;
+)sql";
+
+template <typename T>
+void AppendRaw(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// GeoPackage geometry blob: header with envelope followed by little-endian
+// ISO WKB.
+std::string EncodeGeometry(const Coordinates& coordinates,
+                           const double (&envelope)[4]) {
+  std::string blob = "GP";
+  blob += '\0';  // Version 1.
+  // Little-endian with a [minx, maxx, miny, maxy] envelope.
+  blob += static_cast<char>(0x01 | (1 << 1));
+  AppendRaw(blob, kSrsId);
+  for (double value : envelope) {
+    AppendRaw(blob, value);
+  }
+  blob += '\x01';
+  AppendRaw(blob, kWkbLineStringZ);
+  AppendRaw(blob, static_cast<std::uint32_t>(coordinates.size()));
+  for (const Coordinate& coordinate : coordinates) {
+    AppendRaw(blob, coordinate.lon);
+    AppendRaw(blob, coordinate.lat);
+    AppendRaw(blob, coordinate.alt);
+  }
+  return blob;
+}
+
+}  // namespace
+
+GeoPackageWriter::GeoPackageWriter(const boost::filesystem::path& path,
+                                   Durability durability)
+    : file_(path, durability) {
+  // Opens the empty temporary file as a new database. Nobody else sees it
+  // before the final rename, so there is no need for a rollback journal or
+  // syncs while it is being built; durability is applied by the commit.
+  Check(sqlite3_open(file_.temp_path().string().data(), &db_), "opening");
+  Execute("PRAGMA journal_mode = OFF");
+  Execute("PRAGMA synchronous = OFF");
+  Execute("PRAGMA cache_size = -65536");
+  CreateSchema();
+  Check(sqlite3_prepare_v2(
+            db_, "INSERT INTO activities (geom, name, date) VALUES (?, ?, ?)",
+            -1, &insert_, nullptr),
+        "preparing insert");
+  thread_ = std::thread([this]() { Run(); });
+}
+
+GeoPackageWriter::~GeoPackageWriter() {
+  Stop();
+  sqlite3_finalize(insert_);
+  sqlite3_close(db_);
+}
+
+void GeoPackageWriter::Add(const Activity& activity) {
+  if (activity.coordinates.empty()) {
+    return;
+  }
+  Row row;
+  row.envelope.min_x = row.envelope.min_y =
+      std::numeric_limits<double>::infinity();
+  row.envelope.max_x = row.envelope.max_y =
+      -std::numeric_limits<double>::infinity();
+  for (const Coordinate& coordinate : activity.coordinates) {
+    row.envelope.min_x = std::min(row.envelope.min_x, coordinate.lon);
+    row.envelope.max_x = std::max(row.envelope.max_x, coordinate.lon);
+    row.envelope.min_y = std::min(row.envelope.min_y, coordinate.lat);
+    row.envelope.max_y = std::max(row.envelope.max_y, coordinate.lat);
+  }
+  const double envelope[] = {row.envelope.min_x, row.envelope.max_x,
+                             row.envelope.min_y, row.envelope.max_y};
+  row.geometry = EncodeGeometry(activity.coordinates, envelope);
+  row.name = activity.name;
+  AppendIsoTime(row.date, activity.time);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_available_.wait(lock, [this]() {
+    return queue_.size() < kMaxQueuedRows || error_ || done_;
+  });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+  queue_.push_back(std::move(row));
+  rows_available_.notify_one();
+}
+
+void GeoPackageWriter::Finish() {
+  Stop();
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+  BuildSpatialIndex();
+  Execute(kSpatialIndexTriggers);
+  Check(sqlite3_finalize(insert_), "finalizing insert");
+  insert_ = nullptr;
+  Check(sqlite3_close(db_), "closing");
+  db_ = nullptr;
+  file_.Commit();
+}
+
+void GeoPackageWriter::Run() {
+  std::vector<Row> rows;
+  std::size_t num_in_transaction = 0;
+  try {
+    Execute("BEGIN");
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        rows_available_.wait(lock,
+                             [this]() { return done_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          break;
+        }
+        rows.swap(queue_);
+      }
+      space_available_.notify_all();
+      for (const Row& row : rows) {
+        sqlite3_bind_blob(insert_, 1, row.geometry.data(),
+                          static_cast<int>(row.geometry.size()),
+                          SQLITE_STATIC);
+        sqlite3_bind_text(insert_, 2, row.name.data(),
+                          static_cast<int>(row.name.size()), SQLITE_STATIC);
+        sqlite3_bind_text(insert_, 3, row.date.data(),
+                          static_cast<int>(row.date.size()), SQLITE_STATIC);
+        const int result = sqlite3_step(insert_);
+        if (result != SQLITE_DONE) {
+          Check(result, "inserting");
+        }
+        sqlite3_reset(insert_);
+        envelopes_.emplace_back(sqlite3_last_insert_rowid(db_), row.envelope);
+        if (++num_in_transaction == kRowsPerTransaction) {
+          Execute("COMMIT");
+          Execute("BEGIN");
+          num_in_transaction = 0;
+        }
+      }
+      rows.clear();
+    }
+    Execute("COMMIT");
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = std::current_exception();
+    space_available_.notify_all();
+  }
+}
+
+void GeoPackageWriter::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+  }
+  rows_available_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void GeoPackageWriter::Execute(const char* sql) {
+  char* message = nullptr;
+  if (sqlite3_exec(db_, sql, nullptr, nullptr, &message) != SQLITE_OK) {
+    const std::string error = message ? message : sqlite3_errmsg(db_);
+    sqlite3_free(message);
+    throw std::invalid_argument(boost::str(
+        boost::format("GeoPackage \"%s\": %s") % file_.path().string() %
+        error));
+  }
+}
+
+void GeoPackageWriter::Check(int result, const char* what) {
+  if (result != SQLITE_OK) {
+    throw std::invalid_argument(boost::str(
+        boost::format("GeoPackage \"%s\": failed %s: %s") %
+        file_.path().string() % what %
+        (db_ ? sqlite3_errmsg(db_) : sqlite3_errstr(result))));
+  }
+}
+
+void GeoPackageWriter::CreateSchema() {
+  Execute("BEGIN");
+  Execute(kSchema);
+  Execute("COMMIT");
+}
+
+void GeoPackageWriter::BuildSpatialIndex() {
+  Envelope extent = {std::numeric_limits<double>::infinity(),
+                     -std::numeric_limits<double>::infinity(),
+                     std::numeric_limits<double>::infinity(),
+                     -std::numeric_limits<double>::infinity()};
+  sqlite3_stmt* insert = nullptr;
+  Check(sqlite3_prepare_v2(
+            db_, "INSERT INTO rtree_activities_geom VALUES (?, ?, ?, ?, ?)",
+            -1, &insert, nullptr),
+        "preparing index insert");
+  std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> statement(
+      insert, sqlite3_finalize);
+  Execute("BEGIN");
+  for (const auto& [fid, envelope] : envelopes_) {
+    sqlite3_bind_int64(insert, 1, fid);
+    sqlite3_bind_double(insert, 2, envelope.min_x);
+    sqlite3_bind_double(insert, 3, envelope.max_x);
+    sqlite3_bind_double(insert, 4, envelope.min_y);
+    sqlite3_bind_double(insert, 5, envelope.max_y);
+    const int result = sqlite3_step(insert);
+    if (result != SQLITE_DONE) {
+      Check(result, "inserting into spatial index");
+    }
+    sqlite3_reset(insert);
+    extent.min_x = std::min(extent.min_x, envelope.min_x);
+    extent.max_x = std::max(extent.max_x, envelope.max_x);
+    extent.min_y = std::min(extent.min_y, envelope.min_y);
+    extent.max_y = std::max(extent.max_y, envelope.max_y);
+  }
+  if (extent.min_x <= extent.max_x) {
+    Execute(boost::str(boost::format(
+                           "UPDATE gpkg_contents SET min_x = %.9f, "
+                           "min_y = %.9f, max_x = %.9f, max_y = %.9f "
+                           "WHERE table_name = 'activities'") %
+                       extent.min_x % extent.min_y % extent.max_x %
+                       extent.max_y)
+                .data());
+  }
+  Execute("COMMIT");
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace gpx_to_kml {
+
+// Writes all activities into a single GeoPackage as LineStringZ features of
+// an "activities" table with name and date attributes.
+//
+// SQLite connections are single-threaded, so the workers only encode the
+// geometry blobs and hand the rows to a dedicated writer thread through a
+// bounded queue. The writer inserts them with a prepared statement in large
+// transactions. The R-tree spatial index is filled in one go by Finish(),
+// its maintenance triggers are only created afterwards.
+class GeoPackageWriter : public ActivitySink {
+ public:
+  GeoPackageWriter(const boost::filesystem::path& path, Durability durability);
+  ~GeoPackageWriter() override;
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  struct Envelope {
+    double min_x;
+    double max_x;
+    double min_y;
+    double max_y;
+  };
+
+  struct Row {
+    std::string geometry;
+    std::string name;
+    std::string date;
+    Envelope envelope;
+  };
+
+  void Run();
+  void Execute(const char* sql);
+  void Check(int result, const char* what);
+  void CreateSchema();
+  void BuildSpatialIndex();
+  // Stops the writer thread after it has inserted all queued rows.
+  void Stop();
+
+  AtomicFile file_;
+  sqlite3* db_ = nullptr;
+  sqlite3_stmt* insert_ = nullptr;
+
+  std::mutex mutex_;
+  std::condition_variable rows_available_;
+  std::condition_variable space_available_;
+  std::vector<Row> queue_;
+  bool done_ = false;
+  // Set by the writer thread if an insert failed.
+  std::exception_ptr error_;
+  std::thread thread_;
+
+  // Only accessed by the writer thread until it has been joined.
+  std::vector<std::pair<std::int64_t, Envelope>> envelopes_;
+};
+
+}  // namespace gpx_to_kml
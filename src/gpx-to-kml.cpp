@@ -1,254 +1,1816 @@
+#ifdef _WIN32
 #include <SDKDDKVer.h>
+#endif
 
+#include <algorithm>
 #include <atomic>
-#include <condition_variable>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
-#include <syncstream>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "boost/algorithm/string/case_conv.hpp"
+#include "boost/algorithm/string/classification.hpp"
+#include "boost/algorithm/string/split.hpp"
 #include "boost/algorithm/string/trim.hpp"
-#include "boost/asio.hpp"
 #include "boost/filesystem.hpp"
 #include "boost/format.hpp"
 #include "boost/lexical_cast.hpp"
-#include "boost/nowide/fstream.hpp"
+#include "boost/nowide/cstdio.hpp"
 #include "boost/program_options.hpp"
-#include "boost/regex.hpp"
-#include "boost/thread/thread.hpp"
+#include "activity.h"
+#include "adaptive-concurrency.h"
+#include "arrow-ipc.h"
+#include "coroutine.h"
+#include "directory-walker.h"
+#include "directory-watcher.h"
+#include "fingerprint.h"
+#include "flatgeobuf.h"
+#include "geopackage.h"
+#include "geojson.h"
+#include "gpx.h"
+#include "hash.h"
+#include "heatmap.h"
+#include "io-backend.h"
+#include "journal.h"
+#include "kml.h"
+#include "logger.h"
+#include "manifest.h"
+#include "output-names.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "run-report.h"
+#include "trace.h"
+#include "track-cache.h"
+#include "vector-tiles.h"
+#include "work-queue.h"
 #include "tinyxml2/tinyxml2.h"
 
 namespace {
 
-struct Coordinate {
-  double lat;
-  double lon;
-  double alt;
+using gpx_to_kml::Activity;
+using gpx_to_kml::ActivitySink;
+using gpx_to_kml::Coordinate;
+using gpx_to_kml::Coordinates;
+using gpx_to_kml::DuplicateIndex;
+using gpx_to_kml::Counters;
+using gpx_to_kml::FileRead;
+using gpx_to_kml::FileWrite;
+using gpx_to_kml::IoBackend;
+using gpx_to_kml::Log;
+using gpx_to_kml::LogError;
+using gpx_to_kml::LogMessage;
+using gpx_to_kml::ManifestEntry;
+using gpx_to_kml::OutputNames;
+using gpx_to_kml::ParseCoordinates;
+using gpx_to_kml::ParseName;
+using gpx_to_kml::ParseTime;
+using gpx_to_kml::PointExtension;
+using gpx_to_kml::ReportStage;
+using gpx_to_kml::RunReport;
+using gpx_to_kml::TraceSpan;
+using gpx_to_kml::Tracer;
+using gpx_to_kml::Verbosity;
+
+// Number of input files read per I/O backend call.
+constexpr std::size_t kReadBatchSize = 64;
+// Number of output files written per I/O backend call.
+constexpr std::size_t kWriteBatchSize = 64;
+// Bytes read at a time from the start of an input to find its output name.
+constexpr std::size_t kNameReadSize = 4096;
+// Longest wait for new inputs with --watch before checking for an interruption.
+constexpr std::chrono::milliseconds kWatchInterruptCheck(100);
+// Exit code of runs stopped by SIGINT, as shells report them.
+constexpr int kInterruptedExitCode = 128 + SIGINT;
+// Slowest files listed per stage by --report_file.
+constexpr std::size_t kReportSlowestFiles = 10;
+// Upper bounds of the concurrency tried by --jobs auto.
+constexpr std::size_t kMaxAdaptiveJobsPerCore = 4;
+constexpr std::size_t kMaxAdaptiveReads = 16;
+
+// An input which has been read and is waiting to be parsed.
+struct ReadFile {
+  FileRead input;
+  // Set if the input wasn't read, its activity is loaded from the track cache.
+  std::optional<std::uint64_t> content_hash = std::nullopt;
+  // When it entered the queue, shown by --trace_file.
+  Tracer::Clock::time_point queued = {};
+};
+
+// An input which has been parsed and is waiting to be formatted.
+struct ParsedFile {
+  boost::filesystem::path path;
+  Activity activity;
+  Tracer::Clock::time_point queued = {};
+};
+
+// An output on its way to the write stage.
+struct OutputWrite {
+  FileWrite write;
+  // Called on the write stage once the write has finished.
+  std::function<void(const FileWrite&)> on_written;
+  Tracer::Clock::time_point queued = {};
 };
 
-using Coordinates = std::vector<Coordinate>;
+// Formats written next to each input, selected by --formats.
+struct OutputFormats {
+  bool kml = false;
+  bool geojson = false;
+  // Write KML as a timed gx:Track where every point has a time.
+  bool kml_track = false;
+};
 
-std::tm ParseTime(const tinyxml2::XMLElement& root) {
-  const tinyxml2::XMLElement* element = root.FirstChildElement("metadata");
-  if (!element) {
-    throw std::invalid_argument("Missing metadata element");
+// Splits a comma separated flag value, dropping empty entries.
+std::vector<std::string> ParseList(const std::string& list) {
+  std::vector<std::string> names;
+  boost::algorithm::split(names, list, boost::algorithm::is_any_of(","));
+  for (std::string& name : names) {
+    boost::algorithm::trim(name);
   }
-  element = element->FirstChildElement("time");
-  if (!element) {
-    throw std::invalid_argument("Missing metadata time element");
+  std::erase(names, "");
+  return names;
+}
+
+OutputFormats ParseOutputFormats(const std::string& list) {
+  OutputFormats formats;
+  for (const std::string& name : ParseList(list)) {
+    if (name == "kml") {
+      formats.kml = true;
+    } else if (name == "geojson") {
+      formats.geojson = true;
+    } else {
+      throw std::invalid_argument(
+          boost::str(boost::format("Unknown output format: \"%s\"") % name));
+    }
   }
-  std::istringstream time_stream(element->GetText());
-  std::tm time;
-  time_stream >> std::get_time(&time, "%Y-%m-%dT%H:%M:%SZ");
-  if (time_stream.fail()) {
-    throw std::invalid_argument(element->GetText());
+  return formats;
+}
+
+// Shared by the writes of one activity, which is done once the last of them
+// has finished.
+struct PendingWrites {
+  std::atomic<std::size_t> remaining;
+  std::atomic<bool> failed = false;
+  std::function<void(bool failed)> done;
+};
+
+// The output name of `activity` before normalizing and disambiguating it.
+std::string OutputBasename(const Activity& activity) {
+  std::stringstream basename;
+  basename << std::put_time(&activity.time, "%Y-%m-%d") << " "
+           << activity.name;
+  return basename.str();
+}
+
+// Returns the outputs of `activity` which don't exist yet, possibly none if no
+// per-file formats are selected, and stores the claimed output name in `name`.
+// Throws if all of them exist.
+std::vector<FileWrite> FormatFiles(const Activity& activity,
+                                   const OutputFormats& formats,
+                                   const boost::filesystem::path& output_dir,
+                                   std::string_view input_stem,
+                                   OutputNames& output_names,
+                                   std::string* name_out) {
+  const std::string basename = OutputBasename(activity);
+  const std::string name = output_names.Claim(basename, input_stem);
+  *name_out = name;
+
+  std::vector<FileWrite> writes;
+  std::vector<std::string> skipped;
+  const auto add = [&](std::string_view extension, const auto& format) {
+    const std::string filename = name + std::string(extension);
+    // Outputs of an earlier conversion of the same input are replaced.
+    if (output_names.Existed(filename) &&
+        !output_names.Owns(name, input_stem)) {
+      skipped.push_back(filename);
+      return;
+    }
+    writes.push_back(FileWrite{.path = output_dir / filename,
+                               .contents = format(filename)});
+  };
+  if (formats.kml) {
+    const bool timed =
+        std::all_of(activity.coordinates.begin(), activity.coordinates.end(),
+                    [](const Coordinate& coordinate) {
+                      return coordinate.time != gpx_to_kml::kNoTime;
+                    });
+    add(".kml", [&](const std::string& filename) {
+      if (!formats.kml_track) {
+        return gpx_to_kml::FormatKml(activity, filename, basename);
+      }
+      if (!timed) {
+        Log(Verbosity::kNormal)
+            << "Not every track point has a valid time, writing a LineString: "
+            << output_dir / filename;
+        return gpx_to_kml::FormatKml(activity, filename, basename);
+      }
+      return gpx_to_kml::FormatKmlTrack(activity, filename, basename);
+    });
+  }
+  if (formats.geojson) {
+    add(".geojson", [&](const std::string&) {
+      return gpx_to_kml::FormatGeoJson(activity);
+    });
   }
-  return time;
+  if (writes.empty() && !skipped.empty()) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Output file already exists, skipping \"%s\"") %
+        (output_dir / skipped.front()).string()));
+  }
+  return writes;
 }
 
-std::string ParseName(const tinyxml2::XMLElement& track) {
-  const tinyxml2::XMLElement* name = track.FirstChildElement("name");
-  if (!name) {
-    throw std::invalid_argument("Missing name element");
+// Hands the outputs of one input to the write stage, which calls `done` once
+// all of them have been written. Calls it right away if there are none.
+void QueueWrites(std::vector<FileWrite> writes,
+                 gpx_to_kml::Stage<OutputWrite>& writer,
+                 std::function<void(bool failed)> done) {
+  if (writes.empty()) {
+    done(/*failed=*/false);
+    return;
+  }
+
+  auto pending = std::make_shared<PendingWrites>();
+  pending->remaining = writes.size();
+  pending->done = std::move(done);
+  for (FileWrite& write : writes) {
+    Log(Verbosity::kNormal) << "Writing: " << write.path;
+    writer.Push(OutputWrite{
+        .write = std::move(write),
+        .on_written = [pending](const FileWrite& written) {
+          if (!written.error.empty()) {
+            LogError() << "error: " << written.error;
+            pending->failed = true;
+          }
+          if (--pending->remaining == 0) {
+            pending->done(pending->failed);
+          }
+        },
+        .queued = Tracer::Clock::now()});
   }
-  return name->GetText();
 }
 
-Coordinates ParseCoordinates(const tinyxml2::XMLElement& track) {
-  const tinyxml2::XMLElement* segment = track.FirstChildElement("trkseg");
-  if (!segment) {
-    throw std::invalid_argument("Missing trkseg element");
+// Order in which inputs are converted.
+enum class Schedule {
+  // As the directory listing returns them, starting immediately.
+  kFifo,
+  // Largest first, once all inputs have been listed.
+  kLargestFirst,
+};
+
+Schedule ParseSchedule(std::string_view name) {
+  if (name == "fifo") {
+    return Schedule::kFifo;
+  }
+  if (name == "largest_first") {
+    return Schedule::kLargestFirst;
   }
+  throw std::invalid_argument(
+      boost::str(boost::format("Unknown schedule: \"%s\"") % name));
+}
+
+// What happens to activities which repeat earlier ones.
+enum class Duplicates {
+  // Not looked for.
+  kOff,
+  // Logged and converted.
+  kReport,
+  // Logged and only converted if they have more of the track than the
+  // original.
+  kSkip,
+};
 
-  Coordinates coordinates;
-  for (const tinyxml2::XMLElement* point = segment->FirstChildElement("trkpt");
-       point; point = point->NextSiblingElement("trkpt")) {
-    const tinyxml2::XMLAttribute* lat = point->FindAttribute("lat");
-    const tinyxml2::XMLAttribute* lon = point->FindAttribute("lon");
-    if (!lat || !lon) {
-      throw std::invalid_argument("Missing lat/lon attributes");
+Duplicates ParseDuplicates(std::string_view name) {
+  if (name == "off") {
+    return Duplicates::kOff;
+  }
+  if (name == "report") {
+    return Duplicates::kReport;
+  }
+  if (name == "skip") {
+    return Duplicates::kSkip;
+  }
+  throw std::invalid_argument(boost::str(
+      boost::format("Unknown duplicate handling: \"%s\"") % name));
+}
+
+// How the steps of each file are run.
+enum class Engine {
+  // A thread group per step, files are handed on through queues.
+  kPipeline,
+  // A coroutine per file, which gives up its thread while waiting for I/O.
+  kCoroutines,
+};
+
+Engine ParseEngine(std::string_view name) {
+  if (name == "pipeline") {
+    return Engine::kPipeline;
+  }
+  if (name == "coroutines") {
+    return Engine::kCoroutines;
+  }
+  throw std::invalid_argument(
+      boost::str(boost::format("Unknown engine: \"%s\"") % name));
+}
+
+struct Options {
+  std::string input_dir;
+  bool recursive;
+  std::size_t walk_threads;
+  Schedule schedule;
+  std::size_t chunked_parse_size;
+  // Defaults to input_dir.
+  std::optional<std::string> output_dir;
+  std::string io_backend;
+  gpx_to_kml::Durability durability;
+  OutputFormats formats;
+  Duplicates duplicates;
+  std::optional<std::string> ndjson_file;
+  std::optional<std::string> flatgeobuf_file;
+  std::optional<std::string> geopackage_file;
+  std::optional<std::string> arrow_file;
+  std::vector<std::string> arrow_extensions;
+  std::optional<std::string> tiles_output;
+  int tiles_min_zoom;
+  int tiles_max_zoom;
+  std::optional<std::string> heatmap_file;
+  int heatmap_zoom;
+  // Parse and format tasks running at the same time. With adaptive_jobs this
+  // and the number of concurrent reads are the starting points for tuning.
+  std::size_t jobs;
+  bool adaptive_jobs;
+  // Files queued per thread in front of the parse and format stages.
+  std::size_t queue_depth;
+  std::size_t read_threads;
+  std::size_t parse_threads;
+  std::size_t format_threads;
+  std::size_t write_threads;
+  Engine engine;
+  // Files the coroutine engine converts at the same time.
+  std::size_t files_in_flight;
+  // Zero disables progress reports.
+  std::chrono::milliseconds progress_interval;
+  std::optional<std::string> report_file;
+  std::optional<std::string> trace_file;
+  std::optional<std::string> journal_file;
+  std::optional<std::string> manifest_file;
+  std::optional<std::string> cache_dir;
+  bool watch;
+  // How long watched inputs must be left alone before they are converted.
+  std::chrono::milliseconds watch_settle;
+};
+
+// Parses --jobs and fills in the thread counts left at zero.
+void ResolveConcurrency(const std::string& jobs, Options& options) {
+  options.adaptive_jobs = jobs == "auto";
+  if (options.adaptive_jobs) {
+    options.jobs = gpx_to_kml::NumParallelThreads();
+  } else {
+    try {
+      options.jobs = boost::lexical_cast<std::size_t>(jobs);
+    } catch (const boost::bad_lexical_cast&) {
+      throw std::invalid_argument(
+          boost::str(boost::format("Invalid number of jobs: \"%s\"") % jobs));
     }
-    const tinyxml2::XMLElement* elevation = point->FirstChildElement("ele");
-    if (!elevation) {
-      throw std::invalid_argument("Missing ele element");
+    if (options.jobs == 0) {
+      options.jobs = gpx_to_kml::NumParallelThreads();
     }
-    coordinates.push_back(
-        Coordinate({.lat = boost::lexical_cast<double>(lat->Value()),
-                    .lon = boost::lexical_cast<double>(lon->Value()),
-                    .alt = boost::lexical_cast<double>(elevation->GetText())}));
   }
-  return coordinates;
+  // Adaptive runs start threads for the largest limits they may try.
+  const std::size_t max_jobs =
+      options.adaptive_jobs
+          ? kMaxAdaptiveJobsPerCore * gpx_to_kml::NumParallelThreads()
+          : options.jobs;
+  if (options.read_threads == 0) {
+    options.read_threads = options.adaptive_jobs ? kMaxAdaptiveReads : 1;
+  }
+  if (options.parse_threads == 0) {
+    options.parse_threads = max_jobs;
+  }
+  if (options.format_threads == 0) {
+    options.format_threads = max_jobs;
+  }
+  options.write_threads = std::max<std::size_t>(1, options.write_threads);
+  options.queue_depth = std::max<std::size_t>(1, options.queue_depth);
 }
 
-std::string NormalizeFilename(const std::string& filename) {
-  // List of illegal characters: https://stackoverflow.com/a/31976060
-  return boost::algorithm::trim_copy(
-      boost::regex_replace(filename, boost::regex(R"([<>:"\/\|\?\*])"), "_"));
+// Identifies an input below the input directory, which is its stem for files
+// directly in the input directory.
+std::string InputName(const boost::filesystem::path& path,
+                      const boost::filesystem::path& input_dir) {
+  const boost::filesystem::path relative = path.lexically_relative(input_dir);
+  if (relative.empty()) {
+    return path.stem().string();
+  }
+  return boost::filesystem::path(relative).replace_extension().generic_string();
 }
 
-void WriteFile(std::string_view name, const std::tm& time,
-               const Coordinates& coordinates,
-               const boost::filesystem::path& output_dir) {
-  std::stringstream basename;
-  basename << std::put_time(&time, "%Y-%m-%d") << " " << name;
-  std::stringstream filename;
-  filename << basename.str() << ".kml";
-  const boost::filesystem::path output_path =
-      output_dir / NormalizeFilename(filename.str());
-  if (boost::filesystem::exists(output_path)) {
-    throw std::invalid_argument(
-        boost::str(boost::format("Output file already exists, skipping \"%s\"") % output_path.string()));
-  }
-  std::osyncstream(std::cout) << "Writing: " << output_path << std::endl;
-  std::shared_ptr<FILE> file(
-      boost::nowide::fopen(output_path.string().data(), "w"), fclose);
-
-  tinyxml2::XMLDocument xml_doc;
-  xml_doc.InsertEndChild(xml_doc.NewDeclaration());
-
-  tinyxml2::XMLElement* root = xml_doc.NewElement("kml");
-  root->SetAttribute("xmlns", "http://www.opengis.net/kml/2.2");
-  root->SetAttribute("xmlns:gx", "http://www.google.com/kml/ext/2.2");
-  root->SetAttribute("xmlns:kml", "http://www.opengis.net/kml/2.2");
-  root->SetAttribute("xmlns:atom", "http://www.w3.org/2005/Atom");
-  tinyxml2::XMLElement* document = root->InsertNewChildElement("Document");
-  document->InsertNewChildElement("name")->SetText(filename.str().data());
-  tinyxml2::XMLElement* style = document->InsertNewChildElement("Style");
-  style->SetAttribute("id", "style1");
-  tinyxml2::XMLElement* line_style = style->InsertNewChildElement("LineStyle");
-  line_style->InsertNewChildElement("color")->SetText("ff0000ff");
-  line_style->InsertNewChildElement("width")->SetText("4");
-  tinyxml2::XMLElement* style_map = document->InsertNewChildElement("StyleMap");
-  style_map->SetAttribute("id", "stylemap_id00");
-  tinyxml2::XMLElement* pair = style_map->InsertNewChildElement("Pair");
-  pair->InsertNewChildElement("key")->SetText("normal");
-  pair->InsertNewChildElement("styleUrl")->SetText("style1");
-  pair = style_map->InsertNewChildElement("Pair");
-  pair->InsertNewChildElement("key")->SetText("highlight");
-  pair->InsertNewChildElement("styleUrl")->SetText("style1");
-
-  tinyxml2::XMLElement* place = document->InsertNewChildElement("Placemark");
-  place->InsertNewChildElement("name")->SetText(basename.str().data());
-  place->InsertNewChildElement("styleUrl")->SetText("#stylemap_id00");
-
-  std::stringstream coordinate_string;
-  coordinate_string.precision(7);
-  for (const Coordinate& coordinate : coordinates) {
-    coordinate_string << std::fixed << coordinate.lon << "," << coordinate.lat
-                      << "," << coordinate.alt << " ";
-  }
-  place->InsertNewChildElement("MultiGeometry")
-      ->InsertNewChildElement("LineString")
-      ->InsertNewChildElement("coordinates")
-      ->SetText(coordinate_string.str().data());
-  xml_doc.InsertEndChild(root);
-
-  if (xml_doc.SaveFile(file.get()) != tinyxml2::XML_SUCCESS) {
-    throw std::invalid_argument(
-        boost::str(boost::format("Failed writing to: \"%s\"") % output_path));
-  }
-}
-
-void ConvertFile(std::string_view input_file,
-                 const boost::filesystem::path& output_dir) {
+// Identifies an input in the journal and the manifest.
+std::string InputKey(const boost::filesystem::path& path,
+                     const boost::filesystem::path& input_dir) {
+  const boost::filesystem::path relative = path.lexically_relative(input_dir);
+  return (relative.empty() ? path : relative).generic_string();
+}
+
+// Identifies the options which affect the per-file outputs, a manifest entry
+// recorded with other ones is out of date.
+std::uint64_t OutputOptionsHash(const Options& options,
+                                const boost::filesystem::path& output_dir) {
+  std::string key = boost::str(
+      boost::format("kml=%d kml_track=%d geojson=%d output_dir=%s") %
+      options.formats.kml % options.formats.kml_track %
+      options.formats.geojson % output_dir.generic_string());
+  return gpx_to_kml::Xxh64(key);
+}
+
+std::invalid_argument InputError(const std::exception& error,
+                                 const boost::filesystem::path& path) {
+  return std::invalid_argument(
+      boost::str(boost::format("%s while parsing: \"%s\"") % error.what() %
+                 path.string()));
+}
+
+// Returns the offset of the first "<trkpt" tag at or after `offset`.
+std::size_t FindTrackPoint(std::string_view xml, std::size_t offset) {
+  constexpr std::string_view kTag = "<trkpt";
+  while ((offset = xml.find(kTag, offset)) != std::string_view::npos) {
+    const std::size_t end = offset + kTag.size();
+    if (end < xml.size() &&
+        (xml[end] == '>' || xml[end] == '/' ||
+         std::isspace(static_cast<unsigned char>(xml[end])))) {
+      return offset;
+    }
+    offset = end;
+  }
+  return xml.size();
+}
+
+// Splits the track points of large files into pieces which are parsed in
+// parallel, so a single huge track doesn't hold up the end of a run. Returns
+// std::nullopt if the file can't be split this way, e.g. because a piece isn't
+// well-formed on its own or the file is invalid. The caller then parses the
+// whole file, which also produces the proper error.
+std::optional<Activity> ParseActivityChunked(std::string_view xml) {
+  constexpr std::size_t kMinChunkSize = 1 << 20;
+  // The body of the first segment, which is the one ParseCoordinates() reads.
+  const std::size_t segment = xml.find("<trkseg");
+  if (segment == std::string_view::npos) {
+    return std::nullopt;
+  }
+  const std::size_t body_begin = xml.find('>', segment);
+  if (body_begin == std::string_view::npos || xml[body_begin - 1] == '/') {
+    return std::nullopt;
+  }
+  const std::size_t body_end = xml.find("</trkseg", body_begin);
+  if (body_end == std::string_view::npos) {
+    return std::nullopt;
+  }
+
+  // Everything but the points, whose first segment must be the one cut out.
+  std::string head(xml.substr(0, body_begin + 1));
+  head.append(xml.substr(body_end));
+  tinyxml2::XMLDocument head_doc;
+  if (head_doc.Parse(head.data(), head.size()) != tinyxml2::XML_SUCCESS) {
+    return std::nullopt;
+  }
+  const tinyxml2::XMLElement* root = head_doc.FirstChildElement("gpx");
+  const tinyxml2::XMLElement* track =
+      root ? root->FirstChildElement("trk") : nullptr;
+  const tinyxml2::XMLElement* first_segment =
+      track ? track->FirstChildElement("trkseg") : nullptr;
+  if (!first_segment || first_segment->FirstChild() ||
+      static_cast<std::ptrdiff_t>(first_segment->GetLineNum()) !=
+          1 + std::count(xml.begin(), xml.begin() + segment, '\n')) {
+    return std::nullopt;
+  }
+  Activity activity;
+  try {
+    activity.time = ParseTime(*root);
+    activity.name = ParseName(*track);
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+
+  const std::string_view body =
+      xml.substr(body_begin + 1, body_end - body_begin - 1);
+  const std::size_t num_chunks = std::min(gpx_to_kml::NumParallelThreads(),
+                                          body.size() / kMinChunkSize + 1);
+  std::vector<std::size_t> bounds = {0};
+  for (std::size_t i = 1; i < num_chunks; ++i) {
+    const std::size_t bound =
+        FindTrackPoint(body, body.size() * i / num_chunks);
+    if (bound > bounds.back() && bound < body.size()) {
+      bounds.push_back(bound);
+    }
+  }
+  bounds.push_back(body.size());
+
+  struct Chunk {
+    bool parsed = false;
+    Coordinates coordinates;
+    std::vector<PointExtension> extensions;
+  };
+  std::vector<Chunk> chunks(bounds.size() - 1);
+  gpx_to_kml::ParallelChunks(chunks.size(), [&](std::size_t begin,
+                                                std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      std::string piece = "<trk><trkseg>";
+      piece.append(body.substr(bounds[i], bounds[i + 1] - bounds[i]));
+      piece.append("</trkseg></trk>");
+      tinyxml2::XMLDocument doc;
+      if (doc.Parse(piece.data(), piece.size()) != tinyxml2::XML_SUCCESS) {
+        continue;
+      }
+      try {
+        chunks[i].coordinates = ParseCoordinates(
+            *doc.FirstChildElement("trk"), &chunks[i].extensions);
+        chunks[i].parsed = true;
+      } catch (const std::exception&) {
+      }
+    }
+  });
+
+  for (Chunk& chunk : chunks) {
+    if (!chunk.parsed) {
+      return std::nullopt;
+    }
+    // Extensions keep the order of their first appearance, points which lack
+    // one are NaN.
+    const std::size_t offset = activity.coordinates.size();
+    for (PointExtension& extension : chunk.extensions) {
+      auto merged = std::find_if(
+          activity.extensions.begin(), activity.extensions.end(),
+          [&](const PointExtension& existing) {
+            return existing.name == extension.name;
+          });
+      if (merged == activity.extensions.end()) {
+        merged = activity.extensions.insert(
+            activity.extensions.end(), PointExtension{.name = extension.name});
+      }
+      merged->values.resize(offset, std::numeric_limits<double>::quiet_NaN());
+      merged->values.insert(merged->values.end(), extension.values.begin(),
+                            extension.values.end());
+    }
+    activity.coordinates.insert(activity.coordinates.end(),
+                                chunk.coordinates.begin(),
+                                chunk.coordinates.end());
+  }
+  for (PointExtension& extension : activity.extensions) {
+    extension.values.resize(activity.coordinates.size(),
+                            std::numeric_limits<double>::quiet_NaN());
+  }
+  return activity;
+}
+
+// Files of at least `chunked_parse_size` bytes are parsed in parallel pieces,
+// zero disables this. `report` may be null.
+Activity ParseActivity(const FileRead& input, std::size_t chunked_parse_size,
+                       RunReport* report) {
   try {
+    if (!input.error.empty()) {
+      throw std::invalid_argument(input.error);
+    }
+    auto start = RunReport::Clock::now();
+    if (chunked_parse_size > 0 && input.contents.size() >= chunked_parse_size) {
+      if (std::optional<Activity> activity =
+              ParseActivityChunked(input.contents)) {
+        // The pieces parse their XML and coordinates in one go.
+        if (report) {
+          report->Record(ReportStage::kParseCoordinates, start, input.path);
+        }
+        return std::move(*activity);
+      }
+    }
     tinyxml2::XMLDocument xml_doc;
-    if (xml_doc.LoadFile(input_file.data()) != tinyxml2::XML_SUCCESS) {
+    if (xml_doc.Parse(input.contents.data(), input.contents.size()) !=
+        tinyxml2::XML_SUCCESS) {
       throw std::invalid_argument(boost::str(
           boost::format("Failed reading XML file %s") % xml_doc.ErrorStr()));
     }
+    if (report) {
+      report->Record(ReportStage::kParseXml, start, input.path);
+      start = RunReport::Clock::now();
+    }
     const tinyxml2::XMLElement* root = xml_doc.FirstChildElement("gpx");
     if (!root) {
       throw std::invalid_argument("Missing root element");
     }
 
-    const std::tm time = ParseTime(*root);
+    Activity activity;
+    activity.time = ParseTime(*root);
 
     const tinyxml2::XMLElement* track = root->FirstChildElement("trk");
     if (!track) {
       throw std::invalid_argument("Missing trk element");
     }
 
-    const std::string name = ParseName(*track);
-    const Coordinates coordinates = ParseCoordinates(*track);
+    activity.name = ParseName(*track);
+    activity.coordinates = ParseCoordinates(*track, &activity.extensions);
+    if (report) {
+      report->Record(ReportStage::kParseCoordinates, start, input.path);
+    }
+    return activity;
+  } catch (const std::exception& error) {
+    throw InputError(error, input.path);
+  }
+}
+
+// Load balance is the share of the makespan the `num_threads` threads doing
+// the tasks were busy.
+void PrintTaskTimes(std::string_view name, std::size_t num_threads,
+                    const gpx_to_kml::TaskTimes& times) {
+  const gpx_to_kml::TaskTimes::Summary summary = times.summary();
+  if (summary.count == 0) {
+    return;
+  }
+  Log(Verbosity::kVerbose)
+      << "Tasks " << name << ": " << summary.count << " took " << std::fixed
+      << std::setprecision(2) << summary.total_seconds << " s, longest "
+      << summary.max_seconds << " s, makespan " << summary.makespan_seconds
+      << " s, load balance " << std::setprecision(0)
+      << 100 * summary.total_seconds /
+             (summary.makespan_seconds * static_cast<double>(num_threads))
+      << "%";
+}
+
+template <typename T>
+void PrintStageStats(const gpx_to_kml::Stage<T>& stage) {
+  const gpx_to_kml::QueueStats stats = stage.stats();
+  Log(Verbosity::kVerbose) << "Stage " << stage.name() << ": "
+                           << stage.num_threads()
+                           << " threads, queue depth max " << stats.max_depth
+                           << " mean " << std::fixed << std::setprecision(1)
+                           << stats.mean_depth;
+}
+
+// Inputs a --watch run has dispatched and not finished converting yet, with
+// the size and modification time they were dispatched with. The watcher may
+// report inputs which the initial listing dispatched already, those aren't
+// converted twice unless they changed. Thread-safe.
+class InFlightInputs {
+ public:
+  // Returns false if `path` is in flight unchanged.
+  bool Add(const boost::filesystem::path& path) {
+    boost::system::error_code error;
+    const std::uintmax_t size = boost::filesystem::file_size(path, error);
+    const std::time_t mtime =
+        error ? 0 : boost::filesystem::last_write_time(path, error);
+    const Version version{.size = error ? 0 : size, .mtime = error ? 0 : mtime};
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto [input, added] = inputs_.try_emplace(path.string(), version);
+    if (added) {
+      return true;
+    }
+    if (input->second.size == version.size &&
+        input->second.mtime == version.mtime) {
+      return false;
+    }
+    input->second = version;
+    return true;
+  }
+
+  void Remove(const boost::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    inputs_.erase(path.string());
+  }
+
+ private:
+  struct Version {
+    std::uintmax_t size;
+    std::time_t mtime;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, Version> inputs_;
+};
+
+// Inputs converted with --duplicates=skip, until a copy which sorts before them
+// turns up and makes them duplicates of it. The outputs of those are removed,
+// once written if they aren't yet. Thread-safe.
+class ConvertedInputs {
+ public:
+  // Records that the outputs of `path`, named `name`, have been written.
+  // Returns false if it has been dropped meanwhile, its outputs are the
+  // caller's to remove then.
+  bool Finish(const boost::filesystem::path& path, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dropped_.erase(path.string()) > 0) {
+      ++num_dropped_;
+      return false;
+    }
+    names_.insert_or_assign(path.string(), name);
+    return true;
+  }
 
-    WriteFile(name, time, coordinates, output_dir);
+  // Drops `path`. Returns the name of its outputs if they have been written,
+  // those are the caller's to remove.
+  std::optional<std::string> Drop(const boost::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto finished = names_.extract(path.string())) {
+      ++num_dropped_;
+      return std::move(finished.mapped());
+    }
+    dropped_.insert(path.string());
+    return std::nullopt;
+  }
+
+  // Inputs counted as succeeded which have been dropped since.
+  std::uint64_t num_dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_dropped_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  // Output names by finished input.
+  std::unordered_map<std::string, std::string> names_;
+  // Inputs dropped before they finished.
+  std::unordered_set<std::string> dropped_;
+  std::uint64_t num_dropped_ = 0;
+};
+
+// State shared by all files of a run, whichever engine converts them.
+struct Conversion {
+  const Options& options;
+  boost::filesystem::path output_dir;
+  // The resolved backend name, never "auto".
+  std::string io_backend;
+  OutputNames& output_names;
+  const std::vector<std::unique_ptr<ActivitySink>>& sinks;
+  // Null unless --report_file asks for a report.
+  RunReport* report;
+  // Null unless --trace_file asks for a trace.
+  Tracer* tracer;
+  // Null unless --journal_file asks for one.
+  gpx_to_kml::Journal* journal;
+  // Null unless --manifest_file asks for one.
+  gpx_to_kml::Manifest* manifest;
+  // Null with --duplicates=off.
+  gpx_to_kml::DuplicateIndex* duplicates;
+  // Null unless --duplicates=skip.
+  ConvertedInputs* converted;
+  // Null unless --watch.
+  InFlightInputs* in_flight;
+  // Null unless --cache_dir asks for one.
+  gpx_to_kml::TrackCache* cache;
+  Counters counters = {};
+  gpx_to_kml::TaskTimes parse_times = {};
+  gpx_to_kml::TaskTimes format_times = {};
+  // Set once every input present at the start has been dispatched. Those are
+  // all converted even if the run is interrupted later, e.g. to stop --watch.
+  bool listed_all = false;
+};
+
+// Set by the first SIGINT, once the files in flight have been converted the
+// run stops. A second one terminates the process.
+std::atomic<bool> interrupted = false;
+
+void Interrupt(int signal) {
+  interrupted = true;
+  std::signal(signal, SIG_DFL);
+}
+
+// Ends the conversion of a dispatched input, counting it in `outcome`.
+void EndInput(Conversion& conversion, const boost::filesystem::path& path,
+              gpx_to_kml::ShardedCounter& outcome) {
+  ++outcome;
+  if (conversion.in_flight) {
+    conversion.in_flight->Remove(path);
+  }
+}
+
+// The filenames of the per-file outputs named `name`.
+std::vector<std::string> OutputFilenames(const std::string& name,
+                                         const OutputFormats& formats) {
+  std::vector<std::string> filenames;
+  if (formats.kml) {
+    filenames.push_back(name + ".kml");
+  }
+  if (formats.geojson) {
+    filenames.push_back(name + ".geojson");
+  }
+  return filenames;
+}
+
+// Returns true if the outputs the manifest recorded for `input` are all still
+// there.
+bool OutputsExist(const Conversion& conversion, const std::string& input) {
+  const ManifestEntry& entry = conversion.manifest->loaded().at(input);
+  return std::all_of(entry.outputs.begin(), entry.outputs.end(),
+                     [&](const std::string& output) {
+                       return conversion.output_names.Existed(output);
+                     });
+}
+
+// Returns the content hash of `path` if the manifest knows it without reading
+// the input and the track cache has its activity, the input needn't be read
+// then. It counts as read, progress reports measure against the listed sizes.
+std::optional<std::uint64_t> SkipRead(Conversion& conversion,
+                                      const boost::filesystem::path& path) {
+  if (!conversion.cache || !conversion.manifest) {
+    return std::nullopt;
+  }
+  const std::string key = InputKey(path, conversion.options.input_dir);
+  const std::optional<std::uint64_t> content_hash =
+      conversion.manifest->KnownContentHash(key);
+  if (!content_hash || !conversion.cache->Contains(*content_hash)) {
+    return std::nullopt;
+  }
+  conversion.counters.read_bytes.Add(
+      conversion.manifest->loaded().at(key).size);
+  return content_hash;
+}
+
+// The hash the manifest and the track cache know `input` by, `known` if it
+// wasn't read. Zero if neither is used or reading failed.
+std::uint64_t ContentHash(const Conversion& conversion, const FileRead& input,
+                          std::optional<std::uint64_t> known) {
+  if (known) {
+    return *known;
+  }
+  if ((!conversion.manifest && !conversion.cache) || !input.error.empty()) {
+    return 0;
+  }
+  return gpx_to_kml::Xxh64(input.contents);
+}
+
+// Returns true if `input` has the contents recorded in the manifest, hashing to
+// `content_hash`, and its outputs are still there, it needn't be converted
+// again then.
+bool UnchangedContents(Conversion& conversion, const FileRead& input,
+                       std::uint64_t content_hash) {
+  if (!conversion.manifest || !input.error.empty()) {
+    return false;
+  }
+  const std::string key = InputKey(input.path, conversion.options.input_dir);
+  if (!conversion.manifest->Hashed(key, content_hash) ||
+      !OutputsExist(conversion, key)) {
+    return false;
+  }
+  conversion.manifest->Keep(key);
+  EndInput(conversion, input.path, conversion.counters.skipped);
+  return true;
+}
+
+// Returns the activity of `input` from the track cache, else parses it and adds
+// it to the cache. If the input wasn't `read` because its activity was cached,
+// it is read after all should loading that fail.
+Activity LoadActivity(Conversion& conversion, FileRead& input,
+                      std::uint64_t content_hash, bool read) {
+  if (!conversion.cache) {
+    return ParseActivity(input, conversion.options.chunked_parse_size,
+                         conversion.report);
+  }
+  const auto start = RunReport::Clock::now();
+  if (std::optional<Activity> activity =
+          conversion.cache->Load(content_hash)) {
+    if (conversion.report) {
+      conversion.report->Record(ReportStage::kLoadCache, start, input.path);
+    }
+    return std::move(*activity);
+  }
+  if (!read) {
+    // Removed or damaged since SkipRead() found it.
+    Log(Verbosity::kVerbose) << "Not in the track cache anymore: "
+                             << input.path;
+    std::vector<FileRead> batch{FileRead{.path = input.path}};
+    gpx_to_kml::CreateIoBackend(conversion.io_backend)->Read(batch);
+    input = std::move(batch.front());
+    content_hash = ContentHash(conversion, input, std::nullopt);
+  }
+  Activity activity = ParseActivity(
+      input, conversion.options.chunked_parse_size, conversion.report);
+  try {
+    conversion.cache->Store(content_hash, activity);
   } catch (const std::exception& error) {
-    throw std::invalid_argument(
-        boost::str(boost::format("%s while parsing: \"%s\"") % error.what() % input_file));
+    // The conversion doesn't need it.
+    LogError() << "error: Failed caching " << input.path << ": "
+               << error.what();
   }
+  return activity;
 }
 
-void Main(std::string_view input_dir,
-          std::optional<std::string_view> output_dir_string) {
-  if (!output_dir_string.has_value()) {
-    output_dir_string = input_dir;
+// Records an input which needs no converting anymore in the journal and the
+// manifest, with its output name and outputs, both empty if it has none.
+// Outputs of an earlier conversion which weren't replaced are removed.
+void RecordInput(Conversion& conversion, const boost::filesystem::path& path,
+                 const std::string& name, std::vector<std::string> outputs) {
+  const std::string key = InputKey(path, conversion.options.input_dir);
+  if (conversion.journal) {
+    conversion.journal->Add(key, name);
   }
-  const boost::filesystem::path output_dir(output_dir_string->data());
-  if (!boost::filesystem::is_directory(output_dir)) {
-    throw std::invalid_argument(boost::str(boost::format("Not a directory: \"%s\"") %
-                                *output_dir_string));
+  if (conversion.manifest) {
+    for (const std::string& stale :
+         conversion.manifest->Converted(key, name, std::move(outputs))) {
+      const boost::filesystem::path stale_path =
+          conversion.output_dir / stale;
+      Log(Verbosity::kNormal) << "Removing: " << stale_path;
+      boost::system::error_code error;
+      boost::filesystem::remove(stale_path, error);
+      if (error) {
+        LogError() << "error: Failed removing " << stale_path << ": "
+                   << error.message();
+      }
+    }
   }
+}
 
-  boost::asio::io_service io_service;
-  boost::asio::io_service::work work(io_service);
-  boost::thread_group threads;
-  for (std::size_t i = 0; i < std::thread::hardware_concurrency(); ++i) {
-    threads.create_thread(
-        boost::bind(&boost::asio::io_service::run, &io_service));
+// Removes the per-file outputs, named `name`, of the converted input at `path`
+// and records it as skipped.
+void DropOutputs(Conversion& conversion, const boost::filesystem::path& path,
+                 const std::string& name) {
+  for (const std::string& filename :
+       OutputFilenames(name, conversion.options.formats)) {
+    const boost::filesystem::path output_path =
+        conversion.output_dir / filename;
+    Log(Verbosity::kNormal) << "Removing: " << output_path;
+    boost::system::error_code error;
+    boost::filesystem::remove(output_path, error);
+    if (error) {
+      LogError() << "error: Failed removing " << output_path << ": "
+                 << error.message();
+    }
   }
+  RecordInput(conversion, path, "", {});
+}
 
-  std::atomic<int> num_processed_successfully = 0;
-  std::atomic<int> num_failed = 0;  
-  std::atomic<int> num_in_progress = 0;
-  std::mutex mutex;
-  std::condition_variable busy;
-  for (boost::filesystem::directory_entry& entry :
-       boost::filesystem::directory_iterator(input_dir.data())) {
-    if (!boost::filesystem::is_regular_file(entry)) {
-      continue;
+// Counts an input whose outputs, named `name`, have all been written, or failed
+// to, and records the converted ones.
+void FinishInput(Conversion& conversion, const boost::filesystem::path& path,
+                 const std::string& name, bool failed) {
+  if (failed) {
+    EndInput(conversion, path, conversion.counters.failed);
+    return;
+  }
+  RecordInput(conversion, path, name,
+              OutputFilenames(name, conversion.options.formats));
+  EndInput(conversion, path, conversion.counters.succeeded);
+  // Recorded first, a drop right after this has to be recorded last.
+  if (conversion.converted && !conversion.converted->Finish(path, name)) {
+    DropOutputs(conversion, path, name);
+  }
+}
+
+// Drops the input at `path` if it has been converted, as a duplicate of a copy
+// which sorts before it and turned up later. Outputs it hasn't written yet are
+// dropped by FinishInput().
+void DropInput(Conversion& conversion, const boost::filesystem::path& path) {
+  if (const std::optional<std::string> name =
+          conversion.converted->Drop(path)) {
+    DropOutputs(conversion, path, *name);
+  }
+}
+
+// Reports `activity` if it repeats an earlier one, or an earlier one repeats
+// it. Returns true if it isn't converted because of that, it counts as skipped
+// then. Earlier copies which are skipped because of it are dropped.
+bool SkipDuplicate(Conversion& conversion, const Activity& activity,
+                   const boost::filesystem::path& path) {
+  if (!conversion.duplicates) {
+    return false;
+  }
+  const std::optional<DuplicateIndex::Duplicate> duplicate =
+      conversion.duplicates->Add(gpx_to_kml::Fingerprint(activity),
+                                 path.string());
+  if (!duplicate) {
+    return false;
+  }
+  ++conversion.counters.duplicates;
+  // Copies with more of the track than the original are kept.
+  const bool skip = conversion.options.duplicates == Duplicates::kSkip &&
+                    duplicate->kind != DuplicateIndex::Kind::kContains;
+  const int percent = static_cast<int>(duplicate->overlap * 100);
+  LogMessage line = Log(Verbosity::kNormal);
+  switch (duplicate->kind) {
+    case DuplicateIndex::Kind::kExact:
+      line << "Duplicate of \"" << duplicate->original << "\"";
+      break;
+    case DuplicateIndex::Kind::kContained:
+      line << "Near duplicate, " << percent << "% within \""
+           << duplicate->original << "\"";
+      break;
+    case DuplicateIndex::Kind::kContains:
+      line << "Near duplicate, contains " << percent << "% of \""
+           << duplicate->original << "\"";
+      break;
+  }
+  const boost::filesystem::path copy(duplicate->copy);
+  line << (skip ? ", skipped: " : ": ") << copy;
+  if (copy != path) {
+    if (skip) {
+      DropInput(conversion, copy);
     }
-    if (boost::algorithm::to_lower_copy(entry.path().extension().string()) !=
-        ".gpx") {
-      continue;
+    return false;
+  }
+  if (skip) {
+    RecordInput(conversion, path, "", {});
+    EndInput(conversion, path, conversion.counters.skipped);
+  }
+  return skip;
+}
+
+// Completes the combined outputs once all files have been converted.
+void FinishConversion(const Conversion& conversion) {
+  for (const std::unique_ptr<ActivitySink>& sink : conversion.sinks) {
+    sink->Finish();
+  }
+  if (conversion.options.durability == gpx_to_kml::Durability::kSyncfs) {
+    gpx_to_kml::SyncFilesystem(conversion.output_dir);
+  }
+  LogMessage line = Log(Verbosity::kQuiet);
+  const std::uint64_t dropped =
+      conversion.converted ? conversion.converted->num_dropped() : 0;
+  line << "Succeeded: " << conversion.counters.succeeded.Sum() - dropped
+       << " Failed: " << conversion.counters.failed.Sum();
+  if (conversion.journal || conversion.manifest ||
+      conversion.options.duplicates == Duplicates::kSkip) {
+    line << " Skipped: " << conversion.counters.skipped.Sum() + dropped;
+  }
+  if (conversion.duplicates) {
+    line << " Duplicates: " << conversion.counters.duplicates.Sum();
+  }
+}
+
+// Reads the input at `path` up to its first track segment and returns its
+// output basename, null if that isn't found or invalid.
+std::optional<std::string> ReadOutputBasename(
+    const boost::filesystem::path& path) {
+  const std::unique_ptr<FILE, decltype(&fclose)> file(
+      boost::nowide::fopen(path.string().data(), "rb"), fclose);
+  if (!file) {
+    return std::nullopt;
+  }
+  constexpr std::string_view kSegment = "<trkseg";
+  std::string xml;
+  char buffer[kNameReadSize];
+  std::size_t num_read;
+  while ((num_read = fread(buffer, 1, sizeof(buffer), file.get())) > 0) {
+    // The tag may straddle two reads.
+    const std::size_t from = xml.size() - std::min(xml.size(), kSegment.size());
+    xml.append(buffer, num_read);
+    if (xml.find(kSegment, from) != std::string::npos) {
+      break;
     }
-    std::osyncstream(std::cout) << "Reading: " << entry << std::endl;
+  }
+  const std::optional<Activity> activity =
+      gpx_to_kml::ParseActivityHeader(xml);
+  if (!activity) {
+    return std::nullopt;
+  }
+  return OutputBasename(*activity);
+}
 
-    std::unique_lock<std::mutex> lock(mutex);
-    // Rate limit the work queue to twice the number of tasks as threads.
-    while (num_in_progress >= threads.size() * 2) {
-      busy.wait(lock);
+// Plans the output name of the input at `path`, see OutputNames::Plan(). Only
+// the start of the input is read. Inputs whose name isn't found this way claim
+// theirs once converted, on a first come, first served basis.
+void PlanOutputName(Conversion& conversion,
+                    const boost::filesystem::path& path) {
+  if (const std::optional<std::string> basename = ReadOutputBasename(path)) {
+    conversion.output_names.Plan(
+        *basename, InputName(path, conversion.options.input_dir));
+  }
+}
+
+// Counts `path` as listed if it is an input, its size is stored in `size` if
+// `sized`, else zero. Returns false if it isn't an input or is skipped because
+// of the journal or the manifest.
+bool ListInput(Conversion& conversion, const boost::filesystem::path& path,
+               bool sized, std::uintmax_t* size) {
+  const Options& options = conversion.options;
+  Counters& counters = conversion.counters;
+  if (boost::algorithm::to_lower_copy(path.extension().string()) != ".gpx") {
+    return false;
+  }
+  const std::string key = conversion.journal || conversion.manifest
+                              ? InputKey(path, options.input_dir)
+                              : std::string();
+  if (conversion.journal && conversion.journal->loaded().contains(key)) {
+    ++counters.listed_files;
+    ++counters.skipped;
+    return false;
+  }
+  *size = 0;
+  boost::system::error_code error;
+  if (sized) {
+    *size = boost::filesystem::file_size(path, error);
+    if (error) {
+      // Reading the file reports the error.
+      *size = 0;
+    }
+  }
+  if (conversion.manifest) {
+    const std::time_t mtime =
+        error ? 0 : boost::filesystem::last_write_time(path, error);
+    if (!error && conversion.manifest->Unchanged(key, *size, mtime) &&
+        OutputsExist(conversion, key)) {
+      conversion.manifest->Keep(key);
+      ++counters.listed_files;
+      ++counters.skipped;
+      return false;
     }
-    ++num_in_progress;
+    conversion.manifest->Listed(key, *size, mtime);
+  }
+  ++counters.listed_files;
+  counters.listed_bytes.Add(*size);
+  return true;
+}
 
-    io_service.post([entry, output_dir, &num_processed_successfully,
-                     &num_failed, &num_in_progress, &busy]() {
-      try {
-        ConvertFile(entry.path().string(), output_dir);
-        ++num_processed_successfully;
-        --num_in_progress;
-        busy.notify_one();
-      } catch (const std::exception& error) {
-        std::osyncstream(std::cerr) << "error: " << error.what() << std::endl;
-        ++num_failed;
-        --num_in_progress;
-        busy.notify_one();
+// Calls `dispatch` for every input, in the order given by --schedule. Inputs in
+// the journal or unchanged since the manifest recorded them are skipped. With
+// --watch, inputs written into the input directory later are dispatched as
+// they arrive, until an interruption. Nothing is dispatched after one.
+// `progress` may be null.
+void ListInputs(
+    Conversion& conversion, gpx_to_kml::ProgressReporter* progress,
+    const std::function<void(const boost::filesystem::path&)>& dispatch) {
+  const Options& options = conversion.options;
+  // Thrown to stop listing.
+  struct Interrupted {};
+  const bool largest_first = options.schedule == Schedule::kLargestFirst;
+  // Output names shared by several inputs are disambiguated for all of them,
+  // which needs the names of all inputs before the first one is converted.
+  const bool plan_names = options.formats.kml || options.formats.geojson;
+  // Walkers dispatch inputs while they are still listing, unless the inputs
+  // are sorted by size or their output names planned first.
+  const bool dispatch_listed = !largest_first && !plan_names;
+  // Sizes cost a stat per input, progress reports need them for the time
+  // left and the manifest to tell changed inputs apart.
+  const bool sized = largest_first || options.progress_interval.count() > 0 ||
+                     conversion.manifest;
+  std::mutex sized_inputs_mutex;
+  std::vector<std::pair<std::uintmax_t, boost::filesystem::path>> sized_inputs;
+
+  // Set up before listing, files arriving meanwhile would be missed
+  // otherwise. Those may be listed and reported by the watcher both.
+  std::unique_ptr<gpx_to_kml::DirectoryWatcher> watcher;
+  if (options.watch) {
+    watcher = std::make_unique<gpx_to_kml::DirectoryWatcher>(
+        options.input_dir, options.recursive, options.watch_settle);
+  }
+  const auto dispatch_once = [&](const boost::filesystem::path& path) {
+    if (conversion.in_flight && !conversion.in_flight->Add(path)) {
+      Log(Verbosity::kVerbose) << "Already converting: " << path;
+      return;
+    }
+    dispatch(path);
+  };
+
+  try {
+    gpx_to_kml::WalkDirectory(
+        options.input_dir, options.recursive, options.walk_threads,
+        [&](const boost::filesystem::directory_entry& entry) {
+          if (interrupted) {
+            throw Interrupted();
+          }
+          std::uintmax_t size;
+          if (!ListInput(conversion, entry.path(), sized, &size)) {
+            return;
+          }
+          if (dispatch_listed) {
+            dispatch_once(entry.path());
+            return;
+          }
+          if (plan_names) {
+            PlanOutputName(conversion, entry.path());
+          }
+          std::lock_guard<std::mutex> lock(sized_inputs_mutex);
+          sized_inputs.emplace_back(size, entry.path());
+        },
+        [&](const std::string& error) {
+          LogError() << "error: " << error;
+        });
+  } catch (const Interrupted&) {
+    return;
+  }
+  if (progress && !watcher) {
+    progress->ListingFinished();
+  }
+
+  // Longest processing time first: starting the big files early leaves the
+  // small ones to fill the gaps at the end.
+  if (largest_first) {
+    std::sort(sized_inputs.begin(), sized_inputs.end(),
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+  }
+  for (const auto& [size, path] : sized_inputs) {
+    if (interrupted) {
+      return;
+    }
+    dispatch_once(path);
+  }
+  conversion.listed_all = true;
+
+  if (!watcher) {
+    return;
+  }
+  Log(Verbosity::kQuiet) << "Watching " << options.input_dir
+                         << " for new inputs, Ctrl-C stops";
+  while (!interrupted) {
+    // Bounds the time an interruption takes to notice, the signal may be
+    // handled by another thread than the waiting one.
+    std::vector<boost::filesystem::path> arrived;
+    for (boost::filesystem::path& path : watcher->Wait(kWatchInterruptCheck)) {
+      std::uintmax_t size;
+      if (!ListInput(conversion, path, sized, &size)) {
+        continue;
       }
-    });
+      // Names claimed by inputs which arrived earlier stay theirs.
+      if (plan_names) {
+        PlanOutputName(conversion, path);
+      }
+      arrived.push_back(std::move(path));
+    }
+    for (const boost::filesystem::path& path : arrived) {
+      dispatch_once(path);
+    }
+  }
+}
+
+// Returns null unless --progress_seconds asks for progress reports.
+std::unique_ptr<gpx_to_kml::ProgressReporter> StartProgress(
+    const Conversion& conversion,
+    std::function<std::vector<gpx_to_kml::ProgressReporter::QueueDepth>()>
+        queue_depths) {
+  if (conversion.options.progress_interval.count() == 0) {
+    return nullptr;
+  }
+  return std::make_unique<gpx_to_kml::ProgressReporter>(
+      conversion.counters, conversion.options.progress_interval,
+      std::move(queue_depths));
+}
+
+// Records each request of a batched I/O call with an equal share of its time.
+// `report` may be null.
+template <typename Request>
+void RecordBatch(RunReport* report, ReportStage stage,
+                 RunReport::Clock::time_point start,
+                 const std::vector<Request>& batch) {
+  if (!report || batch.empty()) {
+    return;
+  }
+  const RunReport::Clock::duration share =
+      (RunReport::Clock::now() - start) /
+      static_cast<RunReport::Clock::rep>(batch.size());
+  for (const Request& request : batch) {
+    report->Record(stage, share, request.path);
+  }
+}
+
+void RunPipeline(Conversion& conversion) {
+  const Options& options = conversion.options;
+  const std::string& io_backend = conversion.io_backend;
+  Counters& counters = conversion.counters;
+  Tracer* const tracer = conversion.tracer;
+  // Stages may have more threads than should work at once, these limits
+  // decide. The read limit only matters for adaptive runs.
+  gpx_to_kml::ConcurrencyLimit jobs(options.jobs);
+  gpx_to_kml::ConcurrencyLimit reads(
+      options.adaptive_jobs ? std::size_t{1} : options.read_threads);
+  // Each file passes through the stages read, parse, format and write. The
+  // queues in between are bounded, which keeps the memory of files in flight
+  // in check and lets a slow stage throttle the ones before it.
+  gpx_to_kml::Stage<OutputWrite> writer(
+      "write", options.write_threads,
+      2 * kWriteBatchSize * options.write_threads,
+      [&](gpx_to_kml::BoundedQueue<OutputWrite>& queue) {
+        if (tracer) {
+          tracer->NameThread("write");
+        }
+        const std::unique_ptr<IoBackend> backend =
+            gpx_to_kml::CreateIoBackend(io_backend, options.durability);
+        std::vector<OutputWrite> outputs;
+        std::vector<FileWrite> batch;
+        while (queue.PopBatch(kWriteBatchSize, outputs)) {
+          const auto start = RunReport::Clock::now();
+          batch.clear();
+          for (OutputWrite& output : outputs) {
+            if (tracer) {
+              tracer->AsyncSpan("wait write", output.queued, start,
+                                output.write.path);
+            }
+            batch.push_back(std::move(output.write));
+          }
+          {
+            TraceSpan span(tracer, "write");
+            backend->Write(batch);
+          }
+          RecordBatch(conversion.report, ReportStage::kWrite, start, batch);
+          for (std::size_t i = 0; i < batch.size(); ++i) {
+            if (batch[i].error.empty()) {
+              counters.written_bytes.Add(batch[i].contents.size());
+            }
+            outputs[i].on_written(batch[i]);
+          }
+        }
+      });
+  gpx_to_kml::Stage<ParsedFile> formatter(
+      "format", options.format_threads,
+      options.queue_depth * options.format_threads,
+      [&](gpx_to_kml::BoundedQueue<ParsedFile>& queue) {
+        if (tracer) {
+          tracer->NameThread("format");
+        }
+        while (std::optional<ParsedFile> parsed = queue.Pop()) {
+          if (tracer) {
+            tracer->AsyncSpan("wait format", parsed->queued,
+                              Tracer::Clock::now(), parsed->path);
+          }
+          gpx_to_kml::ConcurrencySlot slot(jobs);
+          const auto start = gpx_to_kml::TaskTimes::Clock::now();
+          try {
+            std::vector<FileWrite> writes;
+            std::string name;
+            {
+              TraceSpan span(tracer, "format", &parsed->path);
+              writes = FormatFiles(parsed->activity, options.formats,
+                                   conversion.output_dir,
+                                   InputName(parsed->path, options.input_dir),
+                                   conversion.output_names, &name);
+            }
+            if (conversion.report) {
+              conversion.report->Record(ReportStage::kFormat, start,
+                                        parsed->path);
+            }
+            QueueWrites(std::move(writes), writer,
+                        [&conversion, path = parsed->path,
+                         name = std::move(name)](bool failed) {
+                          FinishInput(conversion, path, name, failed);
+                        });
+          } catch (const std::exception& error) {
+            LogError() << "error: "
+                       << InputError(error, parsed->path).what();
+            EndInput(conversion, parsed->path, counters.failed);
+          }
+          conversion.format_times.Record(start,
+                                         gpx_to_kml::TaskTimes::Clock::now());
+        }
+      });
+  gpx_to_kml::Stage<ReadFile> parser(
+      "parse", options.parse_threads,
+      options.queue_depth * options.parse_threads +
+          kReadBatchSize * options.read_threads,
+      [&](gpx_to_kml::BoundedQueue<ReadFile>& queue) {
+        if (tracer) {
+          tracer->NameThread("parse");
+        }
+        while (std::optional<ReadFile> read = queue.Pop()) {
+          FileRead& input = read->input;
+          if (tracer) {
+            tracer->AsyncSpan("wait parse", read->queued, Tracer::Clock::now(),
+                              input.path);
+          }
+          const std::uint64_t content_hash =
+              ContentHash(conversion, input, read->content_hash);
+          if (UnchangedContents(conversion, input, content_hash)) {
+            continue;
+          }
+          std::optional<ParsedFile> parsed;
+          {
+            // The slot is released before pushing on, a full format queue
+            // must not keep formatters from getting one.
+            gpx_to_kml::ConcurrencySlot slot(jobs);
+            const auto start = gpx_to_kml::TaskTimes::Clock::now();
+            TraceSpan span(tracer, "parse", &input.path);
+            try {
+              parsed = ParsedFile{
+                  .path = input.path,
+                  .activity = LoadActivity(conversion, input, content_hash,
+                                           !read->content_hash.has_value())};
+              counters.points.Add(parsed->activity.coordinates.size());
+              if (SkipDuplicate(conversion, parsed->activity, input.path)) {
+                parsed.reset();
+              } else {
+                // Combined outputs take every activity, even if its own files
+                // exist.
+                for (const std::unique_ptr<ActivitySink>& sink :
+                     conversion.sinks) {
+                  sink->Add(parsed->activity);
+                }
+              }
+            } catch (const std::exception& error) {
+              LogError() << "error: " << error.what();
+              EndInput(conversion, input.path, counters.failed);
+              parsed.reset();
+            }
+            conversion.parse_times.Record(start,
+                                          gpx_to_kml::TaskTimes::Clock::now());
+          }
+          if (parsed.has_value()) {
+            parsed->queued = Tracer::Clock::now();
+            formatter.Push(std::move(*parsed));
+          }
+        }
+      });
+  gpx_to_kml::Stage<boost::filesystem::path> reader(
+      "read", options.read_threads, kReadBatchSize * 4,
+      [&](gpx_to_kml::BoundedQueue<boost::filesystem::path>& queue) {
+        if (tracer) {
+          tracer->NameThread("read");
+        }
+        const std::unique_ptr<IoBackend> backend =
+            gpx_to_kml::CreateIoBackend(io_backend);
+        std::vector<boost::filesystem::path> paths;
+        std::vector<FileRead> batch;
+        while (queue.PopBatch(kReadBatchSize, paths)) {
+          batch.clear();
+          for (boost::filesystem::path& path : paths) {
+            if (const std::optional<std::uint64_t> content_hash =
+                    SkipRead(conversion, path)) {
+              parser.Push(ReadFile{.input = FileRead{.path = std::move(path)},
+                                   .content_hash = content_hash,
+                                   .queued = Tracer::Clock::now()});
+              continue;
+            }
+            batch.push_back(FileRead{.path = std::move(path)});
+          }
+          {
+            gpx_to_kml::ConcurrencySlot slot(reads);
+            const auto start = RunReport::Clock::now();
+            TraceSpan span(tracer, "read");
+            backend->Read(batch);
+            RecordBatch(conversion.report, ReportStage::kRead, start, batch);
+          }
+          for (FileRead& input : batch) {
+            counters.read_bytes.Add(input.contents.size());
+            parser.Push(
+                ReadFile{.input = std::move(input),
+                         .queued = Tracer::Clock::now()});
+          }
+        }
+      });
+
+  std::unique_ptr<gpx_to_kml::AdaptiveConcurrency> adaptive;
+  if (options.adaptive_jobs) {
+    adaptive = std::make_unique<gpx_to_kml::AdaptiveConcurrency>(
+        std::vector<gpx_to_kml::AdaptiveConcurrency::Dimension>{
+            {.name = "jobs",
+             .limit = &jobs,
+             .min = 1,
+             .max = std::min(kMaxAdaptiveJobsPerCore *
+                                 gpx_to_kml::NumParallelThreads(),
+                             options.parse_threads + options.format_threads)},
+            {.name = "reads",
+             .limit = &reads,
+             .min = 1,
+             .max = options.read_threads}},
+        [&counters]() -> std::uint64_t {
+          return counters.succeeded.Sum() + counters.failed.Sum();
+        });
+  }
+
+  std::unique_ptr<gpx_to_kml::ProgressReporter> progress =
+      StartProgress(conversion, [&]() {
+        return std::vector<gpx_to_kml::ProgressReporter::QueueDepth>{
+            {reader.name(), reader.depth()},
+            {parser.name(), parser.depth()},
+            {formatter.name(), formatter.depth()},
+            {writer.name(), writer.depth()}};
+      });
+
+  {
+    TraceSpan span(tracer, "enumerate");
+    ListInputs(conversion, progress.get(),
+               [&](const boost::filesystem::path& path) {
+                 Log(Verbosity::kNormal) << "Reading: " << path;
+                 reader.Push(path);
+               });
   }
 
-  io_service.stop();
-  threads.join_all();
-  std::cout << "Succeeded: " << num_processed_successfully
-            << " Failed: " << num_failed << std::endl;
+  // Each stage drains its queue before the next one is closed.
+  reader.Finish();
+  parser.Finish();
+  formatter.Finish();
+  writer.Finish();
+  if (adaptive) {
+    adaptive->Stop();
+  }
+  progress.reset();
+  FinishConversion(conversion);
+  PrintStageStats(reader);
+  PrintStageStats(parser);
+  PrintStageStats(formatter);
+  PrintStageStats(writer);
+  PrintTaskTimes(parser.name(), parser.num_threads(), conversion.parse_times);
+  PrintTaskTimes(formatter.name(), formatter.num_threads(),
+                 conversion.format_times);
+  if (adaptive) {
+    LogMessage line = Log(Verbosity::kVerbose);
+    line << "Concurrency (adaptive):" << std::fixed << std::setprecision(1);
+    for (const gpx_to_kml::AdaptiveConcurrency::Summary& summary :
+         adaptive->summaries()) {
+      line << " " << summary.name << " " << summary.min << "-" << summary.max
+           << " mean " << summary.mean << " last " << summary.last;
+    }
+  } else {
+    Log(Verbosity::kVerbose)
+        << "Concurrency: " << options.jobs << " jobs, " << options.read_threads
+        << " reads";
+  }
+}
+
+// Converts one file, holding a thread only while parsing and formatting.
+gpx_to_kml::Task ConvertFile(boost::filesystem::path path,
+                             Conversion& conversion, gpx_to_kml::AsyncIo& io) {
+  const Options& options = conversion.options;
+  Counters& counters = conversion.counters;
+  std::vector<FileWrite> writes;
+  std::string name;
+  {
+    FileRead input{.path = path};
+    const std::optional<std::uint64_t> cached = SkipRead(conversion, path);
+    if (!cached) {
+      const auto read_start = RunReport::Clock::now();
+      co_await io.Read(input);
+      if (conversion.report) {
+        conversion.report->Record(ReportStage::kRead, read_start, input.path);
+      }
+      if (conversion.tracer) {
+        // Until the coroutine resumes, which includes waiting for a thread.
+        conversion.tracer->AsyncSpan("read", read_start, Tracer::Clock::now(),
+                                     input.path);
+      }
+      counters.read_bytes.Add(input.contents.size());
+    }
+    const std::uint64_t content_hash = ContentHash(conversion, input, cached);
+    if (UnchangedContents(conversion, input, content_hash)) {
+      co_return;
+    }
+    std::optional<Activity> activity;
+    const auto parse_start = gpx_to_kml::TaskTimes::Clock::now();
+    try {
+      activity = LoadActivity(conversion, input, content_hash,
+                              !cached.has_value());
+      counters.points.Add(activity->coordinates.size());
+      if (SkipDuplicate(conversion, *activity, input.path)) {
+        co_return;
+      }
+      // Combined outputs take every activity, even if its own files exist.
+      for (const std::unique_ptr<ActivitySink>& sink : conversion.sinks) {
+        sink->Add(*activity);
+      }
+    } catch (const std::exception& error) {
+      LogError() << "error: " << error.what();
+      EndInput(conversion, path, counters.failed);
+      co_return;
+    }
+    const auto format_start = gpx_to_kml::TaskTimes::Clock::now();
+    conversion.parse_times.Record(parse_start, format_start);
+    if (conversion.tracer) {
+      conversion.tracer->Span("parse", parse_start, format_start, input.path);
+    }
+    try {
+      writes = FormatFiles(*activity, options.formats, conversion.output_dir,
+                           InputName(input.path, options.input_dir),
+                           conversion.output_names, &name);
+    } catch (const std::exception& error) {
+      LogError() << "error: " << InputError(error, input.path).what();
+      EndInput(conversion, path, counters.failed);
+      co_return;
+    }
+    const auto format_end = gpx_to_kml::TaskTimes::Clock::now();
+    conversion.format_times.Record(format_start, format_end);
+    if (conversion.tracer) {
+      conversion.tracer->Span("format", format_start, format_end, input.path);
+    }
+    if (conversion.report) {
+      conversion.report->Record(ReportStage::kFormat, format_start,
+                                input.path);
+    }
+  }
+
+  bool failed = false;
+  for (FileWrite& write : writes) {
+    Log(Verbosity::kNormal) << "Writing: " << write.path;
+    const auto write_start = RunReport::Clock::now();
+    co_await io.Write(write);
+    if (conversion.report) {
+      conversion.report->Record(ReportStage::kWrite, write_start, write.path);
+    }
+    if (conversion.tracer) {
+      conversion.tracer->AsyncSpan("write", write_start, Tracer::Clock::now(),
+                                   write.path);
+    }
+    if (!write.error.empty()) {
+      LogError() << "error: " << write.error;
+      failed = true;
+    } else {
+      counters.written_bytes.Add(write.contents.size());
+    }
+  }
+  FinishInput(conversion, path, name, failed);
+}
+
+void RunCoroutines(Conversion& conversion) {
+  const Options& options = conversion.options;
+  // Blocking backends need threads to wait on, as many as the pipeline's I/O
+  // stages have.
+  gpx_to_kml::Executor executor(options.jobs);
+  const std::unique_ptr<gpx_to_kml::AsyncIo> io = gpx_to_kml::CreateAsyncIo(
+      conversion.io_backend, options.durability, executor,
+      options.read_threads + options.write_threads);
+  gpx_to_kml::TaskGroup files(executor, options.files_in_flight);
+  std::unique_ptr<gpx_to_kml::ProgressReporter> progress =
+      StartProgress(conversion, [&]() {
+        return std::vector<gpx_to_kml::ProgressReporter::QueueDepth>{
+            {"in_flight", files.running()}};
+      });
+  {
+    TraceSpan span(conversion.tracer, "enumerate");
+    ListInputs(conversion, progress.get(),
+               [&](const boost::filesystem::path& path) {
+                 Log(Verbosity::kNormal) << "Reading: " << path;
+                 files.Spawn(ConvertFile(path, conversion, *io));
+               });
+  }
+  files.Wait();
+  progress.reset();
+
+  FinishConversion(conversion);
+  Log(Verbosity::kVerbose)
+      << "Coroutines: " << executor.num_threads() << " threads, "
+      << files.max_running() << " files in flight max";
+  PrintTaskTimes("parse", executor.num_threads(), conversion.parse_times);
+  PrintTaskTimes("format", executor.num_threads(), conversion.format_times);
+}
+
+// Returns false if an interruption left inputs unconverted. Interrupting
+// --watch once the inputs present at the start have been converted is the
+// regular way to stop it.
+bool Main(const Options& options) {
+  const auto start = RunReport::Clock::now();
+  const boost::filesystem::path output_dir(
+      options.output_dir.value_or(options.input_dir));
+  if (!boost::filesystem::is_directory(output_dir)) {
+    throw std::invalid_argument(boost::str(boost::format("Not a directory: \"%s\"") %
+                                output_dir.string()));
+  }
+
+  // Resolves "auto", each I/O thread creates its own instance of the backend.
+  const std::string io_backend(
+      gpx_to_kml::CreateIoBackend(options.io_backend)->Name());
+  Log(Verbosity::kNormal) << "I/O backend: " << io_backend;
+
+  OutputNames output_names(output_dir);
+  std::vector<std::unique_ptr<ActivitySink>> sinks;
+  if (options.ndjson_file.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::NdjsonWriter>(
+        *options.ndjson_file, options.durability));
+  }
+  if (options.flatgeobuf_file.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::FlatGeobufWriter>(
+        *options.flatgeobuf_file, options.durability));
+  }
+  if (options.geopackage_file.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::GeoPackageWriter>(
+        *options.geopackage_file, options.durability));
+  }
+  if (options.arrow_file.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::ArrowWriter>(
+        *options.arrow_file, options.arrow_extensions, options.durability));
+  }
+  if (options.tiles_output.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::VectorTileWriter>(
+        *options.tiles_output, options.tiles_min_zoom, options.tiles_max_zoom,
+        io_backend, options.durability));
+  }
+  if (options.heatmap_file.has_value()) {
+    sinks.push_back(std::make_unique<gpx_to_kml::HeatmapWriter>(
+        *options.heatmap_file, options.heatmap_zoom, options.durability));
+  }
+
+  std::unique_ptr<RunReport> report;
+  if (options.report_file.has_value()) {
+    report = std::make_unique<RunReport>(kReportSlowestFiles);
+  }
+  std::unique_ptr<Tracer> tracer;
+  if (options.trace_file.has_value()) {
+    tracer = std::make_unique<Tracer>();
+    tracer->NameThread("main");
+  }
+  std::unique_ptr<gpx_to_kml::Journal> journal;
+  if (options.journal_file.has_value()) {
+    // Resumed runs would leave out the activities of the earlier ones.
+    if (!sinks.empty()) {
+      throw std::invalid_argument(
+          "--journal_file can't be combined with outputs of all activities");
+    }
+    journal = std::make_unique<gpx_to_kml::Journal>(*options.journal_file);
+    // Outputs of the earlier runs keep their names, inputs with the same
+    // activity names are disambiguated as if converted in a single run.
+    for (const auto& [input, name] : journal->loaded()) {
+      // Duplicates have no outputs.
+      if (name.empty()) {
+        continue;
+      }
+      output_names.Reserve(
+          name, InputName(options.input_dir / boost::filesystem::path(input),
+                          options.input_dir));
+    }
+  }
+  std::unique_ptr<DuplicateIndex> duplicates;
+  if (options.duplicates != Duplicates::kOff) {
+    duplicates = std::make_unique<DuplicateIndex>();
+  }
+  std::unique_ptr<ConvertedInputs> converted;
+  if (options.duplicates == Duplicates::kSkip) {
+    converted = std::make_unique<ConvertedInputs>();
+  }
+  std::unique_ptr<gpx_to_kml::Manifest> manifest;
+  if (options.manifest_file.has_value()) {
+    // Skipped inputs would be left out, like with the journal.
+    if (!sinks.empty()) {
+      throw std::invalid_argument(
+          "--manifest_file can't be combined with outputs of all activities");
+    }
+    manifest = std::make_unique<gpx_to_kml::Manifest>(
+        *options.manifest_file, OutputOptionsHash(options, output_dir));
+    // Changed inputs replace their earlier outputs, new ones are
+    // disambiguated against them.
+    for (const auto& [input, entry] : manifest->loaded()) {
+      if (entry.name.empty()) {
+        continue;
+      }
+      output_names.Reserve(
+          entry.name,
+          InputName(options.input_dir / boost::filesystem::path(input),
+                    options.input_dir));
+    }
+  }
+  std::unique_ptr<gpx_to_kml::TrackCache> cache;
+  if (options.cache_dir.has_value()) {
+    cache = std::make_unique<gpx_to_kml::TrackCache>(*options.cache_dir);
+  }
+  std::unique_ptr<InFlightInputs> in_flight;
+  if (options.watch) {
+    in_flight = std::make_unique<InFlightInputs>();
+  }
+  Conversion conversion{.options = options,
+                        .output_dir = output_dir,
+                        .io_backend = io_backend,
+                        .output_names = output_names,
+                        .sinks = sinks,
+                        .report = report.get(),
+                        .tracer = tracer.get(),
+                        .journal = journal.get(),
+                        .manifest = manifest.get(),
+                        .duplicates = duplicates.get(),
+                        .converted = converted.get(),
+                        .in_flight = in_flight.get(),
+                        .cache = cache.get()};
+  switch (options.engine) {
+    case Engine::kPipeline:
+      RunPipeline(conversion);
+      break;
+    case Engine::kCoroutines:
+      RunCoroutines(conversion);
+      break;
+  }
+  const bool stopped_watching =
+      interrupted && options.watch && conversion.listed_all;
+  if (stopped_watching) {
+    Log(Verbosity::kNormal) << "Stopped watching";
+  } else if (interrupted) {
+    LogError() << "Interrupted, the inputs which hadn't been started were "
+               << (journal || manifest ? "left for the next run" : "skipped");
+  }
+  if (manifest) {
+    manifest->Write(options.durability, conversion.listed_all);
+  }
+  if (report) {
+    report->Write(
+        *options.report_file, options.durability,
+        {{"input_dir", options.input_dir},
+         {"engine",
+          options.engine == Engine::kPipeline ? "pipeline" : "coroutines"},
+         {"io_backend", io_backend},
+         {"jobs", options.adaptive_jobs ? std::string("auto")
+                                        : std::to_string(options.jobs)}},
+        conversion.counters,
+        std::chrono::duration<double>(RunReport::Clock::now() - start)
+            .count());
+  }
+  if (tracer) {
+    tracer->Write(*options.trace_file, options.durability);
+  }
+  return !interrupted || stopped_watching;
 }
 
 }  // namespace
@@ -258,10 +1820,159 @@ int main(int argc, char** argv) {
     boost::program_options::options_description flags_description(
         "Supported options");
     flags_description.add_options()("help", "List command line options")(
+        "quiet", "Only report errors and the final counts.")(
+        "verbose",
+        "Also report statistics of the threads, queues and tasks of the "
+        "run.")(
         "input_dir", boost::program_options::value<std::string>(),
         "Input directory containing GPX files.")(
+        "recursive",
+        "Also convert GPX files in all subdirectories of input_dir.")(
+        "walk_threads",
+        boost::program_options::value<std::size_t>()->default_value(4),
+        "Threads listing the subdirectories of a recursive input_dir.")(
+        "schedule",
+        boost::program_options::value<std::string>()->default_value("fifo"),
+        "Order of conversion: fifo starts with the first files listed, "
+        "largest_first lists all inputs and converts them by descending size "
+        "to avoid a long tail.")(
+        "chunked_parse_mb",
+        boost::program_options::value<std::size_t>()->default_value(0),
+        "Parse files of at least this many megabytes in parallel pieces, 0 "
+        "disables this.")(
         "output_dir", boost::program_options::value<std::string>(),
-        "Output directory for KML results. Defaults to input_dir.");
+        "Output directory for KML results. Defaults to input_dir.")(
+        "formats",
+        boost::program_options::value<std::string>()->default_value("kml"),
+        "Comma separated formats written for each input: kml, geojson. May "
+        "be empty if only combined outputs are wanted.")(
+        "kml_track",
+        "Write KML as gx:Track with the time of every point, for Google "
+        "Earth's time slider. Tracks with a point without a valid time stay "
+        "LineStrings.")(
+        "duplicates",
+        boost::program_options::value<std::string>()->default_value("off"),
+        "Look for activities repeating the track of another one, e.g. the "
+        "same activity in several exports, also with trimmed ends: off, "
+        "report or skip. Of the copies of a track, the one whose input path "
+        "sorts first is the original. skip converts neither the others nor "
+        "their combined outputs, unless they have more of the track than the "
+        "original. Copies converted before the original turned up lose their "
+        "files but stay in the combined outputs.")(
+        "ndjson_file", boost::program_options::value<std::string>(),
+        "Also write all activities into this newline-delimited GeoJSON "
+        "file.")(
+        "flatgeobuf_file", boost::program_options::value<std::string>(),
+        "Also write all activities into this spatially indexed FlatGeobuf "
+        "file.")(
+        "geopackage_file", boost::program_options::value<std::string>(),
+        "Also write all activities into this spatially indexed GeoPackage "
+        "file.")(
+        "arrow_file", boost::program_options::value<std::string>(),
+        "Also write every track point into this Arrow IPC file for "
+        "analytics.")(
+        "arrow_extensions",
+        boost::program_options::value<std::string>()->default_value(""),
+        "Comma separated GPX track point extensions written as additional "
+        "columns of the Arrow file, e.g. hr,cad,atemp,power.")(
+        "tiles_output", boost::program_options::value<std::string>(),
+        "Also render all activities into Mapbox Vector Tiles, written to this "
+        "MBTiles file if it ends in .mbtiles or else into this z/x/y "
+        "directory tree.")(
+        "tiles_zoom",
+        boost::program_options::value<std::string>()->default_value("0-14"),
+        "Zoom levels of the vector tiles, e.g. 0-14.")(
+        "heatmap_file", boost::program_options::value<std::string>(),
+        "Also render a heatmap of all activities into a PNG image next to "
+        "this KML file, which overlays it in Google Earth.")(
+        "heatmap_zoom", boost::program_options::value<int>()->default_value(14),
+        "Heatmap resolution, 256 << zoom pixels around the equator. Larger "
+        "areas are scaled down to fit 16384 pixels.")(
+        "jobs",
+        boost::program_options::value<std::string>()->default_value("0"),
+        "Number of files parsed or formatted at the same time, 0 for one per "
+        "core. auto tunes this and the number of concurrent reads by the "
+        "measured files per second.")(
+        "queue_depth",
+        boost::program_options::value<std::size_t>()->default_value(2),
+        "Files queued per thread in front of the parse and format threads.")(
+        "read_threads",
+        boost::program_options::value<std::size_t>()->default_value(0),
+        "Threads reading input files, 0 for 1 or up to 16 with --jobs auto. "
+        "Raise for high latency storage.")(
+        "parse_threads",
+        boost::program_options::value<std::size_t>()->default_value(0),
+        "Threads parsing GPX and feeding the combined outputs, 0 for one per "
+        "job.")(
+        "format_threads",
+        boost::program_options::value<std::size_t>()->default_value(0),
+        "Threads formatting the outputs of each input, 0 for one per job.")(
+        "write_threads",
+        boost::program_options::value<std::size_t>()->default_value(1),
+        "Threads writing the outputs of each input.")(
+        "engine",
+        boost::program_options::value<std::string>()->default_value(
+            "pipeline"),
+        "How files are converted: pipeline runs reading, parsing, formatting "
+        "and writing on threads of their own. coroutines converts each file "
+        "in a coroutine which waits for I/O without holding a thread, so "
+        "--jobs threads keep --files_in_flight files going. Without io_uring "
+        "--read_threads plus --write_threads threads do the I/O.")(
+        "files_in_flight",
+        boost::program_options::value<std::size_t>()->default_value(256),
+        "Files converted at the same time by the coroutines engine. Raise "
+        "for high latency storage.")(
+        "progress_seconds",
+        boost::program_options::value<double>()->default_value(0),
+        "Report files, megabytes read and points per second, megabytes "
+        "written, queue depths and, once all inputs are listed, the estimated "
+        "time left every this many seconds, 0 disables this. Inputs are "
+        "listed up front with --schedule largest_first. Combine with --quiet "
+        "to see only these.")(
+        "report_file", boost::program_options::value<std::string>(),
+        "Write a JSON report of the run into this file: the time of the "
+        "stages read, parse_xml, parse_coordinates, format and write per file "
+        "with percentiles and the slowest files, and the totals. Batched "
+        "reads and writes of the pipeline engine count each file with its "
+        "share of the batch, those of the coroutines engine last until the "
+        "file's coroutine resumes.")(
+        "trace_file", boost::program_options::value<std::string>(),
+        "Write a timeline of the run into this Chrome trace event JSON file, "
+        "for Perfetto or chrome://tracing: what each thread worked on when "
+        "and how long files waited in the queues or for I/O.")(
+        "journal_file", boost::program_options::value<std::string>(),
+        "Record every converted input in this file and skip the inputs "
+        "recorded by earlier runs, so an interrupted run resumes where it "
+        "stopped. Not available with the outputs of all activities. Ctrl-C "
+        "lets the files in flight finish, a second one aborts.")(
+        "manifest_file", boost::program_options::value<std::string>(),
+        "Record the size, modification time and content hash of every "
+        "converted input in this file, along with its outputs and the output "
+        "options. Later runs only convert new or changed inputs, or all of "
+        "them if the options changed, and replace the outputs of changed "
+        "ones. Not available with the outputs of all activities.")(
+        "cache_dir", boost::program_options::value<std::string>(),
+        "Keep the parsed track of every input in this directory, by content "
+        "hash, and load it from there instead of parsing the GPX again, e.g. "
+        "to convert with other options. With --manifest_file, inputs "
+        "unchanged since the last run aren't even read.")(
+        "watch",
+        "After converting the inputs present, keep converting the ones "
+        "written into --input_dir until Ctrl-C, which ends the run "
+        "successfully. Inputs written again are converted again. Linux "
+        "only.")(
+        "watch_settle_ms",
+        boost::program_options::value<int>()->default_value(50),
+        "With --watch, inputs are converted once they haven't been written to "
+        "for this long after being closed or moved in, so writers which "
+        "reopen them aren't caught halfway.")(
+        "io_backend",
+        boost::program_options::value<std::string>()->default_value("auto"),
+        "File I/O backend: posix, io_uring (Linux only) or auto.")(
+        "durability",
+        boost::program_options::value<std::string>()->default_value("none"),
+        "Outputs are renamed into place once complete. Additionally sync "
+        "them to disk: none, fsync (each file) or syncfs (once at the end).");
 
     boost::program_options::variables_map flags;
     boost::program_options::store(boost::program_options::parse_command_line(
@@ -269,7 +1980,7 @@ int main(int argc, char** argv) {
                                   flags);
     boost::program_options::notify(flags);
 
-    if (flags.count("help") || flags.empty()) {
+    if (flags.count("help") || argc <= 1) {
       std::cout << flags_description << std::endl;
       return EXIT_SUCCESS;
     }
@@ -278,11 +1989,90 @@ int main(int argc, char** argv) {
       std::cout << flags_description << std::endl;
       return EXIT_FAILURE;
     }
-    std::optional<std::string> output_dir;
+    Options options;
+    options.input_dir = flags["input_dir"].as<std::string>();
+    options.recursive = flags.contains("recursive");
+    options.walk_threads =
+        std::max<std::size_t>(1, flags["walk_threads"].as<std::size_t>());
+    options.schedule = ParseSchedule(flags["schedule"].as<std::string>());
+    options.chunked_parse_size =
+        flags["chunked_parse_mb"].as<std::size_t>() << 20;
     if (flags.contains("output_dir")) {
-      output_dir = flags["output_dir"].as<std::string>();
+      options.output_dir = flags["output_dir"].as<std::string>();
+    }
+    options.io_backend = flags["io_backend"].as<std::string>();
+    options.durability =
+        gpx_to_kml::ParseDurability(flags["durability"].as<std::string>());
+    options.formats = ParseOutputFormats(flags["formats"].as<std::string>());
+    options.formats.kml_track = flags.contains("kml_track");
+    if (flags.contains("ndjson_file")) {
+      options.ndjson_file = flags["ndjson_file"].as<std::string>();
+    }
+    if (flags.contains("flatgeobuf_file")) {
+      options.flatgeobuf_file = flags["flatgeobuf_file"].as<std::string>();
+    }
+    if (flags.contains("geopackage_file")) {
+      options.geopackage_file = flags["geopackage_file"].as<std::string>();
+    }
+    if (flags.contains("arrow_file")) {
+      options.arrow_file = flags["arrow_file"].as<std::string>();
+    }
+    options.arrow_extensions =
+        ParseList(flags["arrow_extensions"].as<std::string>());
+    if (flags.contains("tiles_output")) {
+      options.tiles_output = flags["tiles_output"].as<std::string>();
+    }
+    std::tie(options.tiles_min_zoom, options.tiles_max_zoom) =
+        gpx_to_kml::ParseZoomRange(flags["tiles_zoom"].as<std::string>());
+    if (flags.contains("heatmap_file")) {
+      options.heatmap_file = flags["heatmap_file"].as<std::string>();
+    }
+    options.heatmap_zoom = flags["heatmap_zoom"].as<int>();
+    options.queue_depth = flags["queue_depth"].as<std::size_t>();
+    options.read_threads = flags["read_threads"].as<std::size_t>();
+    options.parse_threads = flags["parse_threads"].as<std::size_t>();
+    options.format_threads = flags["format_threads"].as<std::size_t>();
+    options.write_threads = flags["write_threads"].as<std::size_t>();
+    options.engine = ParseEngine(flags["engine"].as<std::string>());
+    options.duplicates =
+        ParseDuplicates(flags["duplicates"].as<std::string>());
+    options.files_in_flight =
+        std::max<std::size_t>(1, flags["files_in_flight"].as<std::size_t>());
+    options.progress_interval =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::duration<double>(
+                std::max(0.0, flags["progress_seconds"].as<double>())));
+    if (flags.contains("report_file")) {
+      options.report_file = flags["report_file"].as<std::string>();
+    }
+    if (flags.contains("trace_file")) {
+      options.trace_file = flags["trace_file"].as<std::string>();
+    }
+    if (flags.contains("journal_file")) {
+      options.journal_file = flags["journal_file"].as<std::string>();
+    }
+    if (flags.contains("manifest_file")) {
+      options.manifest_file = flags["manifest_file"].as<std::string>();
+    }
+    if (flags.contains("cache_dir")) {
+      options.cache_dir = flags["cache_dir"].as<std::string>();
+    }
+    options.watch = flags.contains("watch");
+    options.watch_settle = std::chrono::milliseconds(
+        std::max(0, flags["watch_settle_ms"].as<int>()));
+    ResolveConcurrency(flags["jobs"].as<std::string>(), options);
+    if (flags.contains("quiet") && flags.contains("verbose")) {
+      throw std::invalid_argument("--quiet and --verbose exclude each other");
+    }
+    gpx_to_kml::SetVerbosity(flags.contains("quiet")     ? Verbosity::kQuiet
+                             : flags.contains("verbose") ? Verbosity::kVerbose
+                                                         : Verbosity::kNormal);
+    // Writes all pending output before errors escaping Main() are reported.
+    const gpx_to_kml::Logger logger;
+    std::signal(SIGINT, Interrupt);
+    if (!Main(options)) {
+      return kInterruptedExitCode;
     }
-    Main(flags["input_dir"].as<std::string>(), output_dir);
   } catch (const std::exception& error) {
     std::cerr << "error: " << error.what() << std::endl;
     return EXIT_FAILURE;
@@ -0,0 +1,148 @@
+#include "gpx.h"
+
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+
+#include "boost/lexical_cast.hpp"
+#include "iso-time.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Collects the numeric leaf elements below the <extensions> of the track point
+// with index `point`.
+void ParseExtensions(const tinyxml2::XMLElement& element, std::size_t point,
+                     std::vector<PointExtension>& extensions) {
+  for (const tinyxml2::XMLElement* child = element.FirstChildElement(); child;
+       child = child->NextSiblingElement()) {
+    if (child->FirstChildElement()) {
+      ParseExtensions(*child, point, extensions);
+      continue;
+    }
+    const std::string_view text = child->GetText() ? child->GetText() : "";
+    double value;
+    if (std::from_chars(text.data(), text.data() + text.size(), value).ec !=
+        std::errc()) {
+      continue;
+    }
+    std::string_view name = child->Name();
+    name = name.substr(name.find(':') + 1);
+    auto extension = std::find_if(
+        extensions.begin(), extensions.end(),
+        [&](const PointExtension& existing) { return existing.name == name; });
+    if (extension == extensions.end()) {
+      extension = extensions.insert(
+          extensions.end(), PointExtension{.name = std::string(name)});
+    }
+    if (extension->values.size() <= point) {
+      extension->values.resize(point,
+                               std::numeric_limits<double>::quiet_NaN());
+      extension->values.push_back(value);
+    }
+  }
+}
+
+}  // namespace
+
+std::tm ParseTime(const tinyxml2::XMLElement& root) {
+  const tinyxml2::XMLElement* element = root.FirstChildElement("metadata");
+  if (!element) {
+    throw std::invalid_argument("Missing metadata element");
+  }
+  element = element->FirstChildElement("time");
+  if (!element) {
+    throw std::invalid_argument("Missing metadata time element");
+  }
+  std::istringstream time_stream(element->GetText());
+  std::tm time;
+  time_stream >> std::get_time(&time, "%Y-%m-%dT%H:%M:%SZ");
+  if (time_stream.fail()) {
+    throw std::invalid_argument(element->GetText());
+  }
+  return time;
+}
+
+std::string ParseName(const tinyxml2::XMLElement& track) {
+  const tinyxml2::XMLElement* name = track.FirstChildElement("name");
+  if (!name) {
+    throw std::invalid_argument("Missing name element");
+  }
+  return name->GetText();
+}
+
+std::optional<Activity> ParseActivityHeader(std::string_view xml) {
+  const std::size_t segment = xml.find("<trkseg");
+  if (segment == std::string_view::npos) {
+    return std::nullopt;
+  }
+  std::string head(xml.substr(0, segment));
+  head += "</trk></gpx>";
+  tinyxml2::XMLDocument doc;
+  if (doc.Parse(head.data(), head.size()) != tinyxml2::XML_SUCCESS) {
+    return std::nullopt;
+  }
+  const tinyxml2::XMLElement* root = doc.FirstChildElement("gpx");
+  const tinyxml2::XMLElement* track =
+      root ? root->FirstChildElement("trk") : nullptr;
+  if (!track) {
+    return std::nullopt;
+  }
+  Activity activity;
+  try {
+    activity.time = ParseTime(*root);
+    activity.name = ParseName(*track);
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+  return activity;
+}
+
+Coordinates ParseCoordinates(const tinyxml2::XMLElement& track,
+                             std::vector<PointExtension>* extensions) {
+  const tinyxml2::XMLElement* segment = track.FirstChildElement("trkseg");
+  if (!segment) {
+    throw std::invalid_argument("Missing trkseg element");
+  }
+
+  Coordinates coordinates;
+  for (const tinyxml2::XMLElement* point = segment->FirstChildElement("trkpt");
+       point; point = point->NextSiblingElement("trkpt")) {
+    const tinyxml2::XMLAttribute* lat = point->FindAttribute("lat");
+    const tinyxml2::XMLAttribute* lon = point->FindAttribute("lon");
+    if (!lat || !lon) {
+      throw std::invalid_argument("Missing lat/lon attributes");
+    }
+    const tinyxml2::XMLElement* elevation = point->FirstChildElement("ele");
+    if (!elevation) {
+      throw std::invalid_argument("Missing ele element");
+    }
+    std::int64_t time = kNoTime;
+    if (const tinyxml2::XMLElement* element = point->FirstChildElement("time");
+        element && element->GetText()) {
+      time = ParseIsoTime(element->GetText())
+                 .value_or(kNoTime);
+    }
+    if (const tinyxml2::XMLElement* element =
+            point->FirstChildElement("extensions")) {
+      ParseExtensions(*element, coordinates.size(), *extensions);
+    }
+    coordinates.push_back(
+        Coordinate({.lat = boost::lexical_cast<double>(lat->Value()),
+                    .lon = boost::lexical_cast<double>(lon->Value()),
+                    .alt = boost::lexical_cast<double>(elevation->GetText()),
+                    .time = time}));
+  }
+  for (PointExtension& extension : *extensions) {
+    extension.values.resize(coordinates.size(),
+                            std::numeric_limits<double>::quiet_NaN());
+  }
+  return coordinates;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "activity.h"
+#include "tinyxml2/tinyxml2.h"
+
+namespace gpx_to_kml {
+
+// Read the parts of a GPX document, throwing std::invalid_argument if a
+// required element is missing or malformed.
+
+// The time of the <metadata> of the <gpx> element `root`.
+std::tm ParseTime(const tinyxml2::XMLElement& root);
+
+// The <name> of the <trk> element `track`.
+std::string ParseName(const tinyxml2::XMLElement& track);
+
+// The time and name of the GPX document starting with `xml`, parsed from just
+// the part before the first <trkseg>, which is all `xml` needs to contain. Its
+// coordinates are left empty. Returns null if that part isn't found or invalid.
+std::optional<Activity> ParseActivityHeader(std::string_view xml);
+
+// The points of the first <trkseg> of the <trk> element `track`, their numeric
+// extensions are stored in `extensions`. A point time which isn't valid ISO
+// 8601 is kNoTime like a missing one, only some outputs need point times.
+Coordinates ParseCoordinates(const tinyxml2::XMLElement& track,
+                             std::vector<PointExtension>* extensions);
+
+}  // namespace gpx_to_kml
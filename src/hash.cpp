@@ -0,0 +1,96 @@
+#include "hash.h"
+
+#include <bit>
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4F;
+constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9;
+constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63;
+constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5;
+
+// Little endian loads, the byte order the hash is defined in. Compilers turn
+// these into single loads.
+std::uint64_t Load64(const char* data) {
+  std::uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= std::uint64_t{static_cast<unsigned char>(data[i])} << (8 * i);
+  }
+  return value;
+}
+
+std::uint64_t Load32(const char* data) {
+  std::uint64_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= std::uint64_t{static_cast<unsigned char>(data[i])} << (8 * i);
+  }
+  return value;
+}
+
+std::uint64_t Round(std::uint64_t accumulator, std::uint64_t input) {
+  accumulator += input * kPrime2;
+  accumulator = std::rotl(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+std::uint64_t MergeRound(std::uint64_t accumulator, std::uint64_t value) {
+  accumulator ^= Round(0, value);
+  return accumulator * kPrime1 + kPrime4;
+}
+
+}  // namespace
+
+std::uint64_t Xxh64(std::string_view data, std::uint64_t seed) {
+  const char* p = data.data();
+  const char* const end = p + data.size();
+  std::uint64_t hash;
+  if (data.size() >= 32) {
+    // Four independent lanes of 8 bytes each.
+    std::uint64_t v1 = seed + kPrime1 + kPrime2;
+    std::uint64_t v2 = seed + kPrime2;
+    std::uint64_t v3 = seed;
+    std::uint64_t v4 = seed - kPrime1;
+    const char* const limit = end - 32;
+    do {
+      v1 = Round(v1, Load64(p));
+      v2 = Round(v2, Load64(p + 8));
+      v3 = Round(v3, Load64(p + 16));
+      v4 = Round(v4, Load64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) +
+           std::rotl(v4, 18);
+    hash = MergeRound(hash, v1);
+    hash = MergeRound(hash, v2);
+    hash = MergeRound(hash, v3);
+    hash = MergeRound(hash, v4);
+  } else {
+    hash = seed + kPrime5;
+  }
+  hash += data.size();
+
+  for (; p + 8 <= end; p += 8) {
+    hash ^= Round(0, Load64(p));
+    hash = std::rotl(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (p + 4 <= end) {
+    hash ^= Load32(p) * kPrime1;
+    hash = std::rotl(hash, 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= static_cast<unsigned char>(*p) * kPrime5;
+    hash = std::rotl(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+}  // namespace gpx_to_kml
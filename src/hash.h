@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace gpx_to_kml {
+
+// XXH64 of `data`, a fast non-cryptographic hash which tells file contents
+// apart. Matches the reference implementation, so results can be checked with
+// the xxhsum tool.
+std::uint64_t Xxh64(std::string_view data, std::uint64_t seed = 0);
+
+}  // namespace gpx_to_kml
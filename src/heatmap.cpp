@@ -0,0 +1,318 @@
+#include "heatmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "boost/format.hpp"
+#include "kml.h"
+#include "logger.h"
+#include "parallel.h"
+#include "png.h"
+
+namespace gpx_to_kml {
+namespace {
+
+std::uint64_t BlockKey(std::int64_t x, std::int64_t y) {
+  return static_cast<std::uint64_t>(x) << 32 | static_cast<std::uint32_t>(y);
+}
+
+std::int64_t BlockX(std::uint64_t key) {
+  return static_cast<std::int64_t>(key >> 32);
+}
+
+std::int64_t BlockY(std::uint64_t key) {
+  return static_cast<std::int64_t>(key & 0xFFFFFFFF);
+}
+
+// Xiaolin Wu's anti-aliased line between pixel coordinates, calling
+// `plot(x, y, coverage)` for the covered pixels.
+template <typename Plot>
+void DrawLine(double x0, double y0, double x1, double y1, const Plot& plot) {
+  const auto fpart = [](double value) { return value - std::floor(value); };
+  const auto rfpart = [&](double value) { return 1 - fpart(value); };
+  const bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+  if (steep) {
+    std::swap(x0, y0);
+    std::swap(x1, y1);
+  }
+  if (x0 > x1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  const auto put = [&](double x, double y, double coverage) {
+    const std::int64_t ix = static_cast<std::int64_t>(x);
+    const std::int64_t iy = static_cast<std::int64_t>(y);
+    steep ? plot(iy, ix, coverage) : plot(ix, iy, coverage);
+  };
+  const double dx = x1 - x0;
+  const double gradient = dx == 0 ? 1 : (y1 - y0) / dx;
+
+  double x_end = std::round(x0);
+  double y_end = y0 + gradient * (x_end - x0);
+  double x_gap = rfpart(x0 + 0.5);
+  const double x_first = x_end;
+  put(x_first, std::floor(y_end), rfpart(y_end) * x_gap);
+  put(x_first, std::floor(y_end) + 1, fpart(y_end) * x_gap);
+  double y = y_end + gradient;
+
+  x_end = std::round(x1);
+  y_end = y1 + gradient * (x_end - x1);
+  x_gap = fpart(x1 + 0.5);
+  const double x_last = x_end;
+  put(x_last, std::floor(y_end), rfpart(y_end) * x_gap);
+  put(x_last, std::floor(y_end) + 1, fpart(y_end) * x_gap);
+
+  for (double x = x_first + 1; x < x_last; ++x) {
+    put(x, std::floor(y), rfpart(y));
+    put(x, std::floor(y) + 1, fpart(y));
+    y += gradient;
+  }
+}
+
+// Black body style ramp from dark red over yellow to white. Faint pixels stay
+// half transparent so the map below remains visible.
+std::array<std::uint32_t, 256> MakePalette() {
+  std::array<std::uint32_t, 256> palette = {};
+  for (int i = 1; i < 256; ++i) {
+    const double t = i / 255.0;
+    const auto channel = [](double value) {
+      return static_cast<std::uint32_t>(
+          std::lround(255 * std::clamp(value, 0.0, 1.0)));
+    };
+    palette[i] = channel(0.3 + 2.1 * t) | channel(2 * t - 0.5) << 8 |
+                 channel(3 * t - 2) << 16 | channel(0.5 + 0.5 * t) << 24;
+  }
+  return palette;
+}
+
+}  // namespace
+
+HeatmapWriter::HeatmapWriter(const boost::filesystem::path& kml_path, int zoom,
+                             Durability durability)
+    : kml_path_(kml_path), zoom_(zoom), durability_(durability) {
+  if (zoom < 0 || zoom > kMaxZoom) {
+    throw std::invalid_argument(
+        boost::str(boost::format("Heatmap zoom must be within 0-%d") %
+                   kMaxZoom));
+  }
+  for (std::size_t i = 0; i < NumParallelThreads(); ++i) {
+    canvases_.push_back(std::make_unique<Canvas>());
+  }
+}
+
+void HeatmapWriter::Add(const Activity& activity) {
+  const std::int64_t width = kBlockSize << zoom_;
+  const std::int64_t height = width / 2;
+  const auto to_x = [&](const Coordinate& coordinate) {
+    return (coordinate.lon + 180) / 360 * static_cast<double>(width);
+  };
+  const auto to_y = [&](const Coordinate& coordinate) {
+    return (90 - coordinate.lat) / 180 * static_cast<double>(height);
+  };
+
+  Canvas& canvas =
+      *canvases_[std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                 canvases_.size()];
+  std::lock_guard<std::mutex> lock(canvas.mutex);
+  // Consecutive pixels mostly fall into the same block.
+  std::uint64_t cached_key = std::numeric_limits<std::uint64_t>::max();
+  Block* cached_block = nullptr;
+  const auto plot = [&](std::int64_t x, std::int64_t y, double coverage) {
+    if (x < 0 || y < 0 || x >= width || y >= height || coverage <= 0) {
+      return;
+    }
+    const std::uint64_t key = BlockKey(x >> kBlockBits, y >> kBlockBits);
+    if (key != cached_key) {
+      std::unique_ptr<Block>& block = canvas.blocks[key];
+      if (!block) {
+        block = std::make_unique<Block>();
+      }
+      cached_key = key;
+      cached_block = block.get();
+    }
+    (*cached_block)[(y & (kBlockSize - 1)) << kBlockBits |
+                    (x & (kBlockSize - 1))] += static_cast<float>(coverage);
+  };
+  const Coordinates& coordinates = activity.coordinates;
+  for (std::size_t i = 0; i + 1 < coordinates.size(); ++i) {
+    DrawLine(to_x(coordinates[i]), to_y(coordinates[i]),
+             to_x(coordinates[i + 1]), to_y(coordinates[i + 1]), plot);
+  }
+}
+
+void HeatmapWriter::Finish() {
+  // Merge all canvases into the first. Blocks only present in one canvas are
+  // moved, the others are summed in parallel, one source canvas at a time so
+  // that no two threads add to the same block.
+  Blocks& merged = canvases_.front()->blocks;
+  for (std::size_t i = 1; i < canvases_.size(); ++i) {
+    std::vector<std::pair<Block*, const Block*>> sums;
+    for (auto& [key, block] : canvases_[i]->blocks) {
+      std::unique_ptr<Block>& target = merged[key];
+      if (target) {
+        sums.emplace_back(target.get(), block.get());
+      } else {
+        target = std::move(block);
+      }
+    }
+    ParallelChunks(sums.size(), [&](std::size_t begin, std::size_t end) {
+      for (std::size_t j = begin; j < end; ++j) {
+        std::transform(sums[j].first->begin(), sums[j].first->end(),
+                       sums[j].second->begin(), sums[j].first->begin(),
+                       std::plus<>());
+      }
+    });
+    canvases_[i]->blocks.clear();
+  }
+  if (merged.empty()) {
+    Log(Verbosity::kNormal) << "Heatmap: no tracks to render";
+    return;
+  }
+
+  // Pixel bounds of the drawn area, inclusive.
+  std::vector<std::pair<std::uint64_t, const Block*>> blocks;
+  for (const auto& [key, block] : merged) {
+    blocks.emplace_back(key, block.get());
+  }
+  std::int64_t min_x = std::numeric_limits<std::int64_t>::max();
+  std::int64_t min_y = min_x;
+  std::int64_t max_x = std::numeric_limits<std::int64_t>::min();
+  std::int64_t max_y = max_x;
+  std::mutex bounds_mutex;
+  ParallelChunks(blocks.size(), [&](std::size_t begin, std::size_t end) {
+    std::int64_t chunk_min_x = min_x, chunk_min_y = min_y;
+    std::int64_t chunk_max_x = max_x, chunk_max_y = max_y;
+    for (std::size_t i = begin; i < end; ++i) {
+      const auto& [key, block] = blocks[i];
+      for (std::int64_t y = 0; y < kBlockSize; ++y) {
+        for (std::int64_t x = 0; x < kBlockSize; ++x) {
+          if ((*block)[y << kBlockBits | x] > 0) {
+            const std::int64_t pixel_x = (BlockX(key) << kBlockBits) + x;
+            const std::int64_t pixel_y = (BlockY(key) << kBlockBits) + y;
+            chunk_min_x = std::min(chunk_min_x, pixel_x);
+            chunk_max_x = std::max(chunk_max_x, pixel_x);
+            chunk_min_y = std::min(chunk_min_y, pixel_y);
+            chunk_max_y = std::max(chunk_max_y, pixel_y);
+          }
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(bounds_mutex);
+    min_x = std::min(min_x, chunk_min_x);
+    max_x = std::max(max_x, chunk_max_x);
+    min_y = std::min(min_y, chunk_min_y);
+    max_y = std::max(max_y, chunk_max_y);
+  });
+
+  // Sum factor x factor pixels into one until the image is small enough.
+  std::int64_t factor = 1;
+  while ((max_x / factor - min_x / factor + 1) > kMaxImageSize ||
+         (max_y / factor - min_y / factor + 1) > kMaxImageSize) {
+    factor *= 2;
+  }
+  Blocks downsampled;
+  if (factor > 1) {
+    for (const auto& [key, block] : blocks) {
+      for (std::int64_t y = 0; y < kBlockSize; ++y) {
+        for (std::int64_t x = 0; x < kBlockSize; ++x) {
+          const float value = (*block)[y << kBlockBits | x];
+          if (value == 0) {
+            continue;
+          }
+          const std::int64_t target_x =
+              ((BlockX(key) << kBlockBits) + x) / factor;
+          const std::int64_t target_y =
+              ((BlockY(key) << kBlockBits) + y) / factor;
+          std::unique_ptr<Block>& target = downsampled[BlockKey(
+              target_x >> kBlockBits, target_y >> kBlockBits)];
+          if (!target) {
+            target = std::make_unique<Block>();
+          }
+          (*target)[(target_y & (kBlockSize - 1)) << kBlockBits |
+                    (target_x & (kBlockSize - 1))] += value;
+        }
+      }
+    }
+    blocks.clear();
+    merged.clear();
+    for (const auto& [key, block] : downsampled) {
+      blocks.emplace_back(key, block.get());
+    }
+  }
+  const Blocks& image = factor > 1 ? downsampled : merged;
+  min_x /= factor;
+  min_y /= factor;
+  max_x /= factor;
+  max_y /= factor;
+
+  float max_value = 0;
+  ParallelChunks(blocks.size(), [&](std::size_t begin, std::size_t end) {
+    float chunk_max = 0;
+    for (std::size_t i = begin; i < end; ++i) {
+      chunk_max = std::max(chunk_max, *std::max_element(blocks[i].second->begin(),
+                                                        blocks[i].second->end()));
+    }
+    std::lock_guard<std::mutex> lock(bounds_mutex);
+    max_value = std::max(max_value, chunk_max);
+  });
+
+  // Log scaling keeps rarely used paths visible next to daily commutes.
+  static const std::array<std::uint32_t, 256> kPalette = MakePalette();
+  const double scale = 255 / std::log1p(static_cast<double>(max_value));
+  const boost::filesystem::path png_path =
+      boost::filesystem::path(kml_path_).replace_extension(".png");
+  AtomicFile png_file(png_path, durability_);
+  const std::int64_t width = max_x - min_x + 1;
+  const std::int64_t height = max_y - min_y + 1;
+  PngWriter png(png_file, static_cast<std::uint32_t>(width),
+                static_cast<std::uint32_t>(height));
+  std::string row(4 * width, '\0');
+  std::vector<const Block*> row_blocks;
+  for (std::int64_t y = min_y; y <= max_y; ++y) {
+    if (y == min_y || (y & (kBlockSize - 1)) == 0) {
+      row_blocks.clear();
+      for (std::int64_t block_x = min_x >> kBlockBits;
+           block_x <= max_x >> kBlockBits; ++block_x) {
+        const auto it = image.find(BlockKey(block_x, y >> kBlockBits));
+        row_blocks.push_back(it == image.end() ? nullptr : it->second.get());
+      }
+    }
+    for (std::int64_t x = min_x; x <= max_x; ++x) {
+      const Block* block =
+          row_blocks[(x >> kBlockBits) - (min_x >> kBlockBits)];
+      const float value =
+          block ? (*block)[(y & (kBlockSize - 1)) << kBlockBits |
+                           (x & (kBlockSize - 1))]
+                : 0;
+      const std::uint32_t color =
+          value > 0 ? kPalette[std::clamp<long>(
+                          std::lround(std::log1p(value) * scale), 1, 255)]
+                    : 0;
+      std::memcpy(row.data() + 4 * (x - min_x), &color, 4);
+    }
+    png.AddRow(row);
+  }
+  png.Finish();
+  png_file.Commit();
+
+  // Pixel edges back to degrees.
+  const double world_width = static_cast<double>(kBlockSize << zoom_) / factor;
+  const auto to_lon = [&](std::int64_t x) { return x / world_width * 360 - 180; };
+  const auto to_lat = [&](std::int64_t y) { return 90 - y / world_width * 360; };
+  AtomicFile kml_file(kml_path_, durability_);
+  kml_file.Write(FormatGroundOverlay(
+      "Heatmap", png_path.filename().string(), to_lat(min_y),
+      to_lat(max_y + 1), to_lon(max_x + 1), to_lon(min_x)));
+  kml_file.Commit();
+  Log(Verbosity::kNormal) << "Heatmap: " << width << "x" << height
+                          << " pixels";
+}
+
+}  // namespace gpx_to_kml
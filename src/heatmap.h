@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// Rasterizes all activities into a track density heatmap. Writes a PNG next to
+// `kml_path`, with the same stem, and a KML GroundOverlay there which drapes it
+// over the covered area, e.g. for Google Earth.
+//
+// Tracks are drawn as anti-aliased lines in an equirectangular projection
+// with 256 << zoom pixels around the equator. Each worker draws into its own
+// canvas of sparsely allocated 256x256 pixel blocks, so memory is bounded by
+// the covered area rather than the number of points. Finish() merges the
+// canvases, crops to the drawn pixels, halves the resolution until the image
+// fits into kMaxImageSize and streams out the log-scaled PNG.
+class HeatmapWriter : public ActivitySink {
+ public:
+  static constexpr int kMaxZoom = 20;
+  static constexpr std::int64_t kMaxImageSize = 16384;
+
+  HeatmapWriter(const boost::filesystem::path& kml_path, int zoom,
+                Durability durability);
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  static constexpr int kBlockBits = 8;
+  static constexpr std::int64_t kBlockSize = std::int64_t{1} << kBlockBits;
+
+  // Summed line coverage per pixel.
+  using Block = std::array<float, kBlockSize * kBlockSize>;
+  using Blocks = std::unordered_map<std::uint64_t, std::unique_ptr<Block>>;
+
+  struct Canvas {
+    std::mutex mutex;
+    Blocks blocks;
+  };
+
+  const boost::filesystem::path kml_path_;
+  const int zoom_;
+  const Durability durability_;
+  std::vector<std::unique_ptr<Canvas>> canvases_;
+};
+
+}  // namespace gpx_to_kml
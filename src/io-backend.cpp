@@ -0,0 +1,1314 @@
+#include "io-backend.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include "boost/format.hpp"
+#include "boost/nowide/cstdio.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#endif
+
+namespace gpx_to_kml {
+namespace {
+
+std::string ErrorMessage(std::string_view action,
+                         const boost::filesystem::path& path,
+                         std::string_view reason) {
+  return boost::str(boost::format("Failed %s \"%s\": %s") % action %
+                    path.string() % reason);
+}
+
+// Outputs are written here first and renamed to their final path once
+// complete.
+boost::filesystem::path TempPath(const boost::filesystem::path& path) {
+  return path.string() + ".tmp";
+}
+
+bool SyncFile(FILE* file) {
+#ifdef _WIN32
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// The directory containing `path`, whose entry a rename changes.
+boost::filesystem::path ParentDirectory(const boost::filesystem::path& path) {
+  const boost::filesystem::path parent = path.parent_path();
+  return parent.empty() ? boost::filesystem::path(".") : parent;
+}
+
+// A rename only survives a power failure once the directory containing it
+// has been synced too. Returns an error message, empty on success. Windows
+// can't sync directories, NTFS journals renames.
+std::string SyncDirectory(const boost::filesystem::path& directory) {
+#ifdef _WIN32
+  return {};
+#else
+  const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrorMessage("opening", directory,
+                        std::system_category().message(errno));
+  }
+  std::string error;
+  if (fsync(fd) != 0) {
+    error = ErrorMessage("syncing", directory,
+                         std::system_category().message(errno));
+  }
+  close(fd);
+  return error;
+#endif
+}
+
+// Syncs each directory the written outputs of `batch` were renamed into once.
+// Outputs whose directory fails to sync get its error.
+void SyncDirectories(std::vector<FileWrite>& batch) {
+  std::vector<std::pair<boost::filesystem::path, std::string>> synced;
+  for (FileWrite& request : batch) {
+    if (!request.error.empty()) {
+      continue;
+    }
+    const boost::filesystem::path directory = ParentDirectory(request.path);
+    auto it =
+        std::find_if(synced.begin(), synced.end(), [&](const auto& entry) {
+          return entry.first == directory;
+        });
+    if (it == synced.end()) {
+      synced.emplace_back(directory, SyncDirectory(directory));
+      it = std::prev(synced.end());
+    }
+    request.error = it->second;
+  }
+}
+
+// Blocking stdio implementation, one open/read/close sequence per file.
+class PosixIoBackend : public IoBackend {
+ public:
+  explicit PosixIoBackend(Durability durability) : durability_(durability) {}
+
+  std::string_view Name() const override { return "posix"; }
+
+  void Read(std::vector<FileRead>& batch) override {
+    for (FileRead& request : batch) {
+      std::shared_ptr<FILE> file(
+          boost::nowide::fopen(request.path.string().data(), "rb"), fclose);
+      if (!file) {
+        request.error = ErrorMessage("opening", request.path, "fopen failed");
+        continue;
+      }
+      boost::system::error_code error;
+      const boost::uintmax_t size =
+          boost::filesystem::file_size(request.path, error);
+      if (!error) {
+        request.contents.reserve(size);
+      }
+      char buffer[64 * 1024];
+      std::size_t num_read;
+      while ((num_read = fread(buffer, 1, sizeof(buffer), file.get())) > 0) {
+        request.contents.append(buffer, num_read);
+      }
+      if (ferror(file.get())) {
+        request.error = ErrorMessage("reading", request.path, "fread failed");
+      }
+    }
+  }
+
+  void Write(std::vector<FileWrite>& batch) override {
+    for (FileWrite& request : batch) {
+      const boost::filesystem::path temp_path = TempPath(request.path);
+      std::unique_ptr<FILE, decltype(&fclose)> file(
+          boost::nowide::fopen(temp_path.string().data(), "wb"), fclose);
+      if (!file) {
+        request.error = ErrorMessage("opening", temp_path, "fopen failed");
+        continue;
+      }
+      if (fwrite(request.contents.data(), 1, request.contents.size(),
+                 file.get()) != request.contents.size() ||
+          fflush(file.get()) != 0) {
+        request.error = ErrorMessage("writing to", temp_path, "fwrite failed");
+      } else if (durability_ == Durability::kFsync && !SyncFile(file.get())) {
+        request.error = ErrorMessage("syncing", temp_path, "fsync failed");
+      }
+      if (fclose(file.release()) != 0 && request.error.empty()) {
+        request.error = ErrorMessage("closing", temp_path, "fclose failed");
+      }
+
+      boost::system::error_code error;
+      if (request.error.empty()) {
+        boost::filesystem::rename(temp_path, request.path, error);
+        if (error) {
+          request.error =
+              ErrorMessage("renaming", temp_path, error.message());
+        }
+      }
+      if (!request.error.empty()) {
+        boost::filesystem::remove(temp_path, error);
+      }
+    }
+    if (durability_ == Durability::kFsync) {
+      SyncDirectories(batch);
+    }
+  }
+
+ private:
+  const Durability durability_;
+};
+
+// Runs a PosixIoBackend on threads of its own, which resume the awaiting
+// coroutines on the executor once their call has returned.
+class BlockingAsyncIo : public AsyncIo {
+ public:
+  BlockingAsyncIo(Durability durability, Executor& executor,
+                  std::size_t num_threads)
+      : durability_(durability), executor_(executor) {
+    for (std::size_t i = 0; i < std::max<std::size_t>(1, num_threads); ++i) {
+      threads_.emplace_back([this]() { Run(); });
+    }
+  }
+
+  ~BlockingAsyncIo() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    call_available_.notify_all();
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  std::string_view Name() const override { return "posix"; }
+
+  Task Read(FileRead& request) override {
+    co_await Blocking([&request](IoBackend& backend) {
+      std::vector<FileRead> batch;
+      batch.push_back(std::move(request));
+      backend.Read(batch);
+      request = std::move(batch.front());
+    });
+  }
+
+  Task Write(FileWrite& request) override {
+    co_await Blocking([&request](IoBackend& backend) {
+      std::vector<FileWrite> batch;
+      batch.push_back(std::move(request));
+      backend.Write(batch);
+      request = std::move(batch.front());
+    });
+  }
+
+ private:
+  // Awaiting a call runs it on one of the blocking threads.
+  struct Call {
+    BlockingAsyncIo& io;
+    std::function<void(IoBackend&)> run;
+    std::coroutine_handle<> handle = nullptr;
+    std::exception_ptr error = nullptr;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+      handle = awaiting;
+      io.Submit(this);
+    }
+    void await_resume() const {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+  };
+
+  Call Blocking(std::function<void(IoBackend&)> run) {
+    return Call{.io = *this, .run = std::move(run)};
+  }
+
+  void Submit(Call* call) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      calls_.push_back(call);
+    }
+    call_available_.notify_one();
+  }
+
+  void Run() {
+    PosixIoBackend backend(durability_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      call_available_.wait(lock, [this]() { return !calls_.empty() || stop_; });
+      if (calls_.empty()) {
+        return;
+      }
+      Call* call = calls_.front();
+      calls_.pop_front();
+      lock.unlock();
+      try {
+        call->run(backend);
+      } catch (...) {
+        call->error = std::current_exception();
+      }
+      executor_.Post(call->handle);
+      lock.lock();
+    }
+  }
+
+  const Durability durability_;
+  Executor& executor_;
+  std::mutex mutex_;
+  std::condition_variable call_available_;
+  std::deque<Call*> calls_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+#ifdef __linux__
+
+// Minimal io_uring wrapper on top of the raw system calls. Not thread-safe.
+class IoUring {
+ public:
+  explicit IoUring(unsigned entries) {
+    io_uring_params params = {};
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+      throw std::system_error(errno, std::system_category(), "io_uring_setup");
+    }
+    sq_entries_ = params.sq_entries;
+
+    sq_ring_size_ =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+                   ? sq_ring_
+                   : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  ~IoUring() {
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    close(fd_);
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // The completion queue holds twice as many entries, so this many operations
+  // may be in flight at any time.
+  unsigned sq_entries() const { return sq_entries_; }
+
+  // Returns true if all the given opcodes are supported by the kernel.
+  bool Supports(std::initializer_list<int> opcodes) {
+    constexpr int kMaxOps = 256;
+    std::vector<char> buffer(sizeof(io_uring_probe) +
+                             kMaxOps * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe,
+                kMaxOps) < 0) {
+      return false;
+    }
+    for (int opcode : opcodes) {
+      if (opcode > probe->last_op ||
+          !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Queues an operation for the next Enter(). At most sq_entries() operations
+  // may be queued.
+  void Prepare(const io_uring_sqe& operation) {
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & sq_mask_;
+    sqes_[index] = operation;
+    sq_array_[index] = index;
+    std::atomic_ref<unsigned>(*sq_tail_).store(tail + 1,
+                                               std::memory_order_release);
+    ++num_prepared_;
+  }
+
+  // Submits the prepared operations and waits for at least `min_complete`
+  // completions. May return early if interrupted by a signal.
+  void Enter(unsigned min_complete) {
+    const long result =
+        syscall(__NR_io_uring_enter, fd_, num_prepared_, min_complete,
+                min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (result < 0) {
+      if (errno != EINTR) {
+        throw std::system_error(errno, std::system_category(),
+                                "io_uring_enter");
+      }
+      return;
+    }
+    num_prepared_ -= static_cast<unsigned>(result);
+  }
+
+  // Calls `complete(user_data, result)` for every available completion.
+  template <typename Complete>
+  void Reap(const Complete& complete) {
+    unsigned head = *cq_head_;
+    const unsigned cq_tail =
+        std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != cq_tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      complete(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref<unsigned>(*cq_head_).store(head, std::memory_order_release);
+  }
+
+  // Runs `count` operations in chunks of at most the submission queue size,
+  // each submitted with a single io_uring_enter call and reaped before the
+  // next chunk is prepared. `prepare(i, sqe)` fills in the i-th submission,
+  // `complete(i, result)` receives its completion result.
+  void Execute(std::size_t count,
+               const std::function<void(std::size_t, io_uring_sqe&)>& prepare,
+               const std::function<void(std::size_t, int)>& complete) {
+    for (std::size_t begin = 0; begin < count; begin += sq_entries_) {
+      const unsigned num = static_cast<unsigned>(
+          std::min<std::size_t>(sq_entries_, count - begin));
+      for (unsigned i = 0; i < num; ++i) {
+        io_uring_sqe sqe = {};
+        prepare(begin + i, sqe);
+        sqe.user_data = begin + i;
+        Prepare(sqe);
+      }
+
+      unsigned num_completed = 0;
+      while (num_completed < num) {
+        Enter(num - num_completed);
+        Reap([&](std::uint64_t user_data, int result) {
+          complete(static_cast<std::size_t>(user_data), result);
+          ++num_completed;
+        });
+      }
+    }
+  }
+
+ private:
+  void* Map(std::size_t size, off_t offset) {
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd_, offset);
+    if (address == MAP_FAILED) {
+      throw std::system_error(errno, std::system_category(), "mmap io_uring");
+    }
+    return address;
+  }
+
+  int fd_;
+  unsigned sq_entries_;
+  void* sq_ring_;
+  std::size_t sq_ring_size_;
+  void* cq_ring_;
+  std::size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  std::size_t sqes_size_;
+  unsigned* sq_tail_;
+  // Prepared but not yet submitted to the kernel.
+  unsigned num_prepared_ = 0;
+  unsigned sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+};
+
+std::string ErrnoMessage(int result) {
+  return std::system_category().message(-result);
+}
+
+// Batches every step (open, stat, read, write, close) of all files in a batch
+// into as few io_uring_enter calls as possible.
+class IoUringBackend : public IoBackend {
+ public:
+  static constexpr unsigned kRingEntries = 256;
+
+  explicit IoUringBackend(Durability durability)
+      : durability_(durability), ring_(kRingEntries) {
+    if (!ring_.Supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                         IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE})) {
+      throw std::runtime_error("Kernel lacks required io_uring operations");
+    }
+    // Added in Linux 5.11, older kernels rename synchronously.
+    supports_rename_ = ring_.Supports({IORING_OP_RENAMEAT});
+  }
+
+  std::string_view Name() const override { return "io_uring"; }
+
+  void Read(std::vector<FileRead>& batch) override {
+    std::vector<int> fds(batch.size(), -1);
+    std::vector<struct statx> stats(batch.size());
+    // Even operations open the file, odd ones stat it.
+    ring_.Execute(
+        batch.size() * 2,
+        [&](std::size_t i, io_uring_sqe& sqe) {
+          const FileRead& request = batch[i / 2];
+          if (i % 2 == 0) {
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<__u64>(request.path.c_str());
+            sqe.open_flags = O_RDONLY | O_CLOEXEC;
+          } else {
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<__u64>(request.path.c_str());
+            sqe.len = STATX_SIZE;
+            sqe.off = reinterpret_cast<__u64>(&stats[i / 2]);
+          }
+        },
+        [&](std::size_t i, int result) {
+          FileRead& request = batch[i / 2];
+          if (result < 0) {
+            if (request.error.empty()) {
+              request.error = ErrorMessage(i % 2 == 0 ? "opening" : "stating",
+                                           request.path, ErrnoMessage(result));
+            }
+          } else if (i % 2 == 0) {
+            fds[i / 2] = result;
+          }
+        });
+
+    std::vector<std::size_t> pending;
+    std::vector<std::size_t> offsets(batch.size(), 0);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i].error.empty()) {
+        batch[i].contents.resize(stats[i].stx_size);
+        if (!batch[i].contents.empty()) {
+          pending.push_back(i);
+        }
+      }
+    }
+    // Short reads are resubmitted until the file is exhausted.
+    while (!pending.empty()) {
+      std::vector<std::size_t> unfinished;
+      ring_.Execute(
+          pending.size(),
+          [&](std::size_t i, io_uring_sqe& sqe) {
+            const std::size_t file = pending[i];
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fds[file];
+            sqe.addr =
+                reinterpret_cast<__u64>(batch[file].contents.data() + offsets[file]);
+            sqe.len = static_cast<__u32>(batch[file].contents.size() -
+                                         offsets[file]);
+            sqe.off = offsets[file];
+          },
+          [&](std::size_t i, int result) {
+            const std::size_t file = pending[i];
+            FileRead& request = batch[file];
+            if (result < 0) {
+              request.error =
+                  ErrorMessage("reading", request.path, ErrnoMessage(result));
+            } else if (result == 0) {
+              request.contents.resize(offsets[file]);
+            } else {
+              offsets[file] += result;
+              if (offsets[file] < request.contents.size()) {
+                unfinished.push_back(file);
+              }
+            }
+          });
+      pending = std::move(unfinished);
+    }
+
+    Close(fds, [&](std::size_t i, int result) {
+      if (batch[i].error.empty()) {
+        batch[i].error =
+            ErrorMessage("closing", batch[i].path, ErrnoMessage(result));
+      }
+    });
+  }
+
+  void Write(std::vector<FileWrite>& batch) override {
+    std::vector<std::string> temp_paths;
+    temp_paths.reserve(batch.size());
+    for (const FileWrite& request : batch) {
+      temp_paths.push_back(TempPath(request.path).string());
+    }
+
+    std::vector<int> fds(batch.size(), -1);
+    ring_.Execute(
+        batch.size(),
+        [&](std::size_t i, io_uring_sqe& sqe) {
+          sqe.opcode = IORING_OP_OPENAT;
+          sqe.fd = AT_FDCWD;
+          sqe.addr = reinterpret_cast<__u64>(temp_paths[i].c_str());
+          sqe.len = 0666;
+          sqe.open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        },
+        [&](std::size_t i, int result) {
+          if (result < 0) {
+            batch[i].error =
+                ErrorMessage("opening", temp_paths[i], ErrnoMessage(result));
+          } else {
+            fds[i] = result;
+          }
+        });
+
+    std::vector<std::size_t> pending;
+    std::vector<std::size_t> offsets(batch.size(), 0);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (fds[i] >= 0 && !batch[i].contents.empty()) {
+        pending.push_back(i);
+      }
+    }
+    while (!pending.empty()) {
+      std::vector<std::size_t> unfinished;
+      ring_.Execute(
+          pending.size(),
+          [&](std::size_t i, io_uring_sqe& sqe) {
+            const std::size_t file = pending[i];
+            sqe.opcode = IORING_OP_WRITE;
+            sqe.fd = fds[file];
+            sqe.addr =
+                reinterpret_cast<__u64>(batch[file].contents.data() + offsets[file]);
+            sqe.len = static_cast<__u32>(batch[file].contents.size() -
+                                         offsets[file]);
+            sqe.off = offsets[file];
+          },
+          [&](std::size_t i, int result) {
+            const std::size_t file = pending[i];
+            FileWrite& request = batch[file];
+            if (result <= 0) {
+              request.error = ErrorMessage("writing to", temp_paths[file],
+                                           ErrnoMessage(result < 0 ? result
+                                                                   : -EIO));
+            } else {
+              offsets[file] += result;
+              if (offsets[file] < request.contents.size()) {
+                unfinished.push_back(file);
+              }
+            }
+          });
+      pending = std::move(unfinished);
+    }
+
+    if (durability_ == Durability::kFsync) {
+      const std::vector<std::size_t> written = Succeeded(batch, fds);
+      ring_.Execute(
+          written.size(),
+          [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.fd = fds[written[i]];
+          },
+          [&](std::size_t i, int result) {
+            if (result < 0) {
+              batch[written[i]].error = ErrorMessage(
+                  "syncing", temp_paths[written[i]], ErrnoMessage(result));
+            }
+          });
+    }
+
+    Close(fds, [&](std::size_t i, int result) {
+      if (batch[i].error.empty()) {
+        batch[i].error =
+            ErrorMessage("closing", temp_paths[i], ErrnoMessage(result));
+      }
+    });
+
+    const std::vector<std::size_t> complete = Succeeded(batch, fds);
+    const auto on_renamed = [&](std::size_t i, int result) {
+      if (result < 0) {
+        batch[complete[i]].error = ErrorMessage(
+            "renaming", temp_paths[complete[i]], ErrnoMessage(result));
+      }
+    };
+    if (supports_rename_) {
+      ring_.Execute(
+          complete.size(),
+          [&](std::size_t i, io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_RENAMEAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = reinterpret_cast<__u64>(temp_paths[complete[i]].c_str());
+            sqe.len = AT_FDCWD;
+            sqe.addr2 =
+                reinterpret_cast<__u64>(batch[complete[i]].path.c_str());
+          },
+          on_renamed);
+    } else {
+      for (std::size_t i = 0; i < complete.size(); ++i) {
+        on_renamed(i, rename(temp_paths[complete[i]].c_str(),
+                             batch[complete[i]].path.c_str()) == 0
+                          ? 0
+                          : -errno);
+      }
+    }
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (fds[i] >= 0 && !batch[i].error.empty()) {
+        unlink(temp_paths[i].c_str());
+      }
+    }
+    if (durability_ == Durability::kFsync) {
+      SyncDirectories(batch);
+    }
+  }
+
+ private:
+  // Indices of the files which were opened and have no error so far.
+  static std::vector<std::size_t> Succeeded(const std::vector<FileWrite>& batch,
+                                            const std::vector<int>& fds) {
+    std::vector<std::size_t> indices;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+      if (fds[i] >= 0 && batch[i].error.empty()) {
+        indices.push_back(i);
+      }
+    }
+    return indices;
+  }
+
+  // Closes all valid descriptors, `on_error` is called for failed closes.
+  void Close(const std::vector<int>& fds,
+             const std::function<void(std::size_t, int)>& on_error) {
+    std::vector<std::size_t> open;
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+      if (fds[i] >= 0) {
+        open.push_back(i);
+      }
+    }
+    ring_.Execute(
+        open.size(),
+        [&](std::size_t i, io_uring_sqe& sqe) {
+          sqe.opcode = IORING_OP_CLOSE;
+          sqe.fd = fds[open[i]];
+        },
+        [&](std::size_t i, int result) {
+          if (result < 0) {
+            on_error(open[i], result);
+          }
+        });
+  }
+
+  const Durability durability_;
+  IoUring ring_;
+  bool supports_rename_;
+};
+
+// The steps of each file are operations on a ring which is driven by a thread
+// of its own, the reactor. It resumes each coroutine on the executor once its
+// operations have completed, so files only hold a thread while parsing or
+// formatting. Steps which usually follow each other without a decision in
+// between are linked into one submission to save round trips. Operations
+// beyond the ring's capacity wait for a free entry.
+class IoUringAsyncIo : public AsyncIo {
+ public:
+  static constexpr unsigned kRingEntries = 256;
+
+  IoUringAsyncIo(Durability durability, Executor& executor)
+      : durability_(durability), executor_(executor), ring_(kRingEntries) {
+    if (!ring_.Supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                         IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE})) {
+      throw std::runtime_error("Kernel lacks required io_uring operations");
+    }
+    supports_rename_ = ring_.Supports({IORING_OP_RENAMEAT});
+    wakeup_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeup_fd_ < 0) {
+      throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+    reactor_ = std::thread([this]() { Run(); });
+  }
+
+  // All coroutines must have finished.
+  ~IoUringAsyncIo() override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    Wake();
+    reactor_.join();
+    close(wakeup_fd_);
+  }
+
+  std::string_view Name() const override { return "io_uring"; }
+
+  Task Read(FileRead& request) override {
+    struct statx stat = {};
+    Operations opened(*this, /*linked=*/false);
+    const std::size_t open =
+        opened.Add(OpenAt(request.path.c_str(), O_RDONLY | O_CLOEXEC, 0));
+    const std::size_t stated = opened.Add(Statx(request.path.c_str(), &stat));
+    co_await opened;
+    const int fd = opened.result(open);
+    if (fd < 0) {
+      request.error =
+          ErrorMessage("opening", request.path, ErrnoMessage(fd));
+      co_return;
+    }
+    if (opened.result(stated) < 0) {
+      request.error = ErrorMessage("stating", request.path,
+                                   ErrnoMessage(opened.result(stated)));
+    } else {
+      request.contents.resize(stat.stx_size);
+    }
+    // The close is linked to each read, so it is done along with the read
+    // which completes the file. Short reads cancel it and are resubmitted.
+    std::size_t offset = 0;
+    bool closed = false;
+    while (request.error.empty() && offset < request.contents.size()) {
+      Operations read(*this, /*linked=*/true);
+      const std::size_t transfer = read.Add(
+          Transfer(IORING_OP_READ, fd, request.contents.data() + offset,
+                   request.contents.size() - offset, offset));
+      const std::size_t close = read.Add(OnFile(IORING_OP_CLOSE, fd));
+      co_await read;
+      if (read.result(transfer) < 0) {
+        request.error = ErrorMessage("reading", request.path,
+                                     ErrnoMessage(read.result(transfer)));
+      } else if (read.result(transfer) == 0) {
+        request.contents.resize(offset);
+      } else {
+        offset += read.result(transfer);
+      }
+      if (read.result(close) != -ECANCELED) {
+        closed = true;
+        if (read.result(close) < 0 && request.error.empty()) {
+          request.error = ErrorMessage("closing", request.path,
+                                       ErrnoMessage(read.result(close)));
+        }
+      }
+    }
+    if (!closed) {
+      const int result = co_await Submit(OnFile(IORING_OP_CLOSE, fd));
+      if (result < 0 && request.error.empty()) {
+        request.error =
+            ErrorMessage("closing", request.path, ErrnoMessage(result));
+      }
+    }
+  }
+
+  Task Write(FileWrite& request) override {
+    const std::string temp_path = TempPath(request.path).string();
+    const int fd = co_await Submit(OpenAt(
+        temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+    if (fd < 0) {
+      request.error = ErrorMessage("opening", temp_path, ErrnoMessage(fd));
+      co_return;
+    }
+
+    // Usually a single write completes the file, so the sync, close and
+    // rename are linked behind it. A failed or short write cancels them, what
+    // is left is then done step by step.
+    std::size_t offset = 0;
+    bool synced = durability_ != Durability::kFsync;
+    bool closed = false;
+    bool renamed = false;
+    {
+      constexpr std::size_t kNone = Operations::kMaxCount;
+      Operations linked(*this, /*linked=*/true);
+      const std::size_t transfer =
+          request.contents.empty()
+              ? kNone
+              : linked.Add(Transfer(IORING_OP_WRITE, fd,
+                                    request.contents.data(),
+                                    request.contents.size(), 0));
+      const std::size_t sync =
+          synced ? kNone : linked.Add(OnFile(IORING_OP_FSYNC, fd));
+      const std::size_t close = linked.Add(OnFile(IORING_OP_CLOSE, fd));
+      const std::size_t rename =
+          supports_rename_
+              ? linked.Add(RenameAt(temp_path.c_str(), request.path.c_str()))
+              : kNone;
+      co_await linked;
+      if (transfer != kNone) {
+        if (linked.result(transfer) < 0) {
+          request.error = ErrorMessage("writing to", temp_path,
+                                       ErrnoMessage(linked.result(transfer)));
+        } else {
+          offset = linked.result(transfer);
+        }
+      }
+      if (sync != kNone && linked.result(sync) != -ECANCELED) {
+        synced = true;
+        if (linked.result(sync) < 0) {
+          request.error = ErrorMessage("syncing", temp_path,
+                                       ErrnoMessage(linked.result(sync)));
+        }
+      }
+      if (linked.result(close) != -ECANCELED) {
+        closed = true;
+        if (linked.result(close) < 0 && request.error.empty()) {
+          request.error = ErrorMessage("closing", temp_path,
+                                       ErrnoMessage(linked.result(close)));
+        }
+      }
+      if (rename != kNone && linked.result(rename) != -ECANCELED) {
+        renamed = true;
+        if (linked.result(rename) < 0 && request.error.empty()) {
+          request.error = ErrorMessage("renaming", temp_path,
+                                       ErrnoMessage(linked.result(rename)));
+        }
+      }
+    }
+
+    int result;
+    while (request.error.empty() && offset < request.contents.size()) {
+      result = co_await Submit(Transfer(IORING_OP_WRITE, fd,
+                                        request.contents.data() + offset,
+                                        request.contents.size() - offset,
+                                        offset));
+      if (result <= 0) {
+        request.error = ErrorMessage("writing to", temp_path,
+                                     ErrnoMessage(result < 0 ? result : -EIO));
+      } else {
+        offset += result;
+      }
+    }
+    if (request.error.empty() && !synced) {
+      result = co_await Submit(OnFile(IORING_OP_FSYNC, fd));
+      if (result < 0) {
+        request.error =
+            ErrorMessage("syncing", temp_path, ErrnoMessage(result));
+      }
+    }
+    if (!closed) {
+      result = co_await Submit(OnFile(IORING_OP_CLOSE, fd));
+      if (result < 0 && request.error.empty()) {
+        request.error =
+            ErrorMessage("closing", temp_path, ErrnoMessage(result));
+      }
+    }
+    if (request.error.empty() && !renamed) {
+      if (supports_rename_) {
+        result = co_await Submit(RenameAt(temp_path.c_str(),
+                                          request.path.c_str()));
+      } else {
+        result = rename(temp_path.c_str(), request.path.c_str()) == 0
+                     ? 0
+                     : -errno;
+      }
+      if (result < 0) {
+        request.error =
+            ErrorMessage("renaming", temp_path, ErrnoMessage(result));
+      }
+    }
+    if (!request.error.empty()) {
+      unlink(temp_path.c_str());
+    } else if (durability_ == Durability::kFsync) {
+      co_await SyncParentDirectory(request);
+    }
+  }
+
+ private:
+  // Operations submitted to the ring together by awaiting them, which
+  // resumes once all of them have completed. Linked operations run one after
+  // the other; one which fails or falls short cancels the rest, they complete
+  // with -ECANCELED.
+  class Operations {
+   public:
+    static constexpr std::size_t kMaxCount = 4;
+
+    Operations(IoUringAsyncIo& io, bool linked) : io_(io), linked_(linked) {}
+
+    // Returns the index of the operation's result.
+    std::size_t Add(const io_uring_sqe& sqe) {
+      sqes_[count_] = sqe;
+      return count_++;
+    }
+
+    int result(std::size_t index) const { return results_[index]; }
+
+    bool await_ready() const noexcept { return count_ == 0; }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+      for (std::size_t i = 0; linked_ && i + 1 < count_; ++i) {
+        sqes_[i].flags |= IOSQE_IO_LINK;
+      }
+      handle_ = awaiting;
+      remaining_ = count_;
+      io_.Enqueue(this);
+    }
+    void await_resume() const noexcept {}
+
+   private:
+    friend class IoUringAsyncIo;
+
+    IoUringAsyncIo& io_;
+    const bool linked_;
+    std::array<io_uring_sqe, kMaxCount> sqes_;
+    std::array<int, kMaxCount> results_ = {};
+    std::size_t count_ = 0;
+    // Only touched by the reactor once enqueued.
+    std::size_t remaining_ = 0;
+    std::coroutine_handle<> handle_;
+  };
+
+  // A single operation, awaiting it results in its completion result.
+  class Operation : public Operations {
+   public:
+    Operation(IoUringAsyncIo& io, const io_uring_sqe& sqe)
+        : Operations(io, /*linked=*/false) {
+      Add(sqe);
+    }
+
+    int await_resume() const noexcept { return result(0); }
+  };
+
+  // Submissions carry their Operations in user_data, the alignment leaves
+  // the low bits for the index of the operation.
+  static_assert(alignof(Operations) >= Operations::kMaxCount);
+
+  // Completions of the wakeup read carry this instead of Operations.
+  static constexpr std::uint64_t kWakeup = 0;
+
+  Operation Submit(const io_uring_sqe& sqe) { return Operation(*this, sqe); }
+
+  static io_uring_sqe OpenAt(const char* path, int flags, mode_t mode) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_OPENAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<__u64>(path);
+    sqe.len = mode;
+    sqe.open_flags = flags;
+    return sqe;
+  }
+
+  static io_uring_sqe Statx(const char* path, struct statx* stat) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_STATX;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<__u64>(path);
+    sqe.len = STATX_SIZE;
+    sqe.off = reinterpret_cast<__u64>(stat);
+    return sqe;
+  }
+
+  // A read or write of `size` bytes at `offset`.
+  static io_uring_sqe Transfer(int opcode, int fd, const char* data,
+                               std::size_t size, std::uint64_t offset) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = static_cast<__u8>(opcode);
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<__u64>(data);
+    sqe.len = static_cast<__u32>(size);
+    sqe.off = offset;
+    return sqe;
+  }
+
+  // An operation on an open file without further arguments.
+  static io_uring_sqe OnFile(int opcode, int fd) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = static_cast<__u8>(opcode);
+    sqe.fd = fd;
+    return sqe;
+  }
+
+  // Syncs the directory `request` was renamed into. Unlike batches, single
+  // files have no others to share the sync with.
+  Task SyncParentDirectory(FileWrite& request) {
+    const std::string directory = ParentDirectory(request.path).string();
+    const int fd = co_await Submit(
+        OpenAt(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0));
+    if (fd < 0) {
+      request.error = ErrorMessage("opening", directory, ErrnoMessage(fd));
+      co_return;
+    }
+    const int result = co_await Submit(OnFile(IORING_OP_FSYNC, fd));
+    if (result < 0) {
+      request.error = ErrorMessage("syncing", directory, ErrnoMessage(result));
+    }
+    co_await Submit(OnFile(IORING_OP_CLOSE, fd));
+  }
+
+  static io_uring_sqe RenameAt(const char* from, const char* to) {
+    io_uring_sqe sqe = {};
+    sqe.opcode = IORING_OP_RENAMEAT;
+    sqe.fd = AT_FDCWD;
+    sqe.addr = reinterpret_cast<__u64>(from);
+    sqe.len = AT_FDCWD;
+    sqe.addr2 = reinterpret_cast<__u64>(to);
+    return sqe;
+  }
+
+  void Enqueue(Operations* operations) {
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // The reactor takes all queued operations at once, only the first one
+      // after that needs to wake it.
+      idle = queued_.empty();
+      queued_.push_back(operations);
+    }
+    if (idle) {
+      Wake();
+    }
+  }
+
+  // Completes the wakeup read, which interrupts the reactor's wait.
+  void Wake() {
+    const std::uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0) {
+      // Only fails if the counter is about to overflow, it is awake then.
+    }
+  }
+
+  void ArmWakeup() {
+    io_uring_sqe sqe = Transfer(IORING_OP_READ, wakeup_fd_,
+                                reinterpret_cast<const char*>(&wakeup_value_),
+                                sizeof(wakeup_value_), 0);
+    sqe.user_data = kWakeup;
+    ring_.Prepare(sqe);
+  }
+
+  // Runs until stopped with nothing in flight. io_uring_enter only fails on
+  // programming errors once the ring is set up, which terminates.
+  void Run() {
+    ArmWakeup();
+    unsigned in_flight = 1;
+    std::vector<std::coroutine_handle<>> completed;
+    while (in_flight > 0) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Completions of at most sq_entries() operations fit the ring.
+        while (!queued_.empty() &&
+               in_flight + queued_.front()->count_ <= ring_.sq_entries()) {
+          Operations* operations = queued_.front();
+          queued_.pop_front();
+          for (std::size_t i = 0; i < operations->count_; ++i) {
+            operations->sqes_[i].user_data =
+                reinterpret_cast<std::uint64_t>(operations) | i;
+            ring_.Prepare(operations->sqes_[i]);
+          }
+          in_flight += static_cast<unsigned>(operations->count_);
+        }
+      }
+      ring_.Enter(1);
+      ring_.Reap([&](std::uint64_t user_data, int result) {
+        --in_flight;
+        if (user_data == kWakeup) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!stop_) {
+            ArmWakeup();
+            ++in_flight;
+          }
+          return;
+        }
+        Operations* operations = reinterpret_cast<Operations*>(
+            user_data & ~std::uint64_t{Operations::kMaxCount - 1});
+        operations->results_[user_data & (Operations::kMaxCount - 1)] =
+            result;
+        if (--operations->remaining_ == 0) {
+          completed.push_back(operations->handle_);
+        }
+      });
+      executor_.Post(completed);
+      completed.clear();
+    }
+  }
+
+  const Durability durability_;
+  Executor& executor_;
+  IoUring ring_;
+  bool supports_rename_;
+  int wakeup_fd_;
+  std::uint64_t wakeup_value_ = 0;
+  std::mutex mutex_;
+  // Waiting to be put on the ring.
+  std::deque<Operations*> queued_;
+  bool stop_ = false;
+  std::thread reactor_;
+};
+
+#endif  // __linux__
+
+}  // namespace
+
+AtomicFile::AtomicFile(const boost::filesystem::path& path,
+                       Durability durability)
+    : path_(path),
+      temp_path_(TempPath(path)),
+      durability_(durability),
+      file_(boost::nowide::fopen(temp_path_.string().data(), "wb")) {
+  if (!file_) {
+    throw std::invalid_argument(
+        ErrorMessage("opening", temp_path_, "fopen failed"));
+  }
+}
+
+AtomicFile::~AtomicFile() {
+  if (file_) {
+    fclose(file_);
+    boost::system::error_code error;
+    boost::filesystem::remove(temp_path_, error);
+  }
+}
+
+void AtomicFile::Write(std::string_view data) {
+  if (fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+    throw std::invalid_argument(
+        ErrorMessage("writing to", temp_path_, "fwrite failed"));
+  }
+}
+
+void AtomicFile::Commit() {
+  if (fflush(file_) != 0) {
+    throw std::invalid_argument(
+        ErrorMessage("writing to", temp_path_, "fflush failed"));
+  }
+  if (durability_ != Durability::kNone && !SyncFile(file_)) {
+    throw std::invalid_argument(
+        ErrorMessage("syncing", temp_path_, "fsync failed"));
+  }
+  const int result = fclose(file_);
+  file_ = nullptr;
+  if (result != 0) {
+    throw std::invalid_argument(
+        ErrorMessage("closing", temp_path_, "fclose failed"));
+  }
+  boost::system::error_code error;
+  boost::filesystem::rename(temp_path_, path_, error);
+  if (error) {
+    const std::string message =
+        ErrorMessage("renaming", temp_path_, error.message());
+    boost::filesystem::remove(temp_path_, error);
+    throw std::invalid_argument(message);
+  }
+  if (durability_ != Durability::kNone) {
+    if (std::string message = SyncDirectory(ParentDirectory(path_));
+        !message.empty()) {
+      throw std::invalid_argument(message);
+    }
+  }
+}
+
+Durability ParseDurability(std::string_view name) {
+  if (name == "none") {
+    return Durability::kNone;
+  }
+  if (name == "fsync") {
+    return Durability::kFsync;
+  }
+  if (name == "syncfs") {
+#ifdef _WIN32
+    throw std::invalid_argument("syncfs durability is not supported on Windows");
+#else
+    return Durability::kSyncfs;
+#endif
+  }
+  throw std::invalid_argument(
+      boost::str(boost::format("Unknown durability: \"%s\"") % name));
+}
+
+void SyncFilesystem(const boost::filesystem::path& directory) {
+#if defined(__linux__)
+  const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "open " + directory.string());
+  }
+  const int result = syncfs(fd);
+  const int error = errno;
+  close(fd);
+  if (result != 0) {
+    throw std::system_error(error, std::system_category(),
+                            "syncfs " + directory.string());
+  }
+#elif !defined(_WIN32)
+  sync();
+#endif
+}
+
+std::unique_ptr<IoBackend> CreateIoBackend(std::string_view name,
+                                           Durability durability) {
+  if (name == "posix") {
+    return std::make_unique<PosixIoBackend>(durability);
+  }
+  if (name == "io_uring" || name == "auto") {
+#ifdef __linux__
+    try {
+      return std::make_unique<IoUringBackend>(durability);
+    } catch (const std::exception& error) {
+      if (name == "io_uring") {
+        throw std::invalid_argument(boost::str(
+            boost::format("io_uring unavailable: %s") % error.what()));
+      }
+      return std::make_unique<PosixIoBackend>(durability);
+    }
+#else
+    if (name == "io_uring") {
+      throw std::invalid_argument("io_uring is only supported on Linux");
+    }
+    return std::make_unique<PosixIoBackend>(durability);
+#endif
+  }
+  throw std::invalid_argument(
+      boost::str(boost::format("Unknown I/O backend: \"%s\"") % name));
+}
+
+std::unique_ptr<AsyncIo> CreateAsyncIo(std::string_view name,
+                                       Durability durability,
+                                       Executor& executor,
+                                       std::size_t blocking_threads) {
+  if (name == "posix") {
+    return std::make_unique<BlockingAsyncIo>(durability, executor,
+                                             blocking_threads);
+  }
+  if (name == "io_uring" || name == "auto") {
+#ifdef __linux__
+    try {
+      return std::make_unique<IoUringAsyncIo>(durability, executor);
+    } catch (const std::exception& error) {
+      if (name == "io_uring") {
+        throw std::invalid_argument(boost::str(
+            boost::format("io_uring unavailable: %s") % error.what()));
+      }
+      return std::make_unique<BlockingAsyncIo>(durability, executor,
+                                               blocking_threads);
+    }
+#else
+    if (name == "io_uring") {
+      throw std::invalid_argument("io_uring is only supported on Linux");
+    }
+    return std::make_unique<BlockingAsyncIo>(durability, executor,
+                                             blocking_threads);
+#endif
+  }
+  throw std::invalid_argument(
+      boost::str(boost::format("Unknown I/O backend: \"%s\"") % name));
+}
+
+}  // namespace gpx_to_kml
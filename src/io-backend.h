@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "coroutine.h"
+
+namespace gpx_to_kml {
+
+struct FileRead {
+  boost::filesystem::path path;
+  std::string contents = {};
+  // Empty on success.
+  std::string error = {};
+};
+
+struct FileWrite {
+  boost::filesystem::path path;
+  std::string contents = {};
+  // Empty on success.
+  std::string error = {};
+};
+
+// How hard Write() tries to make finished outputs survive a power failure.
+// Outputs are always written to a temporary file and renamed into place, so a
+// killed run never leaves a truncated file under the final name.
+enum class Durability {
+  // Rename only.
+  kNone,
+  // fsync every file before renaming it into place.
+  kFsync,
+  // A single SyncFilesystem() call once all outputs have been written.
+  kSyncfs,
+};
+
+// Parses "none", "fsync" or "syncfs".
+Durability ParseDurability(std::string_view name);
+
+// Flushes the filesystem containing `directory` to stable storage.
+void SyncFilesystem(const boost::filesystem::path& directory);
+
+// Reads and writes whole files in batches. Per-file failures are reported via
+// the error member of each request; the calls only throw if the backend itself
+// fails. Instances are not thread-safe, use one per I/O thread.
+class IoBackend {
+ public:
+  virtual ~IoBackend() = default;
+
+  virtual std::string_view Name() const = 0;
+  virtual void Read(std::vector<FileRead>& batch) = 0;
+  virtual void Write(std::vector<FileWrite>& batch) = 0;
+};
+
+// Streams a single output to a temporary file which is renamed into place by
+// Commit(). Destroying an uncommitted file removes the temporary file.
+class AtomicFile {
+ public:
+  AtomicFile(const boost::filesystem::path& path, Durability durability);
+  ~AtomicFile();
+
+  AtomicFile(const AtomicFile&) = delete;
+  AtomicFile& operator=(const AtomicFile&) = delete;
+
+  const boost::filesystem::path& path() const { return path_; }
+  const boost::filesystem::path& temp_path() const { return temp_path_; }
+
+  void Write(std::string_view data);
+  // Any durability other than kNone syncs the file itself, a single sync is
+  // cheaper than relying on a later SyncFilesystem().
+  void Commit();
+
+ private:
+  const boost::filesystem::path path_;
+  const boost::filesystem::path temp_path_;
+  const Durability durability_;
+  FILE* file_;
+};
+
+// Supported names are "posix", "io_uring" and "auto". The latter picks
+// io_uring if the running kernel supports it and falls back to posix otherwise.
+std::unique_ptr<IoBackend> CreateIoBackend(
+    std::string_view name, Durability durability = Durability::kNone);
+
+// Reads and writes single files for coroutines, which are suspended until the
+// I/O has completed and then resumed on an executor. Per-file failures are
+// reported via the error member of each request. Thread-safe.
+class AsyncIo {
+ public:
+  virtual ~AsyncIo() = default;
+
+  virtual std::string_view Name() const = 0;
+  // The request must outlive the returned task.
+  virtual Task Read(FileRead& request) = 0;
+  virtual Task Write(FileWrite& request) = 0;
+};
+
+// Names as for CreateIoBackend(). With io_uring the open, read, write and
+// close of each file are awaited on a ring driven by a single thread. posix
+// runs the blocking calls on `blocking_threads` threads of its own.
+std::unique_ptr<AsyncIo> CreateAsyncIo(std::string_view name,
+                                       Durability durability,
+                                       Executor& executor,
+                                       std::size_t blocking_threads);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,97 @@
+#include "iso-time.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Consumes exactly `digits` decimal digits.
+bool ParseDigits(std::string_view& text, int digits, int& value) {
+  if (text.size() < static_cast<std::size_t>(digits)) {
+    return false;
+  }
+  value = 0;
+  for (int i = 0; i < digits; ++i) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    value = value * 10 + (text[i] - '0');
+  }
+  text.remove_prefix(digits);
+  return true;
+}
+
+bool Consume(std::string_view& text, char c) {
+  if (text.empty() || text.front() != c) {
+    return false;
+  }
+  text.remove_prefix(1);
+  return true;
+}
+
+int DaysInMonth(int year, int month) {
+  if (month == 2) {
+    const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    return leap ? 29 : 28;
+  }
+  return month == 4 || month == 6 || month == 9 || month == 11 ? 30 : 31;
+}
+
+}  // namespace
+
+std::optional<std::int64_t> ParseIsoTime(std::string_view text) {
+  const std::size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string_view::npos) {
+    return std::nullopt;
+  }
+  text = text.substr(begin, text.find_last_not_of(" \t\r\n") + 1 - begin);
+  int year, month, day, hour, minute, second;
+  if (!ParseDigits(text, 4, year) || !Consume(text, '-') ||
+      !ParseDigits(text, 2, month) || !Consume(text, '-') ||
+      !ParseDigits(text, 2, day) || !Consume(text, 'T') ||
+      !ParseDigits(text, 2, hour) || !Consume(text, ':') ||
+      !ParseDigits(text, 2, minute) || !Consume(text, ':') ||
+      !ParseDigits(text, 2, second)) {
+    return std::nullopt;
+  }
+  // Leap seconds are folded into the following second.
+  if (month < 1 || month > 12 || day < 1 || day > DaysInMonth(year, month) ||
+      hour > 23 || minute > 59 || second > 60) {
+    return std::nullopt;
+  }
+  int milliseconds = 0;
+  if (Consume(text, '.')) {
+    int scale = 100;
+    if (text.empty() || text.front() < '0' || text.front() > '9') {
+      return std::nullopt;
+    }
+    while (!text.empty() && text.front() >= '0' && text.front() <= '9') {
+      milliseconds += (text.front() - '0') * scale;
+      scale /= 10;
+      text.remove_prefix(1);
+    }
+  }
+  int offset_minutes = 0;
+  if (!text.empty() && (text.front() == '+' || text.front() == '-')) {
+    const int sign = text.front() == '+' ? 1 : -1;
+    text.remove_prefix(1);
+    int offset_hours, offset_minute;
+    if (!ParseDigits(text, 2, offset_hours)) {
+      return std::nullopt;
+    }
+    Consume(text, ':');
+    if (!ParseDigits(text, 2, offset_minute)) {
+      return std::nullopt;
+    }
+    offset_minutes = sign * (offset_hours * 60 + offset_minute);
+  } else {
+    Consume(text, 'Z');
+  }
+  if (!text.empty()) {
+    return std::nullopt;
+  }
+  const std::int64_t seconds =
+      DaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 +
+      second - offset_minutes * 60;
+  return seconds * 1000 + milliseconds;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace gpx_to_kml {
+
+// Converts a proleptic Gregorian UTC date to days since 1970-01-01.
+constexpr std::int64_t DaysFromCivil(std::int64_t year, unsigned month,
+                                     unsigned day) {
+  year -= month <= 2;
+  const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const unsigned year_of_era = static_cast<unsigned>(year - era * 400);
+  const unsigned day_of_year =
+      (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const unsigned day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + static_cast<std::int64_t>(day_of_era) - 719468;
+}
+
+struct CivilDate {
+  std::int64_t year;
+  unsigned month;
+  unsigned day;
+};
+
+// Inverse of DaysFromCivil().
+constexpr CivilDate CivilFromDays(std::int64_t days) {
+  days += 719468;
+  const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  const unsigned day_of_era = static_cast<unsigned>(days - era * 146097);
+  const unsigned year_of_era =
+      (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+       day_of_era / 146096) /
+      365;
+  const unsigned day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const unsigned shifted_month = (5 * day_of_year + 2) / 153;
+  const unsigned month = shifted_month < 10 ? shifted_month + 3
+                                            : shifted_month - 9;
+  return CivilDate{
+      .year = static_cast<std::int64_t>(year_of_era) + era * 400 + (month <= 2),
+      .month = month,
+      .day = day_of_year - (153 * shifted_month + 2) / 5 + 1};
+}
+
+// Parses an ISO 8601 timestamp as used by GPX, e.g. "2022-01-10T08:00:00Z",
+// into milliseconds since the Unix epoch. Accepts fractional seconds and "Z",
+// "+hh:mm" or "-hh:mm" zone designators, a missing designator means UTC.
+// Rejects dates which don't exist, e.g. February 31. Unlike std::get_time this
+// neither allocates nor depends on the locale, which matters since it runs for
+// every track point.
+std::optional<std::int64_t> ParseIsoTime(std::string_view text);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,76 @@
+#include "journal.h"
+
+#include <stdexcept>
+
+#include "boost/format.hpp"
+#include "boost/nowide/cstdio.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+// Entries are an input and an output name, each terminated by a null
+// character, which neither paths nor names contain.
+constexpr char kTerminator = '\0';
+
+}  // namespace
+
+Journal::Journal(const boost::filesystem::path& path) : path_(path) {
+  std::string contents;
+  if (FILE* file = boost::nowide::fopen(path.string().data(), "rb")) {
+    char buffer[64 * 1024];
+    std::size_t num_read;
+    while ((num_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      contents.append(buffer, num_read);
+    }
+    const bool failed = ferror(file);
+    fclose(file);
+    if (failed) {
+      throw std::invalid_argument(boost::str(
+          boost::format("Failed reading \"%s\"") % path.string()));
+    }
+  }
+
+  std::size_t complete = 0;
+  while (true) {
+    const std::size_t input_end = contents.find(kTerminator, complete);
+    if (input_end == std::string::npos) {
+      break;
+    }
+    const std::size_t name_end = contents.find(kTerminator, input_end + 1);
+    if (name_end == std::string::npos) {
+      break;
+    }
+    loaded_.insert_or_assign(
+        contents.substr(complete, input_end - complete),
+        contents.substr(input_end + 1, name_end - input_end - 1));
+    complete = name_end + 1;
+  }
+  // A run killed while adding an entry may have left it incomplete, which
+  // would otherwise run into the next one.
+  if (complete < contents.size()) {
+    boost::filesystem::resize_file(path, complete);
+  }
+
+  file_ = boost::nowide::fopen(path.string().data(), "ab");
+  if (!file_) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Failed opening \"%s\"") % path.string()));
+  }
+}
+
+Journal::~Journal() { fclose(file_); }
+
+void Journal::Add(std::string_view input, std::string_view output_name) {
+  std::string entry(input);
+  entry += kTerminator;
+  entry += output_name;
+  entry += kTerminator;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fwrite(entry.data(), 1, entry.size(), file_) != entry.size() ||
+      fflush(file_) != 0) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Failed writing \"%s\"") % path_.string()));
+  }
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Records which inputs have been converted and the output name each got, so an
+// interrupted run can resume where it stopped. Every entry is handed to the
+// operating system right away, it survives the process being killed but not
+// necessarily a power failure. Thread-safe.
+class Journal {
+ public:
+  // Loads the entries of earlier runs from `path`, if it exists, and appends
+  // new ones to it.
+  explicit Journal(const boost::filesystem::path& path);
+  ~Journal();
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  // Output names by input of the earlier runs.
+  const std::unordered_map<std::string, std::string>& loaded() const {
+    return loaded_;
+  }
+
+  void Add(std::string_view input, std::string_view output_name);
+
+ private:
+  const boost::filesystem::path path_;
+  // Only written by the constructor.
+  std::unordered_map<std::string, std::string> loaded_;
+  std::mutex mutex_;
+  FILE* file_ = nullptr;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,152 @@
+#include "kml.h"
+
+#include <utility>
+
+#include "format.h"
+#include "tinyxml2/tinyxml2.h"
+
+namespace gpx_to_kml {
+
+std::string FormatKml(const Activity& activity, std::string_view document_name,
+                      std::string_view placemark_name) {
+  tinyxml2::XMLDocument xml_doc;
+  xml_doc.InsertEndChild(xml_doc.NewDeclaration());
+
+  tinyxml2::XMLElement* root = xml_doc.NewElement("kml");
+  root->SetAttribute("xmlns", "http://www.opengis.net/kml/2.2");
+  root->SetAttribute("xmlns:gx", "http://www.google.com/kml/ext/2.2");
+  root->SetAttribute("xmlns:kml", "http://www.opengis.net/kml/2.2");
+  root->SetAttribute("xmlns:atom", "http://www.w3.org/2005/Atom");
+  tinyxml2::XMLElement* document = root->InsertNewChildElement("Document");
+  document->InsertNewChildElement("name")->SetText(
+      std::string(document_name).data());
+  tinyxml2::XMLElement* style = document->InsertNewChildElement("Style");
+  style->SetAttribute("id", "style1");
+  tinyxml2::XMLElement* line_style = style->InsertNewChildElement("LineStyle");
+  line_style->InsertNewChildElement("color")->SetText("ff0000ff");
+  line_style->InsertNewChildElement("width")->SetText("4");
+  tinyxml2::XMLElement* style_map = document->InsertNewChildElement("StyleMap");
+  style_map->SetAttribute("id", "stylemap_id00");
+  tinyxml2::XMLElement* pair = style_map->InsertNewChildElement("Pair");
+  pair->InsertNewChildElement("key")->SetText("normal");
+  pair->InsertNewChildElement("styleUrl")->SetText("style1");
+  pair = style_map->InsertNewChildElement("Pair");
+  pair->InsertNewChildElement("key")->SetText("highlight");
+  pair->InsertNewChildElement("styleUrl")->SetText("style1");
+
+  tinyxml2::XMLElement* place = document->InsertNewChildElement("Placemark");
+  place->InsertNewChildElement("name")->SetText(
+      std::string(placemark_name).data());
+  place->InsertNewChildElement("styleUrl")->SetText("#stylemap_id00");
+
+  std::string coordinate_string;
+  for (const Coordinate& coordinate : activity.coordinates) {
+    AppendFixed(coordinate_string, coordinate.lon, kCoordinatePrecision);
+    coordinate_string += ',';
+    AppendFixed(coordinate_string, coordinate.lat, kCoordinatePrecision);
+    coordinate_string += ',';
+    AppendFixed(coordinate_string, coordinate.alt, kCoordinatePrecision);
+    coordinate_string += ' ';
+  }
+  place->InsertNewChildElement("MultiGeometry")
+      ->InsertNewChildElement("LineString")
+      ->InsertNewChildElement("coordinates")
+      ->SetText(coordinate_string.data());
+  xml_doc.InsertEndChild(root);
+
+  tinyxml2::XMLPrinter printer;
+  xml_doc.Print(&printer);
+  return std::string(printer.CStr(), printer.CStrSize() - 1);
+}
+
+std::string FormatKmlTrack(const Activity& activity,
+                           std::string_view document_name,
+                           std::string_view placemark_name) {
+  // Streamed through the printer FormatKml() prints its document with, so both
+  // look alike.
+  tinyxml2::XMLPrinter printer;
+  const auto push_element = [&printer](const char* name, const char* text) {
+    printer.OpenElement(name);
+    printer.PushText(text);
+    printer.CloseElement();
+  };
+  printer.PushDeclaration("xml version=\"1.0\" encoding=\"UTF-8\"");
+  printer.OpenElement("kml");
+  printer.PushAttribute("xmlns", "http://www.opengis.net/kml/2.2");
+  printer.PushAttribute("xmlns:gx", "http://www.google.com/kml/ext/2.2");
+  printer.PushAttribute("xmlns:kml", "http://www.opengis.net/kml/2.2");
+  printer.PushAttribute("xmlns:atom", "http://www.w3.org/2005/Atom");
+  printer.OpenElement("Document");
+  push_element("name", std::string(document_name).data());
+  printer.OpenElement("Style");
+  printer.PushAttribute("id", "style1");
+  printer.OpenElement("LineStyle");
+  push_element("color", "ff0000ff");
+  push_element("width", "4");
+  printer.CloseElement();
+  printer.CloseElement();
+  printer.OpenElement("StyleMap");
+  printer.PushAttribute("id", "stylemap_id00");
+  for (const char* key : {"normal", "highlight"}) {
+    printer.OpenElement("Pair");
+    push_element("key", key);
+    push_element("styleUrl", "style1");
+    printer.CloseElement();
+  }
+  printer.CloseElement();
+
+  printer.OpenElement("Placemark");
+  push_element("name", std::string(placemark_name).data());
+  push_element("styleUrl", "#stylemap_id00");
+  printer.OpenElement("gx:Track");
+  std::string text;
+  for (const Coordinate& coordinate : activity.coordinates) {
+    text.clear();
+    AppendIsoTime(text, coordinate.time);
+    push_element("when", text.data());
+  }
+  for (const Coordinate& coordinate : activity.coordinates) {
+    text.clear();
+    AppendFixed(text, coordinate.lon, kCoordinatePrecision);
+    text += ' ';
+    AppendFixed(text, coordinate.lat, kCoordinatePrecision);
+    text += ' ';
+    AppendFixed(text, coordinate.alt, kCoordinatePrecision);
+    push_element("gx:coord", text.data());
+  }
+  printer.CloseElement();
+  printer.CloseElement();
+  printer.CloseElement();
+  printer.CloseElement();
+  return std::string(printer.CStr(), printer.CStrSize() - 1);
+}
+
+std::string FormatGroundOverlay(std::string_view name, std::string_view href,
+                                double north, double south, double east,
+                                double west) {
+  tinyxml2::XMLDocument xml_doc;
+  xml_doc.InsertEndChild(xml_doc.NewDeclaration());
+
+  tinyxml2::XMLElement* root = xml_doc.NewElement("kml");
+  root->SetAttribute("xmlns", "http://www.opengis.net/kml/2.2");
+  tinyxml2::XMLElement* overlay = root->InsertNewChildElement("GroundOverlay");
+  overlay->InsertNewChildElement("name")->SetText(std::string(name).data());
+  overlay->InsertNewChildElement("Icon")
+      ->InsertNewChildElement("href")
+      ->SetText(std::string(href).data());
+  tinyxml2::XMLElement* box = overlay->InsertNewChildElement("LatLonBox");
+  for (const auto& [element, value] :
+       {std::pair("north", north), std::pair("south", south),
+        std::pair("east", east), std::pair("west", west)}) {
+    std::string text;
+    AppendFixed(text, value, kCoordinatePrecision);
+    box->InsertNewChildElement(element)->SetText(text.data());
+  }
+  xml_doc.InsertEndChild(root);
+
+  tinyxml2::XMLPrinter printer;
+  xml_doc.Print(&printer);
+  return std::string(printer.CStr(), printer.CStrSize() - 1);
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "activity.h"
+
+namespace gpx_to_kml {
+
+// Formats `activity` as a KML document with a single styled LineString.
+std::string FormatKml(const Activity& activity, std::string_view document_name,
+                      std::string_view placemark_name);
+
+// Like FormatKml() but with a gx:Track carrying the time of every point,
+// which enables Google Earth's time slider. All points must have a time.
+// Printed in a single pass without building a DOM, tracks have thousands of
+// points with two elements each.
+std::string FormatKmlTrack(const Activity& activity,
+                           std::string_view document_name,
+                           std::string_view placemark_name);
+
+// Formats a KML document draping the image at `href` over the given
+// longitude/latitude box.
+std::string FormatGroundOverlay(std::string_view name, std::string_view href,
+                                double north, double south, double east,
+                                double west);
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,228 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gpx_to_kml {
+namespace {
+
+// Lines a thread may log ahead of the writer before it has to wait.
+constexpr std::size_t kRingSize = 1024;
+// Longest time a line waits to be written.
+constexpr std::chrono::milliseconds kFlushInterval(20);
+
+struct Line {
+  // Orders the lines of all threads.
+  std::uint64_t sequence = 0;
+  std::string text;
+  bool error = false;
+};
+
+// Lines of one thread on their way to the writer. Single producer, single
+// consumer.
+class LineRing {
+ public:
+  // Returns false if the ring is full.
+  bool TryPush(Line& line) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kRingSize) {
+      return false;
+    }
+    lines_[tail % kRingSize] = std::move(line);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves all lines to the end of `lines`.
+  void Drain(std::vector<Line>& lines) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t tail = tail_.load(std::memory_order_acquire);
+    for (std::size_t i = head; i != tail; ++i) {
+      lines.push_back(std::move(lines_[i % kRingSize]));
+    }
+    head_.store(tail, std::memory_order_release);
+  }
+
+  // Set once the owning thread has exited.
+  std::atomic<bool> abandoned = false;
+
+ private:
+  std::array<Line, kRingSize> lines_;
+  alignas(64) std::atomic<std::size_t> head_ = 0;
+  alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+
+void Write(const std::string& text, FILE* stream) {
+  if (!text.empty()) {
+    fwrite(text.data(), 1, text.size(), stream);
+    fflush(stream);
+  }
+}
+
+// Writes the lines of all threads, created by a Logger.
+class AsyncWriter {
+ public:
+  AsyncWriter() : id_(++num_writers), thread_([this]() { Run(); }) {}
+
+  ~AsyncWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+  }
+
+  void Push(Line& line) {
+    LineRing& ring = ThreadRing();
+    while (!ring.TryPush(line)) {
+      // The writer is behind, have it catch up now.
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        urgent_ = true;
+      }
+      wake_.notify_one();
+      std::this_thread::yield();
+    }
+  }
+
+ private:
+  // Keeps the ring of a thread and marks it abandoned when the thread exits.
+  struct ThreadState {
+    std::uint64_t writer_id = 0;
+    std::shared_ptr<LineRing> ring;
+
+    ~ThreadState() {
+      if (ring) {
+        ring->abandoned = true;
+      }
+    }
+  };
+
+  LineRing& ThreadRing() {
+    thread_local ThreadState state;
+    // Rings of an earlier writer are not drained anymore.
+    if (state.writer_id != id_) {
+      if (state.ring) {
+        state.ring->abandoned = true;
+      }
+      state.writer_id = id_;
+      state.ring = std::make_shared<LineRing>();
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.push_back(state.ring);
+    }
+    return *state.ring;
+  }
+
+  void Run() {
+    std::vector<std::shared_ptr<LineRing>> rings;
+    std::vector<Line> lines;
+    std::string text;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait_for(lock, kFlushInterval,
+                     [this]() { return stop_ || urgent_; });
+      urgent_ = false;
+      const bool stop = stop_;
+      // Rings abandoned before they are drained have no more lines coming.
+      rings = rings_;
+      std::erase_if(rings_, [](const std::shared_ptr<LineRing>& ring) {
+        return ring->abandoned.load();
+      });
+      lock.unlock();
+
+      for (const std::shared_ptr<LineRing>& ring : rings) {
+        ring->Drain(lines);
+      }
+      std::sort(lines.begin(), lines.end(),
+                [](const Line& a, const Line& b) {
+                  return a.sequence < b.sequence;
+                });
+      // A single write per run of lines of the same stream, which keeps the
+      // order between stdout and stderr.
+      FILE* stream = stdout;
+      for (const Line& line : lines) {
+        FILE* const line_stream = line.error ? stderr : stdout;
+        if (line_stream != stream) {
+          Write(text, stream);
+          text.clear();
+          stream = line_stream;
+        }
+        text += line.text;
+      }
+      Write(text, stream);
+      text.clear();
+      lines.clear();
+      rings.clear();
+
+      lock.lock();
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+  static inline std::atomic<std::uint64_t> num_writers = 0;
+
+  // Tells the writers of successive Loggers apart.
+  const std::uint64_t id_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<std::shared_ptr<LineRing>> rings_;
+  bool urgent_ = false;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+std::atomic<Verbosity> verbosity = Verbosity::kNormal;
+std::atomic<std::uint64_t> num_lines = 0;
+std::atomic<AsyncWriter*> async_writer = nullptr;
+// Serializes the lines written without a Logger.
+std::mutex sync_mutex;
+
+}  // namespace
+
+void SetVerbosity(Verbosity value) { verbosity = value; }
+
+LogMessage::LogMessage(bool enabled, bool error)
+    : enabled_(enabled), error_(error) {}
+
+LogMessage::~LogMessage() {
+  if (!enabled_) {
+    return;
+  }
+  Line line{.sequence = num_lines.fetch_add(1, std::memory_order_relaxed),
+            .text = std::move(stream_).str(),
+            .error = error_};
+  line.text += '\n';
+  if (AsyncWriter* writer = async_writer.load(std::memory_order_acquire)) {
+    writer->Push(line);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sync_mutex);
+  Write(line.text, error_ ? stderr : stdout);
+}
+
+LogMessage Log(Verbosity level) {
+  return LogMessage(level <= verbosity.load(std::memory_order_relaxed),
+                    /*error=*/false);
+}
+
+LogMessage LogError() { return LogMessage(/*enabled=*/true, /*error=*/true); }
+
+Logger::Logger() { async_writer = new AsyncWriter(); }
+
+Logger::~Logger() { delete async_writer.exchange(nullptr); }
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+namespace gpx_to_kml {
+
+// How much is reported. Each message is shown if the selected verbosity is at
+// least its own.
+enum class Verbosity {
+  // Only errors and the final counts.
+  kQuiet,
+  // Also progress of every file.
+  kNormal,
+  // Also statistics of the run.
+  kVerbose,
+};
+
+// Messages are shown at or below this verbosity, kNormal unless set.
+void SetVerbosity(Verbosity verbosity);
+
+// Collects one line of output, which is logged when the message is destroyed.
+// Output of a disabled verbosity is dropped without being formatted.
+class LogMessage {
+ public:
+  LogMessage(bool enabled, bool error);
+  ~LogMessage();
+
+  LogMessage(const LogMessage&) = delete;
+  LogMessage& operator=(const LogMessage&) = delete;
+
+  template <typename T>
+  LogMessage& operator<<(const T& value) {
+    if (enabled_) {
+      stream_ << value;
+    }
+    return *this;
+  }
+
+ private:
+  const bool enabled_;
+  const bool error_;
+  std::ostringstream stream_;
+};
+
+// A line for stdout, shown at `verbosity` and above.
+LogMessage Log(Verbosity verbosity);
+// A line for stderr, always shown.
+LogMessage LogError();
+
+// While a Logger exists messages are written by a thread of its own: each
+// logging thread appends to a lock-free ring of its own, which the writer
+// drains periodically with a single write per run of lines of the same stream,
+// so stdout and stderr stay in the order the lines were logged. Without a
+// Logger messages are written immediately. At most one Logger may exist at a
+// time.
+class Logger {
+ public:
+  Logger();
+  // Writes all pending messages. No messages may be logged concurrently.
+  ~Logger();
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+};
+
+}  // namespace gpx_to_kml
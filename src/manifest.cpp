@@ -0,0 +1,240 @@
+#include "manifest.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#include "boost/format.hpp"
+#include "boost/nowide/cstdio.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+// Followed by the start time of the run which wrote the file, the number of
+// entries and the entries. All integers are little endian.
+constexpr std::string_view kMagic = "GPXKMLM1";
+
+void AppendInteger(std::string& out, std::uint64_t value, int bytes = 8) {
+  for (int i = 0; i < bytes; ++i) {
+    out += static_cast<char>(value >> (8 * i));
+  }
+}
+
+void AppendString(std::string& out, std::string_view value) {
+  AppendInteger(out, value.size(), 4);
+  out += value;
+}
+
+// Reads what the Append functions wrote, throws past the end of the data.
+class Reader {
+ public:
+  Reader(std::string_view data, const boost::filesystem::path& path)
+      : data_(data), path_(path) {}
+
+  std::uint64_t Integer(int bytes = 8) {
+    const std::string_view data = Take(bytes);
+    std::uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+      value |= std::uint64_t{static_cast<unsigned char>(data[i])} << (8 * i);
+    }
+    return value;
+  }
+
+  std::string String() { return std::string(Take(Integer(4))); }
+
+  std::string_view Take(std::size_t size) {
+    if (size > data_.size()) {
+      throw std::invalid_argument(boost::str(
+          boost::format("Truncated manifest \"%s\"") % path_.string()));
+    }
+    const std::string_view taken = data_.substr(0, size);
+    data_.remove_prefix(size);
+    return taken;
+  }
+
+  bool empty() const { return data_.empty(); }
+
+ private:
+  std::string_view data_;
+  const boost::filesystem::path& path_;
+};
+
+}  // namespace
+
+Manifest::Manifest(const boost::filesystem::path& path,
+                   std::uint64_t options_hash)
+    : path_(path), options_hash_(options_hash), start_(std::time(nullptr)) {
+  FILE* file = boost::nowide::fopen(path.string().data(), "rb");
+  if (!file) {
+    // The first run.
+    return;
+  }
+  std::string contents;
+  char buffer[64 * 1024];
+  std::size_t num_read;
+  while ((num_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, num_read);
+  }
+  const bool failed = ferror(file);
+  fclose(file);
+  if (failed) {
+    throw std::invalid_argument(
+        boost::str(boost::format("Failed reading \"%s\"") % path.string()));
+  }
+
+  Reader reader(contents, path);
+  if (reader.Take(kMagic.size()) != kMagic) {
+    throw std::invalid_argument(
+        boost::str(boost::format("Not a manifest \"%s\"") % path.string()));
+  }
+  loaded_start_ = static_cast<std::time_t>(reader.Integer());
+  const std::uint64_t num_entries = reader.Integer();
+  // Bounded by the smallest possible entry, a corrupt count mustn't reserve
+  // unbounded memory.
+  loaded_.reserve(std::min<std::uint64_t>(num_entries, contents.size() / 44));
+  for (std::uint64_t i = 0; i < num_entries; ++i) {
+    std::string input = reader.String();
+    ManifestEntry entry;
+    entry.size = reader.Integer();
+    entry.mtime = static_cast<std::int64_t>(reader.Integer());
+    entry.content_hash = reader.Integer();
+    entry.options_hash = reader.Integer();
+    entry.name = reader.String();
+    const std::uint64_t num_outputs = reader.Integer(4);
+    for (std::uint64_t j = 0; j < num_outputs; ++j) {
+      entry.outputs.push_back(reader.String());
+    }
+    loaded_.insert_or_assign(std::move(input), std::move(entry));
+  }
+  if (!reader.empty()) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Trailing data in manifest \"%s\"") % path.string()));
+  }
+}
+
+bool Manifest::Unchanged(const std::string& input, std::uint64_t size,
+                         std::int64_t mtime) const {
+  const auto earlier = loaded_.find(input);
+  return earlier != loaded_.end() &&
+         earlier->second.options_hash == options_hash_ &&
+         earlier->second.size == size && earlier->second.mtime == mtime &&
+         mtime < loaded_start_;
+}
+
+void Manifest::Listed(const std::string& input, std::uint64_t size,
+                      std::int64_t mtime) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ManifestEntry& pending = pending_[input];
+  pending.size = size;
+  pending.mtime = mtime;
+  if (const auto earlier = loaded_.find(input); earlier != loaded_.end()) {
+    entries_.insert_or_assign(input, earlier->second);
+  }
+}
+
+std::optional<std::uint64_t> Manifest::KnownContentHash(
+    const std::string& input) const {
+  const auto earlier = loaded_.find(input);
+  if (earlier == loaded_.end()) {
+    return std::nullopt;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto pending = pending_.find(input);
+  if (pending == pending_.end() ||
+      pending->second.size != earlier->second.size ||
+      pending->second.mtime != earlier->second.mtime ||
+      pending->second.mtime >= loaded_start_) {
+    return std::nullopt;
+  }
+  return earlier->second.content_hash;
+}
+
+bool Manifest::Hashed(const std::string& input, std::uint64_t content_hash) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[input].content_hash = content_hash;
+  }
+  const auto earlier = loaded_.find(input);
+  return earlier != loaded_.end() &&
+         earlier->second.options_hash == options_hash_ &&
+         earlier->second.content_hash == content_hash;
+}
+
+void Manifest::Keep(const std::string& input) {
+  ManifestEntry entry = loaded_.at(input);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (const auto pending = pending_.find(input); pending != pending_.end()) {
+    entry.size = pending->second.size;
+    entry.mtime = pending->second.mtime;
+    pending_.erase(pending);
+  }
+  entries_.insert_or_assign(input, std::move(entry));
+}
+
+std::vector<std::string> Manifest::Converted(const std::string& input,
+                                             std::string name,
+                                             std::vector<std::string> outputs) {
+  std::vector<std::string> stale;
+  if (const auto earlier = loaded_.find(input); earlier != loaded_.end()) {
+    for (const std::string& output : earlier->second.outputs) {
+      if (std::find(outputs.begin(), outputs.end(), output) == outputs.end()) {
+        stale.push_back(output);
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ManifestEntry entry;
+  if (const auto pending = pending_.find(input); pending != pending_.end()) {
+    entry = std::move(pending->second);
+    pending_.erase(pending);
+  } else if (const auto converted = entries_.find(input);
+             converted != entries_.end()) {
+    // Converted again, e.g. dropped as a duplicate, the size, modification
+    // time and content hash are still the ones recorded before.
+    entry = std::move(converted->second);
+  }
+  entry.options_hash = options_hash_;
+  entry.name = std::move(name);
+  entry.outputs = std::move(outputs);
+  entries_.insert_or_assign(input, std::move(entry));
+  return stale;
+}
+
+void Manifest::Write(Durability durability, bool listed_all) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<const std::pair<const std::string, ManifestEntry>*> entries;
+  entries.reserve(entries_.size());
+  for (const auto& entry : entries_) {
+    entries.push_back(&entry);
+  }
+  if (!listed_all) {
+    for (const auto& entry : loaded_) {
+      if (!entries_.contains(entry.first)) {
+        entries.push_back(&entry);
+      }
+    }
+  }
+
+  std::string out(kMagic);
+  AppendInteger(out, static_cast<std::uint64_t>(start_));
+  AppendInteger(out, entries.size());
+  for (const auto* entry : entries) {
+    const auto& [input, value] = *entry;
+    AppendString(out, input);
+    AppendInteger(out, value.size);
+    AppendInteger(out, static_cast<std::uint64_t>(value.mtime));
+    AppendInteger(out, value.content_hash);
+    AppendInteger(out, value.options_hash);
+    AppendString(out, value.name);
+    AppendInteger(out, value.outputs.size(), 4);
+    for (const std::string& output : value.outputs) {
+      AppendString(out, output);
+    }
+  }
+
+  AtomicFile file(path_, durability);
+  file.Write(out);
+  file.Commit();
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// What a run knew about an input after converting it.
+struct ManifestEntry {
+  std::uint64_t size = 0;
+  // Last modification, in seconds since the Unix epoch.
+  std::int64_t mtime = 0;
+  std::uint64_t content_hash = 0;
+  // Of the options which affect the outputs.
+  std::uint64_t options_hash = 0;
+  // Claimed output name and the filenames of the outputs.
+  std::string name;
+  std::vector<std::string> outputs;
+};
+
+// Remembers the inputs converted by earlier runs, so a run only converts new or
+// changed ones. Kept in a compact binary file which is read in one go and
+// replaced at the end of each run. Thread-safe.
+class Manifest {
+ public:
+  // Loads `path` if it exists, the entries converted with other options than
+  // `options_hash` are out of date. Throws if the file is corrupt.
+  Manifest(const boost::filesystem::path& path, std::uint64_t options_hash);
+
+  Manifest(const Manifest&) = delete;
+  Manifest& operator=(const Manifest&) = delete;
+
+  // Entries of the earlier runs by input, only read after construction.
+  const std::unordered_map<std::string, ManifestEntry>& loaded() const {
+    return loaded_;
+  }
+
+  // Returns true if the earlier entry of `input` matches its size and
+  // modification time, without reading it. Files modified during the earlier
+  // run may have changed in the same second and never match.
+  bool Unchanged(const std::string& input, std::uint64_t size,
+                 std::int64_t mtime) const;
+
+  // Records the size and modification time `input` had before it was read.
+  void Listed(const std::string& input, std::uint64_t size,
+              std::int64_t mtime);
+  // Returns the content hash of the earlier entry of `input` if it matches the
+  // size and modification time given to Listed(), the contents needn't be read
+  // to know it then. Unlike Unchanged(), whatever options the entry was
+  // converted with.
+  std::optional<std::uint64_t> KnownContentHash(const std::string& input) const;
+  // Records the content hash of `input`. Returns true if the earlier entry
+  // matches it, even though the size or modification time didn't.
+  bool Hashed(const std::string& input, std::uint64_t content_hash);
+
+  // Carries the earlier entry of `input` over to this run, with the size and
+  // modification time given to Listed(), if any.
+  void Keep(const std::string& input);
+  // Replaces the entry of `input`, returns the outputs of the earlier entry
+  // which aren't outputs anymore.
+  std::vector<std::string> Converted(const std::string& input,
+                                     std::string name,
+                                     std::vector<std::string> outputs);
+
+  // Writes the entries kept or converted during this run. Entries of earlier
+  // runs for inputs which weren't seen are dropped unless `listed_all` is
+  // false, e.g. because the run was interrupted. Inputs which failed keep their
+  // earlier entry.
+  void Write(Durability durability, bool listed_all) const;
+
+ private:
+  const boost::filesystem::path path_;
+  const std::uint64_t options_hash_;
+  // When this run started, stored for the next one.
+  const std::time_t start_;
+  // When the run which wrote the loaded entries started.
+  std::time_t loaded_start_ = 0;
+  std::unordered_map<std::string, ManifestEntry> loaded_;
+
+  mutable std::mutex mutex_;
+  // Inputs seen during this run, with their earlier entry until converted.
+  std::unordered_map<std::string, ManifestEntry> entries_;
+  // Listed or hashed, but not kept or converted yet.
+  std::unordered_map<std::string, ManifestEntry> pending_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,148 @@
+#include "output-names.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "boost/algorithm/string/case_conv.hpp"
+#include "boost/format.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+// List of illegal characters: https://stackoverflow.com/a/31976060
+constexpr std::string_view kIllegalCharacters = R"(<>:"/\|?*)";
+
+constexpr std::array<char, 256> MakeFilenameCharacters() {
+  std::array<char, 256> characters = {};
+  for (std::size_t i = 0; i < characters.size(); ++i) {
+    characters[i] = static_cast<char>(i);
+  }
+  for (char illegal : kIllegalCharacters) {
+    characters[static_cast<unsigned char>(illegal)] = '_';
+  }
+  return characters;
+}
+
+constexpr std::array<char, 256> kFilenameCharacters = MakeFilenameCharacters();
+
+// Temporary files of per-file outputs, which a killed run leaves behind.
+constexpr std::array<std::string_view, 2> kTempSuffixes = {".kml.tmp",
+                                                           ".geojson.tmp"};
+
+bool IsTempOutput(std::string_view filename) {
+  return std::any_of(kTempSuffixes.begin(), kTempSuffixes.end(),
+                     [&](std::string_view suffix) {
+                       return filename.ends_with(suffix);
+                     });
+}
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+// Case-insensitive filesystems treat names differing in case as equal.
+std::string Key(std::string filename) {
+#if defined(_WIN32) || defined(__APPLE__)
+  boost::algorithm::to_lower(filename);
+#endif
+  return filename;
+}
+
+}  // namespace
+
+std::string NormalizeFilename(std::string_view filename) {
+  while (!filename.empty() && IsSpace(filename.front())) {
+    filename.remove_prefix(1);
+  }
+  while (!filename.empty() && IsSpace(filename.back())) {
+    filename.remove_suffix(1);
+  }
+  std::string normalized(filename.size(), '\0');
+  for (std::size_t i = 0; i < filename.size(); ++i) {
+    normalized[i] =
+        kFilenameCharacters[static_cast<unsigned char>(filename[i])];
+  }
+  return normalized;
+}
+
+OutputNames::OutputNames(const boost::filesystem::path& directory) {
+  for (const boost::filesystem::directory_entry& entry :
+       boost::filesystem::directory_iterator(directory)) {
+    std::string filename = entry.path().filename().string();
+    if (IsTempOutput(filename)) {
+      // No run writes into the directory but this one.
+      boost::system::error_code error;
+      boost::filesystem::remove(entry.path(), error);
+      continue;
+    }
+    existing_.insert(Key(std::move(filename)));
+  }
+}
+
+void OutputNames::Plan(std::string_view basename, std::string_view owner) {
+  std::string key = Key(NormalizeFilename(basename));
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto [planned, inserted] = shard.planned.try_emplace(
+      std::move(key), Planned{.owner = std::string(owner)});
+  if (!inserted && planned->second.owner != owner) {
+    planned->second.shared = true;
+  }
+}
+
+std::string OutputNames::Claim(std::string_view basename,
+                               std::string_view disambiguator) {
+  std::string name = NormalizeFilename(basename);
+  if (TryClaim(name, disambiguator, /*unshared=*/true)) {
+    return name;
+  }
+  name = NormalizeFilename(
+      boost::str(boost::format("%s (%s)") % basename % disambiguator));
+  if (!TryClaim(name, disambiguator, /*unshared=*/false)) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Output name \"%s\" claimed twice") % name));
+  }
+  return name;
+}
+
+void OutputNames::Reserve(const std::string& name, std::string owner) {
+  reserved_.insert_or_assign(Key(name), std::move(owner));
+}
+
+bool OutputNames::Existed(const std::string& filename) const {
+  return existing_.contains(Key(filename));
+}
+
+bool OutputNames::Owns(const std::string& name, std::string_view owner) const {
+  const auto reserved = reserved_.find(Key(name));
+  return reserved != reserved_.end() && reserved->second == owner;
+}
+
+OutputNames::Shard& OutputNames::ShardOf(const std::string& key) {
+  return shards_[std::hash<std::string>()(key) % kNumShards];
+}
+
+bool OutputNames::TryClaim(const std::string& filename, std::string_view owner,
+                           bool unshared) {
+  std::string key = Key(filename);
+  if (const auto reserved = reserved_.find(key);
+      reserved != reserved_.end() && reserved->second != owner) {
+    return false;
+  }
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (const auto claimed = shard.claimed.find(key);
+      claimed != shard.claimed.end()) {
+    // Inputs converted again, e.g. rewritten while watched, keep their name.
+    return claimed->second == owner;
+  }
+  if (const auto planned = shard.planned.find(key);
+      unshared && planned != shard.planned.end() && planned->second.shared) {
+    return false;
+  }
+  shard.claimed.emplace(std::move(key), owner);
+  return true;
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Replaces characters which are illegal in filenames and trims whitespace.
+std::string NormalizeFilename(std::string_view filename);
+
+// Hands out unique output filenames. The output directory is listed once on
+// construction, so claims never touch the filesystem, and temporary files of
+// per-file outputs left behind by killed runs are removed then. Thread-safe.
+class OutputNames {
+ public:
+  explicit OutputNames(const boost::filesystem::path& directory);
+
+  // Records that the input with the disambiguator `owner` is going to claim
+  // `basename`. Planning the names of all inputs before they are claimed lets
+  // names shared by several of them be disambiguated for all, whichever input
+  // is converted first.
+  void Plan(std::string_view basename, std::string_view owner);
+
+  // Returns the normalized `basename`, or `<basename> (<disambiguator>)` if
+  // several inputs planned it or another one claimed or reserved it already.
+  // An input claiming its name again keeps it. The result doesn't depend on the
+  // processing order as long as disambiguators are unique, e.g. input file
+  // stems, and every input was planned. Outputs append their extension to the
+  // result.
+  std::string Claim(std::string_view basename, std::string_view disambiguator);
+
+  // Reserves `name`, which an earlier run claimed for the input with the
+  // disambiguator `owner`. Claims of other inputs are disambiguated against it,
+  // the owner may claim it again. Must be called before any claims.
+  void Reserve(const std::string& name, std::string owner);
+
+  // Returns true if `filename` existed in the directory before the run.
+  bool Existed(const std::string& filename) const;
+  // Returns true if `owner` reserved `name`, which makes the existing outputs
+  // with that name its own to replace.
+  bool Owns(const std::string& name, std::string_view owner) const;
+
+ private:
+  static constexpr std::size_t kNumShards = 16;
+
+  struct Planned {
+    std::string owner;
+    // Planned by other owners too.
+    bool shared = false;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, Planned> planned;
+    // Owners by name claimed during this run.
+    std::unordered_map<std::string, std::string> claimed;
+  };
+
+  Shard& ShardOf(const std::string& key);
+
+  // Returns true if `filename` was neither claimed by another owner yet nor
+  // reserved by one and claims it. With `unshared` a name planned by several
+  // owners isn't claimed either.
+  bool TryClaim(const std::string& filename, std::string_view owner,
+                bool unshared);
+
+  // Names present in the directory at construction time, only read later.
+  std::unordered_set<std::string> existing_;
+  // Owners by reserved name, only read once claims start.
+  std::unordered_map<std::string, std::string> reserved_;
+  std::array<Shard, kNumShards> shards_;
+};
+
+}  // namespace gpx_to_kml
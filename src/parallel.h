@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Number of threads used for the parallel post-processing steps which run
+// after the worker pool has finished.
+inline std::size_t NumParallelThreads() {
+  return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Calls `fn(begin, end)` for consecutive chunks of [0, count), one chunk per
+// thread. Rethrows the first exception thrown by any chunk.
+template <typename Fn>
+void ParallelChunks(std::size_t count, const Fn& fn) {
+  const std::size_t num_threads = std::min(NumParallelThreads(), count);
+  if (num_threads <= 1) {
+    fn(std::size_t{0}, count);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(num_threads);
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i]() {
+      try {
+        fn(count * i / num_threads, count * (i + 1) / num_threads);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (const std::exception_ptr& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+// Sorts chunks in parallel, then merges neighbouring runs pairwise with the
+// merges of each round running in parallel.
+template <typename RandomIt, typename Compare>
+void ParallelSort(RandomIt begin, RandomIt end, Compare compare) {
+  const std::size_t count = static_cast<std::size_t>(std::distance(begin, end));
+  const std::size_t num_chunks = std::min(NumParallelThreads(), count);
+  if (num_chunks <= 1) {
+    std::sort(begin, end, compare);
+    return;
+  }
+  std::vector<std::size_t> bounds;
+  for (std::size_t i = 0; i <= num_chunks; ++i) {
+    bounds.push_back(count * i / num_chunks);
+  }
+  ParallelChunks(num_chunks, [&](std::size_t first, std::size_t last) {
+    for (std::size_t i = first; i < last; ++i) {
+      std::sort(begin + bounds[i], begin + bounds[i + 1], compare);
+    }
+  });
+  while (bounds.size() > 2) {
+    const std::size_t num_merges = (bounds.size() - 1) / 2;
+    ParallelChunks(num_merges, [&](std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) {
+        std::inplace_merge(begin + bounds[2 * i], begin + bounds[2 * i + 1],
+                           begin + bounds[2 * i + 2], compare);
+      }
+    });
+    std::vector<std::size_t> merged;
+    for (std::size_t i = 0; i < bounds.size(); i += 2) {
+      merged.push_back(bounds[i]);
+    }
+    if (merged.back() != bounds.back()) {
+      merged.push_back(bounds.back());
+    }
+    bounds = std::move(merged);
+  }
+}
+
+}  // namespace gpx_to_kml
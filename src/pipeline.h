@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "work-queue.h"
+
+namespace gpx_to_kml {
+
+// Aggregated durations of the tasks of one stage. Thread-safe.
+class TaskTimes {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Summary {
+    std::uint64_t count = 0;
+    // Sum of all task durations.
+    double total_seconds = 0;
+    double max_seconds = 0;
+    // From the start of the first to the end of the last task.
+    double makespan_seconds = 0;
+  };
+
+  void Record(Clock::time_point start, Clock::time_point end) {
+    const std::int64_t start_ns = Nanoseconds(start);
+    const std::int64_t end_ns = Nanoseconds(end);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_ns_.fetch_add(end_ns - start_ns, std::memory_order_relaxed);
+    UpdateMax(max_ns_, end_ns - start_ns);
+    UpdateMax(last_end_ns_, end_ns);
+    // The minimum start is kept negated to share UpdateMax().
+    UpdateMax(negated_first_start_ns_, -start_ns);
+  }
+
+  Summary summary() const {
+    Summary summary;
+    summary.count = count_.load(std::memory_order_relaxed);
+    if (summary.count == 0) {
+      return summary;
+    }
+    summary.total_seconds = Seconds(total_ns_.load(std::memory_order_relaxed));
+    summary.max_seconds = Seconds(max_ns_.load(std::memory_order_relaxed));
+    summary.makespan_seconds =
+        Seconds(last_end_ns_.load(std::memory_order_relaxed) +
+                negated_first_start_ns_.load(std::memory_order_relaxed));
+    return summary;
+  }
+
+ private:
+  static std::int64_t Nanoseconds(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  static double Seconds(std::int64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) * 1e-9;
+  }
+
+  static void UpdateMax(std::atomic<std::int64_t>& max, std::int64_t value) {
+    std::int64_t current = max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value,
+                                      std::memory_order_relaxed)) {
+    }
+  }
+
+  std::atomic<std::uint64_t> count_ = 0;
+  std::atomic<std::int64_t> total_ns_ = 0;
+  std::atomic<std::int64_t> max_ns_ = 0;
+  std::atomic<std::int64_t> last_end_ns_ =
+      std::numeric_limits<std::int64_t>::min();
+  std::atomic<std::int64_t> negated_first_start_ns_ =
+      std::numeric_limits<std::int64_t>::min();
+};
+
+// One step of a pipeline: a bounded input queue drained by its own group of
+// threads, which typically push their results into the next stage. Stages are
+// constructed from the last to the first, so each can refer to its successor,
+// and finished from the first to the last.
+template <typename T>
+class Stage {
+ public:
+  // Every thread calls `run(queue)` once, which returns after the queue has
+  // been closed and drained.
+  Stage(std::string name, std::size_t num_threads, std::size_t capacity,
+        std::function<void(BoundedQueue<T>&)> run)
+      : name_(std::move(name)), num_threads_(num_threads), queue_(capacity) {
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this, run]() {
+        try {
+          run(queue_);
+        } catch (...) {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+              error_ = std::current_exception();
+            }
+          }
+          // Keep draining so producers never block on a dead stage.
+          while (queue_.Pop().has_value()) {
+          }
+        }
+      });
+    }
+  }
+
+  ~Stage() {
+    if (!threads_.empty()) {
+      queue_.Close();
+      Join();
+    }
+  }
+
+  Stage(const Stage&) = delete;
+  Stage& operator=(const Stage&) = delete;
+
+  const std::string& name() const { return name_; }
+  std::size_t num_threads() const { return num_threads_; }
+  QueueStats stats() const { return queue_.stats(); }
+  // Values queued at the moment.
+  std::size_t depth() const { return queue_.size(); }
+
+  // Blocks while the queue is full.
+  void Push(T value) { queue_.Push(std::move(value)); }
+
+  // Lets the threads drain the queue, waits for them and rethrows the first
+  // exception any of them threw. No more values may be pushed.
+  void Finish() {
+    queue_.Close();
+    Join();
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  void Join() {
+    for (std::thread& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+  }
+
+  const std::string name_;
+  const std::size_t num_threads_;
+  BoundedQueue<T> queue_;
+  std::mutex mutex_;
+  std::exception_ptr error_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,75 @@
+#include "png.h"
+
+#include <stdexcept>
+
+namespace gpx_to_kml {
+namespace {
+
+// Scanline bytes compressed into one IDAT chunk.
+constexpr std::size_t kImageDataChunkSize = 1 << 20;
+
+void AppendBigEndian(std::string& out, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out += static_cast<char>((value >> shift) & 0xFF);
+  }
+}
+
+}  // namespace
+
+PngWriter::PngWriter(AtomicFile& file, std::uint32_t width,
+                     std::uint32_t height)
+    : file_(file), width_(width) {
+  if (width == 0 || height == 0) {
+    throw std::invalid_argument("PNG images cannot be empty");
+  }
+  file_.Write(std::string_view("\x89PNG\r\n\x1A\n", 8));
+  std::string header;
+  AppendBigEndian(header, width);
+  AppendBigEndian(header, height);
+  // 8 bits per channel, RGBA, deflate, adaptive filtering, not interlaced.
+  header += std::string_view("\x08\x06\x00\x00\x00", 5);
+  WriteChunk("IHDR", header);
+}
+
+void PngWriter::AddRow(std::string_view rgba) {
+  if (rgba.size() != 4 * static_cast<std::size_t>(width_)) {
+    throw std::logic_error("PNG row has the wrong size");
+  }
+  pending_ += '\0';  // Filter type none.
+  pending_ += rgba;
+  if (pending_.size() >= kImageDataChunkSize) {
+    FlushImageData(false);
+  }
+}
+
+void PngWriter::Finish() {
+  FlushImageData(true);
+  WriteChunk("IEND", "");
+}
+
+void PngWriter::WriteChunk(std::string_view type, std::string_view data) {
+  std::string chunk;
+  AppendBigEndian(chunk, static_cast<std::uint32_t>(data.size()));
+  chunk += type;
+  chunk += data;
+  AppendBigEndian(chunk, Crc32(std::string_view(chunk).substr(4)));
+  file_.Write(chunk);
+}
+
+void PngWriter::FlushImageData(bool final) {
+  std::string data;
+  if (!started_) {
+    // zlib header: deflate with a 32K window, no dictionary, fast.
+    data += "\x78\x01";
+    started_ = true;
+  }
+  encoder_.Compress(pending_, final, data);
+  adler_ = Adler32(pending_, adler_);
+  pending_.clear();
+  if (final) {
+    AppendBigEndian(data, adler_);
+  }
+  WriteChunk("IDAT", data);
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "deflate.h"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// Streams an 8-bit RGBA PNG into `file` one row at a time, so that large
+// images never have to be held in memory. Rows are compressed with
+// DeflateEncoder in chunks of kImageDataChunkSize bytes.
+class PngWriter {
+ public:
+  PngWriter(AtomicFile& file, std::uint32_t width, std::uint32_t height);
+
+  // `rgba` holds 4 * width bytes.
+  void AddRow(std::string_view rgba);
+  // Writes the remaining data, the file itself is committed by the caller.
+  void Finish();
+
+ private:
+  void WriteChunk(std::string_view type, std::string_view data);
+  void FlushImageData(bool final);
+
+  AtomicFile& file_;
+  const std::uint32_t width_;
+  // Unfiltered scanlines not yet written.
+  std::string pending_;
+  DeflateEncoder encoder_;
+  std::uint32_t adler_ = 1;
+  bool started_ = false;
+};
+
+}  // namespace gpx_to_kml
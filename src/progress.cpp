@@ -0,0 +1,126 @@
+#include "progress.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <utility>
+
+#include "logger.h"
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr double kMegabyte = 1 << 20;
+
+}  // namespace
+
+std::size_t ThreadIndex() {
+  static std::atomic<std::size_t> num_threads = 0;
+  thread_local const std::size_t index =
+      num_threads.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+void ShardedCounter::Add(std::uint64_t value) {
+  shards_[ThreadIndex() % kNumShards].value.fetch_add(
+      value, std::memory_order_relaxed);
+}
+
+std::uint64_t ShardedCounter::Sum() const {
+  std::uint64_t sum = 0;
+  for (const Shard& shard : shards_) {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+ProgressReporter::ProgressReporter(
+    const Counters& counters, std::chrono::milliseconds interval,
+    std::function<std::vector<QueueDepth>()> queue_depths)
+    : counters_(counters),
+      interval_(interval),
+      queue_depths_(std::move(queue_depths)),
+      thread_([this]() { Run(); }) {}
+
+ProgressReporter::~ProgressReporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_requested_.notify_one();
+  thread_.join();
+}
+
+void ProgressReporter::ListingFinished() { listing_finished_ = true; }
+
+ProgressReporter::Sample ProgressReporter::Take() const {
+  return Sample{
+      .time = Clock::now(),
+      .files = counters_.succeeded.Sum() + counters_.failed.Sum() +
+               counters_.skipped.Sum(),
+      .read_bytes = counters_.read_bytes.Sum(),
+      .points = counters_.points.Sum(),
+      .written_bytes = counters_.written_bytes.Sum()};
+}
+
+void ProgressReporter::Run() {
+  const Sample start = Take();
+  Sample previous = start;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_requested_.wait_for(lock, interval_,
+                                   [this]() { return stop_; })) {
+    const Sample current = Take();
+    Report(start, previous, current);
+    previous = current;
+  }
+}
+
+void ProgressReporter::Report(const Sample& start, const Sample& previous,
+                              const Sample& current) const {
+  const double seconds =
+      std::chrono::duration<double>(current.time - previous.time).count();
+  const auto per_second = [seconds](std::uint64_t from, std::uint64_t to) {
+    return static_cast<double>(to - from) / seconds;
+  };
+  LogMessage line = Log(Verbosity::kQuiet);
+  line << "Progress: " << current.files << "/"
+       << counters_.listed_files.Sum() << " files, " << std::fixed
+       << std::setprecision(1) << per_second(previous.files, current.files)
+       << " files/s, "
+       << per_second(previous.read_bytes, current.read_bytes) / kMegabyte
+       << " MB/s read, " << std::setprecision(0)
+       << per_second(previous.points, current.points) << " points/s, "
+       << std::setprecision(1) << current.written_bytes / kMegabyte
+       << " MB written";
+  const std::vector<QueueDepth> queue_depths = queue_depths_();
+  if (!queue_depths.empty()) {
+    line << ", queue depth";
+    for (const QueueDepth& queue : queue_depths) {
+      line << " " << queue.name << " " << queue.depth;
+    }
+  }
+
+  // At the mean rates of the whole run, the last interval alone is too noisy.
+  // Reads run ahead of the conversion by the queued files, the files left
+  // cover the time those take.
+  const double elapsed =
+      std::chrono::duration<double>(current.time - start.time).count();
+  const auto time_left = [elapsed](std::uint64_t done, std::uint64_t total) {
+    return done == 0 || done >= total
+               ? 0.0
+               : static_cast<double>(total - done) * elapsed /
+                     static_cast<double>(done);
+  };
+  const std::uint64_t files_done = current.files - start.files;
+  const std::uint64_t bytes_read = current.read_bytes - start.read_bytes;
+  if (!listing_finished_) {
+    // The inputs yet to be listed are unknown.
+    line << ", listing";
+  } else if (files_done > 0 || bytes_read > 0) {
+    line << ", ETA " << std::setprecision(0)
+         << std::max(time_left(bytes_read, counters_.listed_bytes.Sum()),
+                     time_left(files_done, counters_.listed_files.Sum()))
+         << " s";
+  }
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Numbers the threads in the order they first call this, starting at zero.
+// Spreads the threads over the shards of per-thread data.
+std::size_t ThreadIndex();
+
+// A counter incremented by many threads. Each thread adds to a shard on a
+// cache line of its own, so increments don't contend; reading sums all shards.
+class ShardedCounter {
+ public:
+  ShardedCounter() = default;
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  void Add(std::uint64_t value);
+  ShardedCounter& operator++() {
+    Add(1);
+    return *this;
+  }
+
+  std::uint64_t Sum() const;
+
+ private:
+  static constexpr std::size_t kNumShards = 64;
+
+  struct alignas(64) Shard {
+    std::atomic<std::uint64_t> value = 0;
+  };
+
+  std::array<Shard, kNumShards> shards_;
+};
+
+// Counts of a conversion run, updated by whichever threads do the work.
+struct Counters {
+  // Inputs which have been converted completely or have failed.
+  ShardedCounter succeeded;
+  ShardedCounter failed;
+  // Inputs which needn't be converted: converted by an earlier run according
+  // to the journal or the manifest, or skipped duplicates.
+  ShardedCounter skipped;
+  // Activities repeating earlier ones, skipped or not.
+  ShardedCounter duplicates;
+  // Inputs found so far, including skipped ones, and their sizes. Sizes are
+  // only known with progress reports, largest first scheduling or the
+  // manifest, inputs skipped before reading them have none.
+  ShardedCounter listed_files;
+  ShardedCounter listed_bytes;
+  ShardedCounter read_bytes;
+  ShardedCounter points;
+  // Of the outputs of each input, the combined outputs aren't counted.
+  ShardedCounter written_bytes;
+};
+
+// Prints the throughput of a run periodically on a thread of its own: files,
+// bytes read and points per second since the previous report, bytes written,
+// the queue depths and, once all inputs are listed, the time left at the mean
+// rates so far.
+class ProgressReporter {
+ public:
+  struct QueueDepth {
+    std::string name;
+    std::size_t depth = 0;
+  };
+
+  ProgressReporter(const Counters& counters,
+                   std::chrono::milliseconds interval,
+                   std::function<std::vector<QueueDepth>()> queue_depths);
+  ~ProgressReporter();
+
+  ProgressReporter(const ProgressReporter&) = delete;
+  ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+  // All inputs have been listed, the time left is known from now on.
+  void ListingFinished();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // The counters at one point in time.
+  struct Sample {
+    Clock::time_point time;
+    std::uint64_t files = 0;
+    std::uint64_t read_bytes = 0;
+    std::uint64_t points = 0;
+    std::uint64_t written_bytes = 0;
+  };
+
+  Sample Take() const;
+  void Run();
+  void Report(const Sample& start, const Sample& previous,
+              const Sample& current) const;
+
+  const Counters& counters_;
+  const std::chrono::milliseconds interval_;
+  const std::function<std::vector<QueueDepth>()> queue_depths_;
+  std::atomic<bool> listing_finished_ = false;
+
+  std::mutex mutex_;
+  std::condition_variable stop_requested_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace gpx_to_kml
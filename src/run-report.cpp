@@ -0,0 +1,232 @@
+#include "run-report.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "format.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Values below 2 * kSubBuckets have a bucket each, every further power of two
+// is split into kSubBuckets.
+constexpr int kSubBucketBits = 5;
+constexpr std::uint64_t kSubBuckets = 1 << kSubBucketBits;
+constexpr std::size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+constexpr std::array<std::string_view, 6> kStageNames = {
+    "read",   "load_cache", "parse_xml", "parse_coordinates",
+    "format", "write"};
+
+std::size_t BucketIndex(std::uint64_t value) {
+  if (value < 2 * kSubBuckets) {
+    return value;
+  }
+  const int shift = std::bit_width(value) - 1 - kSubBucketBits;
+  return static_cast<std::size_t>(shift) * kSubBuckets + (value >> shift);
+}
+
+// The largest value counted in the bucket.
+std::uint64_t BucketEnd(std::size_t index) {
+  if (index < 2 * kSubBuckets) {
+    return index;
+  }
+  const std::size_t shift = index / kSubBuckets - 1;
+  const std::uint64_t sub_bucket = index % kSubBuckets + kSubBuckets;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+using SlowestEntry = std::pair<std::uint64_t, std::string>;
+
+// Keeps the `limit` largest entries of `heap`, a min-heap.
+void AddSlowest(std::vector<SlowestEntry>& heap, std::size_t limit,
+                SlowestEntry entry) {
+  if (heap.size() < limit) {
+    heap.push_back(std::move(entry));
+    std::push_heap(heap.begin(), heap.end(), std::greater<>());
+  } else if (entry.first > heap.front().first) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+    heap.back() = std::move(entry);
+    std::push_heap(heap.begin(), heap.end(), std::greater<>());
+  }
+}
+
+void AppendMilliseconds(std::string& out, std::uint64_t nanoseconds) {
+  AppendFixed(out, static_cast<double>(nanoseconds) * 1e-6, 3);
+}
+
+void AppendInteger(std::string& out, std::uint64_t value) {
+  out += std::to_string(value);
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : buckets_(kNumBuckets, 0) {}
+
+void LatencyHistogram::Record(std::uint64_t nanoseconds) {
+  ++buckets_[BucketIndex(nanoseconds)];
+  ++count_;
+  total_ += nanoseconds;
+  max_ = std::max(max_, nanoseconds);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (std::size_t i = 0; i < kNumBuckets; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  total_ += other.total_;
+  max_ = std::max(max_, other.max_);
+}
+
+std::uint64_t LatencyHistogram::Percentile(double quantile) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  const std::uint64_t rank = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(
+             std::ceil(quantile * static_cast<double>(count_))));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(BucketEnd(i), max_);
+    }
+  }
+  return max_;
+}
+
+RunReport::RunReport(std::size_t num_slowest) : num_slowest_(num_slowest) {
+  for (auto& stage_shards : shards_) {
+    for (std::atomic<Shard*>& shard : stage_shards) {
+      shard = nullptr;
+    }
+  }
+}
+
+RunReport::~RunReport() {
+  for (auto& stage_shards : shards_) {
+    for (std::atomic<Shard*>& shard : stage_shards) {
+      delete shard.load();
+    }
+  }
+}
+
+RunReport::Shard& RunReport::ThreadShard(ReportStage stage) {
+  std::atomic<Shard*>& slot =
+      shards_[static_cast<std::size_t>(stage)][ThreadIndex() % kNumShards];
+  Shard* shard = slot.load(std::memory_order_acquire);
+  if (!shard) {
+    // Another thread sharing the slot may have been first.
+    auto created = std::make_unique<Shard>();
+    if (slot.compare_exchange_strong(shard, created.get(),
+                                     std::memory_order_acq_rel)) {
+      shard = created.release();
+    }
+  }
+  return *shard;
+}
+
+void RunReport::Record(ReportStage stage, Clock::duration duration,
+                       const boost::filesystem::path& path) {
+  const std::uint64_t nanoseconds = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+  Shard& shard = ThreadShard(stage);
+  // Only contended by threads beyond the number of shards.
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.histogram.Record(nanoseconds);
+  // Checked first, most files don't make it and their path isn't copied.
+  if (shard.slowest.size() < num_slowest_ ||
+      (num_slowest_ > 0 && nanoseconds > shard.slowest.front().first)) {
+    AddSlowest(shard.slowest, num_slowest_, {nanoseconds, path.string()});
+  }
+}
+
+void RunReport::Write(
+    const boost::filesystem::path& path, Durability durability,
+    const std::vector<std::pair<std::string, std::string>>& labels,
+    const Counters& counters, double wall_seconds) const {
+  std::string out = "{\n  \"run\": {";
+  for (std::size_t i = 0; i < labels.size(); ++i) {
+    out += i == 0 ? "" : ", ";
+    AppendJsonString(out, labels[i].first);
+    out += ": ";
+    AppendJsonString(out, labels[i].second);
+  }
+  out += "},\n  \"wall_seconds\": ";
+  AppendFixed(out, wall_seconds, 3);
+  out += ",\n  \"files\": {\"listed\": ";
+  AppendInteger(out, counters.listed_files.Sum());
+  out += ", \"succeeded\": ";
+  AppendInteger(out, counters.succeeded.Sum());
+  out += ", \"failed\": ";
+  AppendInteger(out, counters.failed.Sum());
+  out += ", \"skipped\": ";
+  AppendInteger(out, counters.skipped.Sum());
+  out += ", \"duplicates\": ";
+  AppendInteger(out, counters.duplicates.Sum());
+  out += "},\n  \"bytes_read\": ";
+  AppendInteger(out, counters.read_bytes.Sum());
+  out += ",\n  \"bytes_written\": ";
+  AppendInteger(out, counters.written_bytes.Sum());
+  out += ",\n  \"points\": ";
+  AppendInteger(out, counters.points.Sum());
+  out += ",\n  \"stages\": {";
+
+  for (std::size_t stage = 0; stage < kNumStages; ++stage) {
+    LatencyHistogram histogram;
+    std::vector<SlowestEntry> slowest;
+    for (const std::atomic<Shard*>& slot : shards_[stage]) {
+      if (const Shard* shard = slot.load()) {
+        histogram.Merge(shard->histogram);
+        for (const SlowestEntry& entry : shard->slowest) {
+          AddSlowest(slowest, num_slowest_, entry);
+        }
+      }
+    }
+    std::sort_heap(slowest.begin(), slowest.end(), std::greater<>());
+
+    out += stage == 0 ? "\n    " : ",\n    ";
+    AppendJsonString(out, kStageNames[stage]);
+    out += ": {\"count\": ";
+    AppendInteger(out, histogram.count());
+    out += ", \"total_seconds\": ";
+    AppendFixed(out, static_cast<double>(histogram.total()) * 1e-9, 3);
+    out += ", \"mean_ms\": ";
+    AppendMilliseconds(out, histogram.count() > 0
+                                ? histogram.total() / histogram.count()
+                                : 0);
+    for (const auto& [name, quantile] :
+         {std::pair<std::string_view, double>{"p50_ms", 0.5},
+          {"p90_ms", 0.9},
+          {"p99_ms", 0.99},
+          {"p999_ms", 0.999}}) {
+      out += ", \"";
+      out += name;
+      out += "\": ";
+      AppendMilliseconds(out, histogram.Percentile(quantile));
+    }
+    out += ", \"max_ms\": ";
+    AppendMilliseconds(out, histogram.max());
+    out += ",\n      \"slowest\": [";
+    for (std::size_t i = 0; i < slowest.size(); ++i) {
+      out += i == 0 ? "{\"file\": " : ", {\"file\": ";
+      AppendJsonString(out, slowest[i].second);
+      out += ", \"ms\": ";
+      AppendMilliseconds(out, slowest[i].first);
+      out += "}";
+    }
+    out += "]}";
+  }
+  out += "\n  }\n}\n";
+
+  AtomicFile file(path, durability);
+  file.Write(out);
+  file.Commit();
+}
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+#include "progress.h"
+
+namespace gpx_to_kml {
+
+// Durations in nanoseconds with a relative error below 3% in constant memory,
+// like an HDR histogram: values are counted in 32 linear buckets per power of
+// two. Not thread-safe.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Record(std::uint64_t nanoseconds);
+  void Merge(const LatencyHistogram& other);
+
+  std::uint64_t count() const { return count_; }
+  std::uint64_t total() const { return total_; }
+  std::uint64_t max() const { return max_; }
+  // The value at or below which `quantile` of all values lie, 0 if empty.
+  std::uint64_t Percentile(double quantile) const;
+
+ private:
+  std::vector<std::uint64_t> buckets_;
+  std::uint64_t count_ = 0;
+  std::uint64_t total_ = 0;
+  std::uint64_t max_ = 0;
+};
+
+// The steps every input goes through, as timed for the run report.
+enum class ReportStage {
+  kRead,
+  // Instead of parsing, for inputs in the --cache_dir.
+  kLoadCache,
+  kParseXml,
+  kParseCoordinates,
+  kFormat,
+  kWrite,
+};
+
+// Times the stages of every file on whichever thread does the work and writes
+// a JSON report with percentiles, totals and the slowest files of each stage.
+// Each thread records into histograms of its own, which are merged at the end.
+// Thread-safe.
+class RunReport {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit RunReport(std::size_t num_slowest);
+  ~RunReport();
+
+  RunReport(const RunReport&) = delete;
+  RunReport& operator=(const RunReport&) = delete;
+
+  void Record(ReportStage stage, Clock::duration duration,
+              const boost::filesystem::path& path);
+  // Records the time since `start`.
+  void Record(ReportStage stage, Clock::time_point start,
+              const boost::filesystem::path& path) {
+    Record(stage, Clock::now() - start, path);
+  }
+
+  // `labels` describe the run, e.g. its settings. No stages may be recorded
+  // concurrently.
+  void Write(const boost::filesystem::path& path, Durability durability,
+             const std::vector<std::pair<std::string, std::string>>& labels,
+             const Counters& counters, double wall_seconds) const;
+
+ private:
+  static constexpr std::size_t kNumStages = 6;
+  static constexpr std::size_t kNumShards = 64;
+
+  // Nanoseconds and file.
+  using Slowest = std::vector<std::pair<std::uint64_t, std::string>>;
+
+  struct Shard {
+    std::mutex mutex;
+    LatencyHistogram histogram;
+    // A min-heap of the slowest files this shard has seen.
+    Slowest slowest;
+  };
+
+  Shard& ThreadShard(ReportStage stage);
+
+  const std::size_t num_slowest_;
+  // Allocated by the first thread recording into one, most are never used.
+  std::array<std::array<std::atomic<Shard*>, kNumShards>, kNumStages> shards_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,131 @@
+#include "trace.h"
+
+#include <utility>
+
+#include "format.h"
+#include "progress.h"
+
+namespace gpx_to_kml {
+namespace {
+
+void AppendMicroseconds(std::string& out, std::int64_t nanoseconds) {
+  AppendFixed(out, static_cast<double>(nanoseconds) * 1e-3, 3);
+}
+
+}  // namespace
+
+Tracer::Tracer() : id_(++num_tracers), start_(Clock::now()) {}
+
+Tracer::Buffer& Tracer::ThreadBuffer() {
+  struct ThreadState {
+    std::uint64_t tracer_id = 0;
+    std::shared_ptr<Buffer> buffer;
+  };
+  thread_local ThreadState state;
+  // Buffers of an earlier tracer belong to it.
+  if (state.tracer_id != id_) {
+    state.tracer_id = id_;
+    state.buffer = std::make_shared<Buffer>();
+    state.buffer->thread_id = ThreadIndex();
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.push_back(state.buffer);
+  }
+  return *state.buffer;
+}
+
+std::int64_t Tracer::Nanoseconds(Clock::time_point time) const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time - start_)
+      .count();
+}
+
+void Tracer::NameThread(std::string name) {
+  ThreadBuffer().thread_name = std::move(name);
+}
+
+void Tracer::Span(std::string_view name, Clock::time_point begin,
+                  Clock::time_point end, const boost::filesystem::path& file) {
+  ThreadBuffer().events.push_back(Event{.name = name,
+                                        .file = file.string(),
+                                        .begin_ns = Nanoseconds(begin),
+                                        .end_ns = Nanoseconds(end),
+                                        .async = false});
+}
+
+void Tracer::AsyncSpan(std::string_view name, Clock::time_point begin,
+                       Clock::time_point end,
+                       const boost::filesystem::path& file) {
+  ThreadBuffer().events.push_back(Event{.name = name,
+                                        .file = file.string(),
+                                        .begin_ns = Nanoseconds(begin),
+                                        .end_ns = Nanoseconds(end),
+                                        .async = true});
+}
+
+void Tracer::Write(const boost::filesystem::path& path,
+                   Durability durability) const {
+  AtomicFile file(path, durability);
+  std::string out = R"({"displayTimeUnit":"ms","traceEvents":[)";
+  bool first = true;
+  const auto begin_event = [&](std::string_view name, std::string_view phase,
+                               std::size_t thread_id) {
+    out += first ? "\n{" : ",\n{";
+    first = false;
+    out += R"("name":)";
+    AppendJsonString(out, name);
+    out += R"(,"ph":")";
+    out += phase;
+    out += R"(","pid":1,"tid":)";
+    out += std::to_string(thread_id);
+  };
+  const auto append_file = [&](const std::string& file) {
+    if (!file.empty()) {
+      out += R"(,"args":{"file":)";
+      AppendJsonString(out, file);
+      out += '}';
+    }
+  };
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The begin and end of an async span are matched up by their id.
+  std::uint64_t num_async = 0;
+  for (const std::shared_ptr<Buffer>& buffer : buffers_) {
+    if (!buffer->thread_name.empty()) {
+      begin_event("thread_name", "M", buffer->thread_id);
+      out += R"(,"args":{"name":)";
+      AppendJsonString(out, buffer->thread_name);
+      out += "}}";
+    }
+    for (const Event& event : buffer->events) {
+      if (!event.async) {
+        begin_event(event.name, "X", buffer->thread_id);
+        out += R"(,"ts":)";
+        AppendMicroseconds(out, event.begin_ns);
+        out += R"(,"dur":)";
+        AppendMicroseconds(out, event.end_ns - event.begin_ns);
+        append_file(event.file);
+        out += '}';
+      } else {
+        const std::string id = std::to_string(++num_async);
+        begin_event(event.name, "b", buffer->thread_id);
+        out += R"(,"cat":"wait","id":)" + id + R"(,"ts":)";
+        AppendMicroseconds(out, event.begin_ns);
+        append_file(event.file);
+        out += '}';
+        begin_event(event.name, "e", buffer->thread_id);
+        out += R"(,"cat":"wait","id":)" + id + R"(,"ts":)";
+        AppendMicroseconds(out, event.end_ns);
+        out += '}';
+      }
+      // Keeps the memory of the output in check on long runs.
+      if (out.size() >= 1 << 20) {
+        file.Write(out);
+        out.clear();
+      }
+    }
+  }
+  out += "\n]}\n";
+  file.Write(out);
+  file.Commit();
+}
+
+}  // namespace gpx_to_kml
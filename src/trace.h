@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+// Records a timeline of spans and writes it as Chrome trace event JSON, which
+// Perfetto and chrome://tracing display. Each thread appends to a buffer of its
+// own, the buffers are only combined by Write(). Thread-safe.
+class Tracer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Tracer();
+
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+
+  // Names the calling thread in the timeline.
+  void NameThread(std::string name);
+
+  // Work of the calling thread, on the file if it isn't empty. `name` must
+  // outlive the tracer.
+  void Span(std::string_view name, Clock::time_point begin,
+            Clock::time_point end, const boost::filesystem::path& file = {});
+  // Waiting which doesn't occupy a thread, e.g. in a queue or for I/O. Shown
+  // on a track of its own per name, overlapping spans side by side.
+  void AsyncSpan(std::string_view name, Clock::time_point begin,
+                 Clock::time_point end, const boost::filesystem::path& file);
+
+  // No spans may be recorded concurrently.
+  void Write(const boost::filesystem::path& path, Durability durability) const;
+
+ private:
+  struct Event {
+    std::string_view name;
+    std::string file;
+    std::int64_t begin_ns;
+    std::int64_t end_ns;
+    bool async;
+  };
+
+  // The events of one thread.
+  struct Buffer {
+    std::size_t thread_id;
+    std::string thread_name;
+    std::vector<Event> events;
+  };
+
+  Buffer& ThreadBuffer();
+  std::int64_t Nanoseconds(Clock::time_point time) const;
+
+  static inline std::atomic<std::uint64_t> num_tracers = 0;
+
+  // Tells the buffers of successive tracers apart.
+  const std::uint64_t id_;
+  const Clock::time_point start_;
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<Buffer>> buffers_;
+};
+
+// Records a span of the calling thread from construction to destruction.
+// Does nothing without a tracer.
+class TraceSpan {
+ public:
+  // `file` may be null, else it must outlive the span.
+  TraceSpan(Tracer* tracer, std::string_view name,
+            const boost::filesystem::path* file = nullptr)
+      : tracer_(tracer),
+        name_(name),
+        file_(file),
+        begin_(tracer ? Tracer::Clock::now() : Tracer::Clock::time_point()) {}
+  ~TraceSpan() {
+    if (tracer_) {
+      tracer_->Span(name_, begin_, Tracer::Clock::now(),
+                    file_ ? *file_ : boost::filesystem::path());
+    }
+  }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  Tracer* const tracer_;
+  const std::string_view name_;
+  const boost::filesystem::path* const file_;
+  const Tracer::Clock::time_point begin_;
+};
+
+}  // namespace gpx_to_kml
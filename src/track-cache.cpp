@@ -0,0 +1,241 @@
+#include "track-cache.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "boost/format.hpp"
+#include "io-backend.h"
+
+#ifdef _WIN32
+#include "boost/nowide/cstdio.hpp"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gpx_to_kml {
+namespace {
+
+// Followed by the number of coordinates, of extensions, the size of the name,
+// the fields of the activity's time, the name, the coordinates and the
+// extensions, each its name size, name and values. Bump the version whenever
+// the layout or the parsed model changes.
+constexpr std::string_view kMagic = "GPXTRK01";
+
+// Coordinates are stored and loaded with a single copy.
+static_assert(std::is_trivially_copyable_v<Coordinate>);
+static_assert(sizeof(Coordinate) == 32);
+
+// A whole file, read-only. Mapped into memory where mmap is available, read
+// into a buffer elsewhere. Empty if the file can't be opened.
+class FileView {
+ public:
+  explicit FileView(const boost::filesystem::path& path) {
+#ifdef _WIN32
+    FILE* file = boost::nowide::fopen(path.string().data(), "rb");
+    if (!file) {
+      return;
+    }
+    char buffer[64 * 1024];
+    std::size_t num_read;
+    while ((num_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      buffer_.append(buffer, num_read);
+    }
+    if (!ferror(file)) {
+      data_ = buffer_;
+    }
+    fclose(file);
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+      int flags = MAP_PRIVATE;
+#ifdef __linux__
+      // The whole file is read, faulting it in at once saves a fault per page.
+      flags |= MAP_POPULATE;
+#endif
+      void* mapped = mmap(nullptr, static_cast<std::size_t>(status.st_size),
+                          PROT_READ, flags, fd, 0);
+      if (mapped != MAP_FAILED) {
+        data_ = std::string_view(static_cast<const char*>(mapped),
+                                 static_cast<std::size_t>(status.st_size));
+      }
+    }
+    // The mapping stays valid.
+    close(fd);
+#endif
+  }
+
+  ~FileView() {
+#ifndef _WIN32
+    if (!data_.empty()) {
+      munmap(const_cast<char*>(data_.data()), data_.size());
+    }
+#endif
+  }
+
+  FileView(const FileView&) = delete;
+  FileView& operator=(const FileView&) = delete;
+
+  std::string_view data() const { return data_; }
+
+ private:
+#ifdef _WIN32
+  std::string buffer_;
+#endif
+  std::string_view data_;
+};
+
+template <typename T>
+void AppendRaw(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Copies what AppendRaw() wrote, returns false past the end of the data.
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  bool Raw(T* values, std::size_t count = 1) {
+    if (count > data_.size() / sizeof(T)) {
+      return false;
+    }
+    std::memcpy(values, data_.data(), count * sizeof(T));
+    data_.remove_prefix(count * sizeof(T));
+    return true;
+  }
+
+  bool String(std::string* value, std::size_t size) {
+    if (size > data_.size()) {
+      return false;
+    }
+    value->assign(data_.substr(0, size));
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  bool empty() const { return data_.empty(); }
+
+ private:
+  std::string_view data_;
+};
+
+}  // namespace
+
+TrackCache::TrackCache(const boost::filesystem::path& directory)
+    : directory_(directory) {
+  boost::filesystem::create_directories(directory);
+}
+
+boost::filesystem::path TrackCache::Path(std::uint64_t content_hash) const {
+  return directory_ / boost::str(boost::format("%016x.track") % content_hash);
+}
+
+bool TrackCache::Contains(std::uint64_t content_hash) const {
+  boost::system::error_code error;
+  return boost::filesystem::is_regular_file(Path(content_hash), error);
+}
+
+std::optional<Activity> TrackCache::Load(std::uint64_t content_hash) const {
+  const FileView file(Path(content_hash));
+  Reader reader(file.data());
+  std::string magic;
+  std::uint64_t num_coordinates;
+  std::uint32_t num_extensions;
+  std::uint32_t name_size;
+  std::int32_t time[9];
+  if (!reader.String(&magic, kMagic.size()) || magic != kMagic ||
+      !reader.Raw(&num_coordinates) || !reader.Raw(&num_extensions) ||
+      !reader.Raw(&name_size) || !reader.Raw(time, 9)) {
+    return std::nullopt;
+  }
+  Activity activity;
+  activity.time = std::tm{};
+  activity.time.tm_sec = time[0];
+  activity.time.tm_min = time[1];
+  activity.time.tm_hour = time[2];
+  activity.time.tm_mday = time[3];
+  activity.time.tm_mon = time[4];
+  activity.time.tm_year = time[5];
+  activity.time.tm_wday = time[6];
+  activity.time.tm_yday = time[7];
+  activity.time.tm_isdst = time[8];
+  if (!reader.String(&activity.name, name_size) ||
+      num_coordinates > file.data().size() / sizeof(Coordinate)) {
+    return std::nullopt;
+  }
+  activity.coordinates.resize(num_coordinates);
+  if (!reader.Raw(activity.coordinates.data(), num_coordinates)) {
+    return std::nullopt;
+  }
+  for (std::uint32_t i = 0; i < num_extensions; ++i) {
+    PointExtension& extension = activity.extensions.emplace_back();
+    std::uint32_t extension_name_size;
+    if (!reader.Raw(&extension_name_size) ||
+        !reader.String(&extension.name, extension_name_size)) {
+      return std::nullopt;
+    }
+    extension.values.resize(num_coordinates);
+    if (!reader.Raw(extension.values.data(), num_coordinates)) {
+      return std::nullopt;
+    }
+  }
+  if (!reader.empty()) {
+    return std::nullopt;
+  }
+  return activity;
+}
+
+void TrackCache::Store(std::uint64_t content_hash, const Activity& activity) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!storing_.insert(content_hash).second) {
+      return;
+    }
+  }
+  struct Stored {
+    TrackCache& cache;
+    std::uint64_t content_hash;
+    ~Stored() {
+      std::lock_guard<std::mutex> lock(cache.mutex_);
+      cache.storing_.erase(content_hash);
+    }
+  } stored{*this, content_hash};
+
+  std::string out(kMagic);
+  AppendRaw(out, static_cast<std::uint64_t>(activity.coordinates.size()));
+  AppendRaw(out, static_cast<std::uint32_t>(activity.extensions.size()));
+  AppendRaw(out, static_cast<std::uint32_t>(activity.name.size()));
+  for (const int field :
+       {activity.time.tm_sec, activity.time.tm_min, activity.time.tm_hour,
+        activity.time.tm_mday, activity.time.tm_mon, activity.time.tm_year,
+        activity.time.tm_wday, activity.time.tm_yday, activity.time.tm_isdst}) {
+    AppendRaw(out, static_cast<std::int32_t>(field));
+  }
+  out += activity.name;
+  out.append(reinterpret_cast<const char*>(activity.coordinates.data()),
+             activity.coordinates.size() * sizeof(Coordinate));
+  for (const PointExtension& extension : activity.extensions) {
+    AppendRaw(out, static_cast<std::uint32_t>(extension.name.size()));
+    out += extension.name;
+    out.append(reinterpret_cast<const char*>(extension.values.data()),
+               extension.values.size() * sizeof(double));
+  }
+
+  // Losing the cache only costs parsing again.
+  AtomicFile file(Path(content_hash), Durability::kNone);
+  file.Write(out);
+  file.Commit();
+}
+
+}  // namespace gpx_to_kml
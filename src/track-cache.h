@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Parsed activities stored by the content hash of their input, so later runs
+// don't parse the XML again, whatever their output options. A file per
+// activity, holding the coordinates as they are in memory and mapped into
+// memory to load them. The files aren't portable between machines of
+// different byte order. Thread-safe.
+class TrackCache {
+ public:
+  // Creates `directory` if it doesn't exist.
+  explicit TrackCache(const boost::filesystem::path& directory);
+
+  TrackCache(const TrackCache&) = delete;
+  TrackCache& operator=(const TrackCache&) = delete;
+
+  bool Contains(std::uint64_t content_hash) const;
+
+  // Returns null if the activity isn't cached or its file is unusable, e.g.
+  // written by another version.
+  std::optional<Activity> Load(std::uint64_t content_hash) const;
+
+  // Does nothing if another thread is storing the same activity. Throws if the
+  // file can't be written.
+  void Store(std::uint64_t content_hash, const Activity& activity);
+
+ private:
+  boost::filesystem::path Path(std::uint64_t content_hash) const;
+
+  const boost::filesystem::path directory_;
+  std::mutex mutex_;
+  // Content hashes being stored, their files would clash.
+  std::unordered_set<std::uint64_t> storing_;
+};
+
+}  // namespace gpx_to_kml
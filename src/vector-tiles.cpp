@@ -0,0 +1,714 @@
+#include "vector-tiles.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "boost/format.hpp"
+#include "deflate.h"
+#include "format.h"
+#include "logger.h"
+#include "parallel.h"
+#include "sqlite3/sqlite3.h"
+
+namespace gpx_to_kml {
+
+// A finished tile, empty data if nothing intersects it.
+struct EncodedTile {
+  std::uint32_t x;
+  std::uint32_t y;
+  std::string data;
+};
+
+// Describes the finished pyramid. The values are formatted as TileJSON
+// expects them.
+struct TilesetMetadata {
+  std::string min_zoom;
+  std::string max_zoom;
+  // "min_lon,min_lat,max_lon,max_lat"
+  std::string bounds;
+  // "lon,lat,zoom"
+  std::string center;
+  // JSON array describing the layers and their fields.
+  std::string vector_layers;
+};
+
+// Receives the tiles of one zoom level at a time.
+class TileStore {
+ public:
+  virtual ~TileStore() = default;
+
+  virtual void Put(int zoom, const std::vector<EncodedTile>& tiles) = 0;
+  virtual void Finish(const TilesetMetadata& metadata) = 0;
+};
+
+namespace {
+
+// Tile coordinate resolution and the margin kept around each tile so that
+// lines do not visibly end at tile borders, both in tile units.
+constexpr std::int64_t kExtent = 4096;
+constexpr std::int64_t kBuffer = 64;
+// Douglas-Peucker tolerance in tile units, a sixteenth of a pixel on a 256
+// pixel tile.
+constexpr double kSimplifyTolerance = 1.0;
+constexpr int kMaxSupportedZoom = 22;
+// Web Mercator is cut off where it becomes square.
+constexpr double kMaxLatitude = 85.05112878;
+
+constexpr char kLayerName[] = "activities";
+
+struct IntPoint {
+  std::int64_t x;
+  std::int64_t y;
+
+  bool operator==(const IntPoint&) const = default;
+};
+
+using Line = std::vector<IntPoint>;
+
+// Pairs a tile with a track intersecting it.
+struct TileTrack {
+  std::uint64_t tile;
+  std::uint32_t track;
+
+  bool operator<(const TileTrack& other) const {
+    return tile != other.tile ? tile < other.tile : track < other.track;
+  }
+};
+
+std::uint64_t TileKey(std::uint32_t x, std::uint32_t y) {
+  return static_cast<std::uint64_t>(x) << 32 | y;
+}
+
+// Protocol Buffers wire format.
+void AppendVarint(std::string& out, std::uint64_t value) {
+  while (value >= 0x80) {
+    out += static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+void AppendVarintField(std::string& out, int field, std::uint64_t value) {
+  AppendVarint(out, static_cast<std::uint64_t>(field) << 3);
+  AppendVarint(out, value);
+}
+
+void AppendBytesField(std::string& out, int field, std::string_view bytes) {
+  AppendVarint(out, static_cast<std::uint64_t>(field) << 3 | 2);
+  AppendVarint(out, bytes.size());
+  out += bytes;
+}
+
+void AppendPackedField(std::string& out, int field,
+                       const std::vector<std::uint32_t>& values) {
+  std::string packed;
+  for (std::uint32_t value : values) {
+    AppendVarint(packed, value);
+  }
+  AppendBytesField(out, field, packed);
+}
+
+std::uint32_t ZigZag(std::int64_t value) {
+  return static_cast<std::uint32_t>((value << 1) ^ (value >> 63));
+}
+
+// Quantizes Web Mercator points to world tile units at `scale` and drops
+// repeated points.
+template <typename Points>
+Line Quantize(const Points& points, double scale) {
+  Line line;
+  line.reserve(points.size());
+  for (const auto& point : points) {
+    const IntPoint quantized{std::llround(point.x * scale),
+                             std::llround(point.y * scale)};
+    if (line.empty() || line.back() != quantized) {
+      line.push_back(quantized);
+    }
+  }
+  return line;
+}
+
+double SquaredSegmentDistance(const IntPoint& p, const IntPoint& a,
+                              const IntPoint& b) {
+  double x = static_cast<double>(a.x);
+  double y = static_cast<double>(a.y);
+  const double dx = static_cast<double>(b.x - a.x);
+  const double dy = static_cast<double>(b.y - a.y);
+  if (dx != 0 || dy != 0) {
+    const double t = std::clamp(((p.x - x) * dx + (p.y - y) * dy) /
+                                    (dx * dx + dy * dy),
+                                0.0, 1.0);
+    x += t * dx;
+    y += t * dy;
+  }
+  return (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y);
+}
+
+// Douglas-Peucker with an explicit stack, tracks can have many thousand
+// points.
+Line Simplify(const Line& line) {
+  if (line.size() <= 2) {
+    return line;
+  }
+  std::vector<bool> keep(line.size(), false);
+  keep.front() = keep.back() = true;
+  std::vector<std::pair<std::size_t, std::size_t>> stack = {
+      {0, line.size() - 1}};
+  while (!stack.empty()) {
+    const auto [first, last] = stack.back();
+    stack.pop_back();
+    double max_distance = 0;
+    std::size_t farthest = first;
+    for (std::size_t i = first + 1; i < last; ++i) {
+      const double distance =
+          SquaredSegmentDistance(line[i], line[first], line[last]);
+      if (distance > max_distance) {
+        max_distance = distance;
+        farthest = i;
+      }
+    }
+    if (max_distance > kSimplifyTolerance * kSimplifyTolerance) {
+      keep[farthest] = true;
+      stack.emplace_back(first, farthest);
+      stack.emplace_back(farthest, last);
+    }
+  }
+  Line simplified;
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    if (keep[i]) {
+      simplified.push_back(line[i]);
+    }
+  }
+  return simplified;
+}
+
+// Liang-Barsky: narrows [t0, t1] to the part of a + t * (b - a) inside
+// [min, max] in both dimensions. Returns false if nothing is inside.
+bool ClipSegment(const IntPoint& a, const IntPoint& b, double min, double max,
+                 double& t0, double& t1) {
+  const double p[] = {-static_cast<double>(b.x - a.x),
+                      static_cast<double>(b.x - a.x),
+                      -static_cast<double>(b.y - a.y),
+                      static_cast<double>(b.y - a.y)};
+  const double q[] = {a.x - min, max - a.x, a.y - min, max - a.y};
+  t0 = 0;
+  t1 = 1;
+  for (int i = 0; i < 4; ++i) {
+    if (p[i] == 0) {
+      if (q[i] < 0) {
+        return false;
+      }
+    } else {
+      const double t = q[i] / p[i];
+      if (p[i] < 0) {
+        t0 = std::max(t0, t);
+      } else {
+        t1 = std::min(t1, t);
+      }
+    }
+  }
+  return t0 <= t1;
+}
+
+// Clips a line given in tile-local units to the buffered tile, which may
+// split it into several parts.
+std::vector<Line> ClipLine(const Line& line) {
+  constexpr double kMin = -kBuffer;
+  constexpr double kMax = kExtent + kBuffer;
+  std::vector<Line> parts;
+  Line part;
+  const auto flush = [&]() {
+    if (part.size() >= 2) {
+      parts.push_back(std::move(part));
+    }
+    part.clear();
+  };
+  const auto interpolate = [](const IntPoint& a, const IntPoint& b, double t) {
+    return IntPoint{a.x + std::llround(t * static_cast<double>(b.x - a.x)),
+                    a.y + std::llround(t * static_cast<double>(b.y - a.y))};
+  };
+  for (std::size_t i = 0; i + 1 < line.size(); ++i) {
+    double t0, t1;
+    if (!ClipSegment(line[i], line[i + 1], kMin, kMax, t0, t1)) {
+      flush();
+      continue;
+    }
+    if (t0 > 0 || part.empty()) {
+      flush();
+      part.push_back(interpolate(line[i], line[i + 1], t0));
+    }
+    const IntPoint end = interpolate(line[i], line[i + 1], t1);
+    if (part.back() != end) {
+      part.push_back(end);
+    }
+    if (t1 < 1) {
+      flush();
+    }
+  }
+  flush();
+  return parts;
+}
+
+// Adds the tiles whose buffered bounds the segment from a to b touches, given
+// in world tile units at a zoom with `num_tiles` tiles per axis. Walks the
+// tiles along the segment instead of covering its bounding box, which matters
+// for sparsely sampled tracks at high zoom levels.
+void AddSegmentTiles(const IntPoint& a, const IntPoint& b,
+                     std::int64_t num_tiles, std::vector<std::uint64_t>& tiles) {
+  const auto visit = [&](std::int64_t x, std::int64_t y) {
+    for (std::int64_t nx = x - 1; nx <= x + 1; ++nx) {
+      for (std::int64_t ny = y - 1; ny <= y + 1; ++ny) {
+        if (nx < 0 || ny < 0 || nx >= num_tiles || ny >= num_tiles) {
+          continue;
+        }
+        double t0, t1;
+        if ((nx == x && ny == y) ||
+            ClipSegment({a.x - nx * kExtent, a.y - ny * kExtent},
+                        {b.x - nx * kExtent, b.y - ny * kExtent}, -kBuffer,
+                        kExtent + kBuffer, t0, t1)) {
+          tiles.push_back(TileKey(static_cast<std::uint32_t>(nx),
+                                  static_cast<std::uint32_t>(ny)));
+        }
+      }
+    }
+  };
+  const auto cell = [](std::int64_t value) {
+    return value >= 0 ? value / kExtent : (value - kExtent + 1) / kExtent;
+  };
+  // Amanatides-Woo grid traversal.
+  std::int64_t x = cell(a.x);
+  std::int64_t y = cell(a.y);
+  const std::int64_t end_x = cell(b.x);
+  const std::int64_t end_y = cell(b.y);
+  const double dx = static_cast<double>(b.x - a.x);
+  const double dy = static_cast<double>(b.y - a.y);
+  const std::int64_t step_x = dx > 0 ? 1 : -1;
+  const std::int64_t step_y = dy > 0 ? 1 : -1;
+  constexpr double kInfinity = std::numeric_limits<double>::infinity();
+  double next_x = dx == 0 ? kInfinity
+                          : ((x + (step_x > 0)) * kExtent - a.x) / dx;
+  double next_y = dy == 0 ? kInfinity
+                          : ((y + (step_y > 0)) * kExtent - a.y) / dy;
+  const double delta_x = dx == 0 ? kInfinity : kExtent / std::abs(dx);
+  const double delta_y = dy == 0 ? kInfinity : kExtent / std::abs(dy);
+  std::int64_t remaining = std::abs(end_x - x) + std::abs(end_y - y);
+  visit(x, y);
+  for (; remaining > 0; --remaining) {
+    if (next_x < next_y) {
+      x += step_x;
+      next_x += delta_x;
+    } else {
+      y += step_y;
+      next_y += delta_y;
+    }
+    visit(x, y);
+  }
+}
+
+// MVT geometry commands: MoveTo and LineTo with zigzag encoded deltas from a
+// cursor which carries over between the parts.
+std::vector<std::uint32_t> EncodeGeometry(const std::vector<Line>& parts) {
+  constexpr std::uint32_t kMoveTo = 1;
+  constexpr std::uint32_t kLineTo = 2;
+  std::vector<std::uint32_t> commands;
+  IntPoint cursor{0, 0};
+  const auto move = [&](const IntPoint& point) {
+    commands.push_back(ZigZag(point.x - cursor.x));
+    commands.push_back(ZigZag(point.y - cursor.y));
+    cursor = point;
+  };
+  for (const Line& part : parts) {
+    commands.push_back(kMoveTo | 1 << 3);
+    move(part.front());
+    commands.push_back(kLineTo |
+                       static_cast<std::uint32_t>(part.size() - 1) << 3);
+    for (std::size_t i = 1; i < part.size(); ++i) {
+      move(part[i]);
+    }
+  }
+  return commands;
+}
+
+class MbtilesStore : public TileStore {
+ public:
+  MbtilesStore(const boost::filesystem::path& path, Durability durability)
+      : file_(path, durability) {
+    // Like GeoPackageWriter, the database is private until it is renamed
+    // into place and needs neither a journal nor syncs.
+    Check(sqlite3_open(file_.temp_path().string().data(), &db_), "opening");
+    Execute(
+        "PRAGMA journal_mode = OFF;"
+        "PRAGMA synchronous = OFF;"
+        "CREATE TABLE metadata (name TEXT, value TEXT);"
+        "CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, "
+        "tile_row INTEGER, tile_data BLOB);");
+    Check(sqlite3_prepare_v2(db_, "INSERT INTO tiles VALUES (?, ?, ?, ?)", -1,
+                             &insert_, nullptr),
+          "preparing insert");
+  }
+
+  ~MbtilesStore() override {
+    sqlite3_finalize(insert_);
+    sqlite3_close(db_);
+  }
+
+  void Put(int zoom, const std::vector<EncodedTile>& tiles) override {
+    Execute("BEGIN");
+    for (const EncodedTile& tile : tiles) {
+      // MBTiles numbers rows from the south, vector tiles are gzipped.
+      const std::string data = Gzip(tile.data);
+      sqlite3_bind_int(insert_, 1, zoom);
+      sqlite3_bind_int64(insert_, 2, tile.x);
+      sqlite3_bind_int64(insert_, 3, (std::int64_t{1} << zoom) - 1 - tile.y);
+      sqlite3_bind_blob(insert_, 4, data.data(), static_cast<int>(data.size()),
+                        SQLITE_STATIC);
+      if (const int result = sqlite3_step(insert_); result != SQLITE_DONE) {
+        Check(result, "inserting tile");
+      }
+      sqlite3_reset(insert_);
+    }
+    Execute("COMMIT");
+  }
+
+  void Finish(const TilesetMetadata& metadata) override {
+    Execute(
+        "CREATE UNIQUE INDEX tile_index ON tiles "
+        "(zoom_level, tile_column, tile_row)");
+    sqlite3_stmt* insert = nullptr;
+    Check(sqlite3_prepare_v2(db_, "INSERT INTO metadata VALUES (?, ?)", -1,
+                             &insert, nullptr),
+          "preparing metadata insert");
+    std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> statement(
+        insert, sqlite3_finalize);
+    const std::string json =
+        "{\"vector_layers\":" + metadata.vector_layers + "}";
+    const std::pair<std::string_view, std::string_view> rows[] = {
+        {"name", kLayerName},           {"format", "pbf"},
+        {"type", "overlay"},            {"minzoom", metadata.min_zoom},
+        {"maxzoom", metadata.max_zoom}, {"bounds", metadata.bounds},
+        {"center", metadata.center},    {"json", json}};
+    for (const auto& [name, value] : rows) {
+      sqlite3_bind_text(insert, 1, name.data(), static_cast<int>(name.size()),
+                        SQLITE_STATIC);
+      sqlite3_bind_text(insert, 2, value.data(),
+                        static_cast<int>(value.size()), SQLITE_STATIC);
+      if (const int result = sqlite3_step(insert); result != SQLITE_DONE) {
+        Check(result, "inserting metadata");
+      }
+      sqlite3_reset(insert);
+    }
+    statement.reset();
+    Check(sqlite3_finalize(insert_), "finalizing insert");
+    insert_ = nullptr;
+    Check(sqlite3_close(db_), "closing");
+    db_ = nullptr;
+    file_.Commit();
+  }
+
+ private:
+  void Execute(const char* sql) {
+    char* message = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &message) != SQLITE_OK) {
+      const std::string error = message ? message : sqlite3_errmsg(db_);
+      sqlite3_free(message);
+      throw std::invalid_argument(
+          boost::str(boost::format("MBTiles \"%s\": %s") %
+                     file_.path().string() % error));
+    }
+  }
+
+  void Check(int result, const char* what) {
+    if (result != SQLITE_OK) {
+      throw std::invalid_argument(boost::str(
+          boost::format("MBTiles \"%s\": failed %s: %s") %
+          file_.path().string() % what %
+          (db_ ? sqlite3_errmsg(db_) : sqlite3_errstr(result))));
+    }
+  }
+
+  AtomicFile file_;
+  sqlite3* db_ = nullptr;
+  sqlite3_stmt* insert_ = nullptr;
+};
+
+// Writes {z}/{x}/{y}.pbf files plus a metadata.json, uncompressed as static
+// file servers expect.
+class DirectoryStore : public TileStore {
+ public:
+  DirectoryStore(const boost::filesystem::path& path,
+                 std::string_view io_backend, Durability durability)
+      : path_(path),
+        durability_(durability),
+        backend_(CreateIoBackend(io_backend, durability)) {
+    boost::filesystem::create_directories(path_);
+  }
+
+  void Put(int zoom, const std::vector<EncodedTile>& tiles) override {
+    constexpr std::size_t kWriteBatchSize = 256;
+    const boost::filesystem::path zoom_dir = path_ / std::to_string(zoom);
+    std::vector<FileWrite> batch;
+    std::uint32_t last_x = 0;
+    for (std::size_t i = 0; i < tiles.size(); ++i) {
+      // Tiles arrive sorted by column.
+      const boost::filesystem::path column_dir =
+          zoom_dir / std::to_string(tiles[i].x);
+      if (i == 0 || tiles[i].x != last_x) {
+        boost::filesystem::create_directories(column_dir);
+        last_x = tiles[i].x;
+      }
+      batch.push_back(
+          FileWrite{.path = column_dir / (std::to_string(tiles[i].y) + ".pbf"),
+                    .contents = tiles[i].data});
+      if (batch.size() == kWriteBatchSize || i + 1 == tiles.size()) {
+        Write(batch);
+      }
+    }
+  }
+
+  // Writes a TileJSON document, the tiles URL is left to the server.
+  void Finish(const TilesetMetadata& metadata) override {
+    std::string json = "{\"tilejson\":\"3.0.0\",\"name\":";
+    AppendJsonString(json, kLayerName);
+    json += ",\"format\":\"pbf\",\"scheme\":\"xyz\",\"minzoom\":" +
+            metadata.min_zoom + ",\"maxzoom\":" + metadata.max_zoom +
+            ",\"bounds\":[" + metadata.bounds + "],\"center\":[" +
+            metadata.center + "],\"vector_layers\":" +
+            metadata.vector_layers + "}\n";
+    AtomicFile file(path_ / "metadata.json", durability_);
+    file.Write(json);
+    file.Commit();
+  }
+
+ private:
+  void Write(std::vector<FileWrite>& batch) {
+    backend_->Write(batch);
+    for (const FileWrite& write : batch) {
+      if (!write.error.empty()) {
+        throw std::invalid_argument(write.error);
+      }
+    }
+    batch.clear();
+  }
+
+  const boost::filesystem::path path_;
+  const Durability durability_;
+  std::unique_ptr<IoBackend> backend_;
+};
+
+// Encodes the parts of `tracks` within the tile at x, y whose lines are given
+// in world tile units of the tile's zoom.
+template <typename Track>
+std::string EncodeTile(std::uint32_t x, std::uint32_t y,
+                       const TileTrack* begin, const TileTrack* end,
+                       const std::vector<Line>& lines,
+                       const std::vector<Track>& tracks) {
+  const IntPoint origin{x * kExtent, y * kExtent};
+  std::string features;
+  std::vector<std::string_view> values;
+  std::unordered_map<std::string_view, std::uint32_t> value_indices;
+  const auto value_index = [&](std::string_view value) {
+    const auto [it, inserted] = value_indices.emplace(
+        value, static_cast<std::uint32_t>(values.size()));
+    if (inserted) {
+      values.push_back(value);
+    }
+    return it->second;
+  };
+  Line local;
+  for (const TileTrack* entry = begin; entry != end; ++entry) {
+    const Line& line = lines[entry->track];
+    local.clear();
+    for (const IntPoint& point : line) {
+      local.push_back({point.x - origin.x, point.y - origin.y});
+    }
+    const std::vector<Line> parts = ClipLine(local);
+    if (parts.empty()) {
+      continue;
+    }
+    const Track& track = tracks[entry->track];
+    std::string feature;
+    AppendVarintField(feature, 1, entry->track + 1);
+    AppendPackedField(feature, 2,
+                      {0, value_index(track.name), 1, value_index(track.date)});
+    AppendVarintField(feature, 3, 2);  // LINESTRING
+    AppendPackedField(feature, 4, EncodeGeometry(parts));
+    AppendBytesField(features, 2, feature);
+  }
+  if (features.empty()) {
+    return "";
+  }
+
+  std::string layer;
+  AppendVarintField(layer, 15, 2);
+  AppendBytesField(layer, 1, kLayerName);
+  layer += features;
+  AppendBytesField(layer, 3, "name");
+  AppendBytesField(layer, 3, "date");
+  for (std::string_view value : values) {
+    std::string encoded;
+    AppendBytesField(encoded, 1, value);
+    AppendBytesField(layer, 4, encoded);
+  }
+  AppendVarintField(layer, 5, kExtent);
+
+  std::string tile;
+  AppendBytesField(tile, 3, layer);
+  return tile;
+}
+
+}  // namespace
+
+std::pair<int, int> ParseZoomRange(std::string_view range) {
+  const std::size_t dash = range.find('-');
+  const std::string_view first = range.substr(0, dash);
+  const std::string_view last =
+      dash == std::string_view::npos ? first : range.substr(dash + 1);
+  int min_zoom = -1;
+  int max_zoom = -1;
+  const auto parse = [](std::string_view text, int& value) {
+    const auto result =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+  };
+  if (!parse(first, min_zoom) || !parse(last, max_zoom) || min_zoom < 0 ||
+      min_zoom > max_zoom || max_zoom > kMaxSupportedZoom) {
+    throw std::invalid_argument(boost::str(
+        boost::format("Invalid zoom range \"%s\", expected e.g. \"0-14\"") %
+        range));
+  }
+  return {min_zoom, max_zoom};
+}
+
+VectorTileWriter::VectorTileWriter(const boost::filesystem::path& path,
+                                   int min_zoom, int max_zoom,
+                                   std::string_view io_backend,
+                                   Durability durability)
+    : min_zoom_(min_zoom), max_zoom_(max_zoom) {
+  if (path.extension() == ".mbtiles") {
+    store_ = std::make_unique<MbtilesStore>(path, durability);
+  } else {
+    store_ = std::make_unique<DirectoryStore>(path, io_backend, durability);
+  }
+}
+
+VectorTileWriter::~VectorTileWriter() = default;
+
+void VectorTileWriter::Add(const Activity& activity) {
+  Track track;
+  track.name = activity.name;
+  AppendIsoTime(track.date, activity.time);
+  track.date.resize(10);
+  track.points.reserve(activity.coordinates.size());
+  double min_lon = 180, min_lat = 90, max_lon = -180, max_lat = -90;
+  for (const Coordinate& coordinate : activity.coordinates) {
+    const double lat = std::clamp(coordinate.lat, -kMaxLatitude, kMaxLatitude);
+    const double sin_lat = std::sin(lat * std::numbers::pi / 180);
+    track.points.push_back(Point{
+        .x = (coordinate.lon + 180) / 360,
+        .y = 0.5 - std::log((1 + sin_lat) / (1 - sin_lat)) /
+                       (4 * std::numbers::pi)});
+    min_lon = std::min(min_lon, coordinate.lon);
+    max_lon = std::max(max_lon, coordinate.lon);
+    min_lat = std::min(min_lat, lat);
+    max_lat = std::max(max_lat, lat);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  tracks_.push_back(std::move(track));
+  min_lon_ = std::min(min_lon_, min_lon);
+  max_lon_ = std::max(max_lon_, max_lon);
+  min_lat_ = std::min(min_lat_, min_lat);
+  max_lat_ = std::max(max_lat_, max_lat);
+}
+
+void VectorTileWriter::Finish() {
+  for (int zoom = min_zoom_; zoom <= max_zoom_; ++zoom) {
+    const double scale = static_cast<double>(kExtent) * std::ldexp(1.0, zoom);
+    const std::int64_t num_tiles = std::int64_t{1} << zoom;
+    // Simplify every track once for this zoom and bucket it by the tiles it
+    // touches.
+    std::vector<Line> lines(tracks_.size());
+    std::vector<TileTrack> tile_tracks;
+    std::mutex tile_tracks_mutex;
+    ParallelChunks(tracks_.size(), [&](std::size_t begin, std::size_t end) {
+      std::vector<TileTrack> chunk;
+      std::vector<std::uint64_t> tiles;
+      for (std::size_t i = begin; i < end; ++i) {
+        lines[i] = Simplify(Quantize(tracks_[i].points, scale));
+        const Line& line = lines[i];
+        tiles.clear();
+        for (std::size_t j = 0; j + 1 < line.size(); ++j) {
+          AddSegmentTiles(line[j], line[j + 1], num_tiles, tiles);
+        }
+        std::sort(tiles.begin(), tiles.end());
+        tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+        for (std::uint64_t tile : tiles) {
+          chunk.push_back(
+              TileTrack{.tile = tile, .track = static_cast<std::uint32_t>(i)});
+        }
+      }
+      std::lock_guard<std::mutex> lock(tile_tracks_mutex);
+      tile_tracks.insert(tile_tracks.end(), chunk.begin(), chunk.end());
+    });
+    ParallelSort(tile_tracks.begin(), tile_tracks.end(), std::less<>());
+
+    std::vector<std::size_t> starts;
+    for (std::size_t i = 0; i < tile_tracks.size(); ++i) {
+      if (i == 0 || tile_tracks[i].tile != tile_tracks[i - 1].tile) {
+        starts.push_back(i);
+      }
+    }
+    starts.push_back(tile_tracks.size());
+
+    std::vector<EncodedTile> tiles(starts.size() - 1);
+    ParallelChunks(tiles.size(), [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = begin; i < end; ++i) {
+        const std::uint64_t key = tile_tracks[starts[i]].tile;
+        tiles[i].x = static_cast<std::uint32_t>(key >> 32);
+        tiles[i].y = static_cast<std::uint32_t>(key);
+        tiles[i].data = EncodeTile(tiles[i].x, tiles[i].y,
+                                   tile_tracks.data() + starts[i],
+                                   tile_tracks.data() + starts[i + 1], lines,
+                                   tracks_);
+      }
+    });
+    std::erase_if(tiles,
+                  [](const EncodedTile& tile) { return tile.data.empty(); });
+    Log(Verbosity::kNormal) << "Vector tiles at zoom " << zoom << ": "
+                            << tiles.size();
+    store_->Put(zoom, tiles);
+  }
+
+  if (tracks_.empty()) {
+    min_lon_ = min_lat_ = max_lon_ = max_lat_ = 0;
+  }
+  TilesetMetadata metadata;
+  metadata.min_zoom = std::to_string(min_zoom_);
+  metadata.max_zoom = std::to_string(max_zoom_);
+  for (double value : {min_lon_, min_lat_, max_lon_, max_lat_}) {
+    if (!metadata.bounds.empty()) {
+      metadata.bounds += ',';
+    }
+    AppendFixed(metadata.bounds, value, kCoordinatePrecision);
+  }
+  AppendFixed(metadata.center, (min_lon_ + max_lon_) / 2,
+              kCoordinatePrecision);
+  metadata.center += ',';
+  AppendFixed(metadata.center, (min_lat_ + max_lat_) / 2,
+              kCoordinatePrecision);
+  metadata.center += ',' + metadata.min_zoom;
+  metadata.vector_layers = "[{\"id\":";
+  AppendJsonString(metadata.vector_layers, kLayerName);
+  metadata.vector_layers +=
+      ",\"fields\":{\"name\":\"String\",\"date\":\"String\"},\"minzoom\":" +
+      metadata.min_zoom + ",\"maxzoom\":" + metadata.max_zoom + "}]";
+  store_->Finish(metadata);
+}
+
+}  // namespace gpx_to_kml
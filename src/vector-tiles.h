@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "io-backend.h"
+
+namespace gpx_to_kml {
+
+class TileStore;
+
+// Renders all activities into a Mapbox Vector Tile pyramid with a single
+// "activities" layer of LineString features carrying name and date. Paths
+// ending in ".mbtiles" produce an MBTiles database, anything else a z/x/y.pbf
+// directory tree.
+//
+// Add() only projects the coordinates to Web Mercator. Finish() then builds
+// one zoom level at a time: every track is quantized and simplified once for
+// the zoom and bucketed by the tiles it touches, after which the tiles are
+// clipped and encoded in parallel and handed to the store.
+class VectorTileWriter : public ActivitySink {
+ public:
+  VectorTileWriter(const boost::filesystem::path& path, int min_zoom,
+                   int max_zoom, std::string_view io_backend,
+                   Durability durability);
+  ~VectorTileWriter() override;
+
+  void Add(const Activity& activity) override;
+  void Finish() override;
+
+ private:
+  // Web Mercator, scaled to [0, 1) with y pointing south.
+  struct Point {
+    double x;
+    double y;
+  };
+
+  struct Track {
+    std::string name;
+    std::string date;
+    std::vector<Point> points;
+  };
+
+  const int min_zoom_;
+  const int max_zoom_;
+  std::unique_ptr<TileStore> store_;
+
+  std::mutex mutex_;
+  std::vector<Track> tracks_;
+  // Longitude/latitude bounds of all tracks.
+  double min_lon_ = 180;
+  double min_lat_ = 90;
+  double max_lon_ = -180;
+  double max_lat_ = -90;
+};
+
+// Parses a zoom range like "0-14", or a single zoom level.
+std::pair<int, int> ParseZoomRange(std::string_view range);
+
+}  // namespace gpx_to_kml
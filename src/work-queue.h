@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gpx_to_kml {
+
+// Depth of a queue as seen by each push, including the pushed value.
+struct QueueStats {
+  std::uint64_t pushes = 0;
+  std::size_t max_depth = 0;
+  double mean_depth = 0;
+};
+
+// Bounded multi-producer multi-consumer queue after Dmitry Vyukov: every cell
+// carries a sequence number which tells producers and consumers whether it is
+// free for their current position, so neither side takes a lock and the two
+// ends only share cache lines when the queue is nearly empty or full.
+//
+// Push() and Pop() block by spinning briefly and then sleeping on an atomic
+// counter, which the other side only notifies while somebody is waiting. Once
+// Close() has been called, Pop() drains the remaining values and then returns
+// std::nullopt.
+template <typename T>
+class BoundedQueue {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit BoundedQueue(std::size_t capacity)
+      : mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+        cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+    for (std::size_t i = 0; i <= mask_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  // Approximate number of queued values.
+  std::size_t size() const {
+    const std::size_t tail = dequeue_pos_.load(std::memory_order_relaxed);
+    const std::size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+  }
+
+  // Returns false and leaves `value` untouched if the queue is full.
+  bool TryPush(T& value) {
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & mask_];
+      const std::size_t sequence =
+          cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = static_cast<std::intptr_t>(sequence) -
+                                 static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          RecordDepth(pos + 1, dequeue_pos_.load(std::memory_order_relaxed));
+          // Every value can satisfy a single consumer.
+          pushes_.fetch_add(1, std::memory_order_seq_cst);
+          if (pop_waiters_.load(std::memory_order_seq_cst) > 0) {
+            pushes_.notify_one();
+          }
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::optional<T> TryPop() {
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & mask_];
+      const std::size_t sequence =
+          cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = static_cast<std::intptr_t>(sequence) -
+                                 static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          std::optional<T> value(std::move(cell.value));
+          cell.value = T();
+          cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          // Blocked producers are woken once half the queue is free rather
+          // than on every pop, so they push in bursts.
+          pops_.fetch_add(1, std::memory_order_seq_cst);
+          if (push_waiters_.load(std::memory_order_seq_cst) > 0 &&
+              size() <= capacity() / 2) {
+            pops_.notify_all();
+          }
+          return value;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Blocks while the queue is full. Must not be called after Close().
+  void Push(T value) {
+    Await(pops_, push_waiters_, [&]() { return TryPush(value); });
+  }
+
+  // Blocks while the queue is empty and open.
+  std::optional<T> Pop() {
+    std::optional<T> value;
+    Await(pushes_, pop_waiters_, [&]() {
+      // All pushes happen before Close(), so the queue is drained for good if
+      // it is still empty after observing the close.
+      const bool closed = closed_.load(std::memory_order_acquire);
+      value = TryPop();
+      return value.has_value() || closed;
+    });
+    return value;
+  }
+
+  // Blocks until at least one value is available and appends up to
+  // `max_values` values to the cleared `values`. Returns false once the queue
+  // has been closed and drained.
+  bool PopBatch(std::size_t max_values, std::vector<T>& values) {
+    values.clear();
+    std::optional<T> value = Pop();
+    if (!value.has_value()) {
+      return false;
+    }
+    values.push_back(std::move(*value));
+    while (values.size() < max_values && (value = TryPop()).has_value()) {
+      values.push_back(std::move(*value));
+    }
+    return true;
+  }
+
+  QueueStats stats() const {
+    QueueStats stats;
+    stats.pushes = pushed_.load(std::memory_order_relaxed);
+    stats.max_depth = max_depth_.load(std::memory_order_relaxed);
+    if (stats.pushes > 0) {
+      stats.mean_depth =
+          static_cast<double>(depth_sum_.load(std::memory_order_relaxed)) /
+          static_cast<double>(stats.pushes);
+    }
+    return stats;
+  }
+
+  // Wakes up all consumers once the queue has been drained.
+  void Close() {
+    closed_.store(true, std::memory_order_release);
+    pushes_.fetch_add(1, std::memory_order_seq_cst);
+    pushes_.notify_all();
+  }
+
+ private:
+  static constexpr std::size_t kCacheLineSize = 64;
+  static constexpr int kSpinCount = 64;
+
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  // Consumers may already have moved past `head` if other producers pushed
+  // meanwhile.
+  void RecordDepth(std::size_t head, std::size_t tail) {
+    const std::size_t depth = head > tail ? head - tail : 0;
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    depth_sum_.fetch_add(depth, std::memory_order_relaxed);
+    std::size_t max_depth = max_depth_.load(std::memory_order_relaxed);
+    while (depth > max_depth &&
+           !max_depth_.compare_exchange_weak(max_depth, depth,
+                                             std::memory_order_relaxed)) {
+    }
+  }
+
+  // Retries `attempt` until it succeeds. A waiter registers itself before
+  // sampling `counter` and retrying, so the other side either sees the waiter
+  // and notifies, or its update is visible to the retry.
+  template <typename Attempt>
+  static void Await(std::atomic<std::uint32_t>& counter,
+                    std::atomic<int>& waiters, const Attempt& attempt) {
+    // Spinning only pays off if the other side runs on another core.
+    static const int spin_count =
+        std::thread::hardware_concurrency() > 1 ? kSpinCount : 0;
+    for (int i = 0; i < spin_count; ++i) {
+      if (attempt()) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    while (true) {
+      waiters.fetch_add(1, std::memory_order_seq_cst);
+      const std::uint32_t seen = counter.load(std::memory_order_seq_cst);
+      if (attempt()) {
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      counter.wait(seen, std::memory_order_seq_cst);
+      waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  const std::size_t mask_;
+  const std::unique_ptr<Cell[]> cells_;
+  alignas(kCacheLineSize) std::atomic<std::size_t> enqueue_pos_ = 0;
+  alignas(kCacheLineSize) std::atomic<std::size_t> dequeue_pos_ = 0;
+  alignas(kCacheLineSize) std::atomic<std::uint32_t> pushes_ = 0;
+  std::atomic<int> pop_waiters_ = 0;
+  std::atomic<std::uint64_t> pushed_ = 0;
+  std::atomic<std::uint64_t> depth_sum_ = 0;
+  std::atomic<std::size_t> max_depth_ = 0;
+  alignas(kCacheLineSize) std::atomic<std::uint32_t> pops_ = 0;
+  std::atomic<int> push_waiters_ = 0;
+  std::atomic<bool> closed_ = false;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,133 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "activity.h"
+#include "boost/test/unit_test.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+// A winding track of `num_points` points about ten meters apart, one second
+// apart in time.
+Activity Track(std::size_t num_points, double lat = 47) {
+  Activity activity = {};
+  for (std::size_t i = 0; i < num_points; ++i) {
+    const double step = static_cast<double>(i);
+    activity.coordinates.push_back(Coordinate{
+        .lat = lat + step * 1e-4,
+        .lon = 8 + std::sin(step / 10) * 1e-3,
+        .alt = 400,
+        .time = 1641801600000 + static_cast<std::int64_t>(i) * 1000});
+  }
+  return activity;
+}
+
+// `activity` without its first and last `num_points` points.
+Activity Trimmed(Activity activity, std::size_t num_points) {
+  activity.coordinates.erase(activity.coordinates.end() - num_points,
+                             activity.coordinates.end());
+  activity.coordinates.erase(activity.coordinates.begin(),
+                             activity.coordinates.begin() + num_points);
+  return activity;
+}
+
+BOOST_AUTO_TEST_SUITE(FingerprintTest)
+
+BOOST_AUTO_TEST_CASE(IgnoresExportDetails) {
+  const Activity track = Track(200);
+  Activity exported = track;
+  exported.name = "Renamed";
+  for (Coordinate& coordinate : exported.coordinates) {
+    // Fewer decimals, other elevations and milliseconds.
+    coordinate.lat = std::round(coordinate.lat * 1e6) / 1e6;
+    coordinate.alt += 10;
+    coordinate.time += 300;
+  }
+  // A repeated point, e.g. from a paused recording.
+  exported.coordinates.insert(exported.coordinates.begin() + 50,
+                              exported.coordinates[50]);
+  const ActivityFingerprint a = Fingerprint(track);
+  const ActivityFingerprint b = Fingerprint(exported);
+  BOOST_TEST(a.points_hash == b.points_hash);
+  BOOST_TEST(a.num_points == b.num_points);
+  BOOST_TEST(a.samples == b.samples);
+  BOOST_TEST(a.points_hash != Fingerprint(Track(200, 48)).points_hash);
+}
+
+BOOST_AUTO_TEST_CASE(TrimmedCopiesShareMostSamples) {
+  const ActivityFingerprint full = Fingerprint(Track(1000));
+  const ActivityFingerprint trimmed = Fingerprint(Trimmed(Track(1000), 50));
+  BOOST_TEST(full.samples.size() >= 40u);
+  std::vector<std::uint64_t> shared;
+  std::set_intersection(full.samples.begin(), full.samples.end(),
+                        trimmed.samples.begin(), trimmed.samples.end(),
+                        std::back_inserter(shared));
+  BOOST_TEST(shared.size() == trimmed.samples.size());
+  BOOST_TEST(static_cast<double>(shared.size()) /
+                 static_cast<double>(full.samples.size()) >=
+             0.8);
+}
+
+BOOST_AUTO_TEST_CASE(FirstSortingCopyIsTheOriginal) {
+  const ActivityFingerprint fingerprint = Fingerprint(Track(200));
+  DuplicateIndex index;
+  BOOST_TEST(!index.Add(fingerprint, "m.gpx"));
+
+  std::optional<DuplicateIndex::Duplicate> duplicate =
+      index.Add(fingerprint, "z.gpx");
+  BOOST_REQUIRE(duplicate);
+  BOOST_TEST((duplicate->kind == DuplicateIndex::Kind::kExact));
+  BOOST_TEST(duplicate->copy == "z.gpx");
+  BOOST_TEST(duplicate->original == "m.gpx");
+  BOOST_TEST(duplicate->overlap == 1);
+
+  // Turns up later but sorts first.
+  duplicate = index.Add(fingerprint, "a.gpx");
+  BOOST_REQUIRE(duplicate);
+  BOOST_TEST(duplicate->copy == "m.gpx");
+  BOOST_TEST(duplicate->original == "a.gpx");
+
+  duplicate = index.Add(fingerprint, "q.gpx");
+  BOOST_REQUIRE(duplicate);
+  BOOST_TEST(duplicate->copy == "q.gpx");
+  BOOST_TEST(duplicate->original == "a.gpx");
+}
+
+BOOST_AUTO_TEST_CASE(NearDuplicates) {
+  const ActivityFingerprint full = Fingerprint(Track(1000));
+  const ActivityFingerprint trimmed = Fingerprint(Trimmed(Track(1000), 50));
+  for (const bool full_first : {true, false}) {
+    DuplicateIndex index;
+    BOOST_TEST(!index.Add(Fingerprint(Track(1000, 48)), "other.gpx"));
+    BOOST_TEST(!index.Add(full_first ? full : trimmed,
+                          full_first ? "b-full.gpx" : "a-trimmed.gpx"));
+    const std::optional<DuplicateIndex::Duplicate> duplicate =
+        index.Add(full_first ? trimmed : full,
+                  full_first ? "a-trimmed.gpx" : "b-full.gpx");
+    BOOST_REQUIRE(duplicate);
+    // Whichever came first, the full track contains the original's.
+    BOOST_TEST((duplicate->kind == DuplicateIndex::Kind::kContains));
+    BOOST_TEST(duplicate->copy == "b-full.gpx");
+    BOOST_TEST(duplicate->original == "a-trimmed.gpx");
+    BOOST_TEST(duplicate->overlap == 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(EmptyTracksNeverMatch) {
+  DuplicateIndex index;
+  BOOST_TEST(!index.Add(Fingerprint(Activity{}), "a.gpx"));
+  BOOST_TEST(!index.Add(Fingerprint(Activity{}), "b.gpx"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
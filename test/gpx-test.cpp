@@ -0,0 +1,73 @@
+#include "gpx.h"
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+#include "iso-time.h"
+#include "test-data.h"
+#include "tinyxml2/tinyxml2.h"
+
+namespace gpx_to_kml {
+namespace {
+
+const tinyxml2::XMLElement& LoadTrack(tinyxml2::XMLDocument& doc,
+                                      std::string_view name) {
+  BOOST_REQUIRE_EQUAL(doc.LoadFile(TestData(name).string().c_str()),
+                      tinyxml2::XML_SUCCESS);
+  const tinyxml2::XMLElement* root = doc.FirstChildElement("gpx");
+  BOOST_REQUIRE(root);
+  const tinyxml2::XMLElement* track = root->FirstChildElement("trk");
+  BOOST_REQUIRE(track);
+  return *track;
+}
+
+BOOST_AUTO_TEST_SUITE(GpxTest)
+
+BOOST_AUTO_TEST_CASE(InvalidPointTimeIsLeftOut) {
+  tinyxml2::XMLDocument doc;
+  const tinyxml2::XMLElement& track = LoadTrack(doc, "invalid-point-time.gpx");
+  BOOST_TEST(ParseName(track) == "Invalid point time");
+  std::vector<PointExtension> extensions;
+  const Coordinates coordinates = ParseCoordinates(track, &extensions);
+  BOOST_REQUIRE_EQUAL(coordinates.size(), 3u);
+  BOOST_TEST(coordinates[0].time == *ParseIsoTime("2022-01-10T08:00:00Z"));
+  BOOST_TEST(coordinates[1].time == kNoTime);
+  BOOST_TEST(coordinates[1].lat == 47.1060023);
+  BOOST_TEST(coordinates[1].alt == 1000.5);
+  BOOST_TEST(coordinates[2].time == *ParseIsoTime("2022-01-10T08:00:02Z"));
+  BOOST_TEST(extensions.empty());
+}
+
+BOOST_AUTO_TEST_CASE(ParsesHeaderOnly) {
+  const std::string xml =
+      "<?xml version=\"1.0\"?><gpx><metadata><time>2022-01-10T08:00:00Z"
+      "</time></metadata><trk><name>Hike</name><type>1</type><trkseg><trkpt";
+  const std::optional<Activity> activity = ParseActivityHeader(xml);
+  BOOST_REQUIRE(activity.has_value());
+  BOOST_TEST(activity->name == "Hike");
+  BOOST_TEST(activity->time.tm_year == 122);
+  BOOST_TEST(activity->time.tm_mday == 10);
+  BOOST_TEST(activity->coordinates.empty());
+
+  BOOST_TEST(!ParseActivityHeader(xml.substr(0, xml.find("<trkseg"))));
+  BOOST_TEST(!ParseActivityHeader("<gpx><trk><name>Hike</name><trkseg>"));
+}
+
+BOOST_AUTO_TEST_CASE(MissingElevationThrows) {
+  tinyxml2::XMLDocument doc;
+  const char xml[] =
+      "<trk><trkseg><trkpt lat=\"1\" lon=\"2\"></trkpt></trkseg></trk>";
+  BOOST_REQUIRE_EQUAL(doc.Parse(xml), tinyxml2::XML_SUCCESS);
+  std::vector<PointExtension> extensions;
+  BOOST_CHECK_THROW(
+      ParseCoordinates(*doc.FirstChildElement("trk"), &extensions),
+      std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
@@ -0,0 +1,42 @@
+#include "hash.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "boost/test/unit_test.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+BOOST_AUTO_TEST_SUITE(HashTest)
+
+// Vectors of the reference implementation, as printed by xxhsum -H64.
+BOOST_AUTO_TEST_CASE(MatchesReference) {
+  BOOST_TEST(Xxh64("") == 0xEF46DB3751D8E999);
+  BOOST_TEST(Xxh64("a") == 0xD24EC4F1A98C6E5B);
+  BOOST_TEST(Xxh64("abc") == 0x44BC2CF5AD770999);
+  // Longer than a stripe of 32 bytes.
+  BOOST_TEST(Xxh64("Nobody inspects the spammish repetition") ==
+             0xFBCEA83C8A378BF1);
+  BOOST_TEST(Xxh64("xxhash", 20141025) == 0xB559B98D844E0635);
+}
+
+BOOST_AUTO_TEST_CASE(EveryByteCounts) {
+  // Crosses the stripe, 8 byte, 4 byte and single byte paths.
+  std::string data(100, 'x');
+  const std::uint64_t hash = Xxh64(data);
+  for (std::size_t i = 0; i < data.size(); ++i) {
+    std::string changed = data;
+    changed[i] = 'y';
+    BOOST_TEST(Xxh64(changed) != hash);
+    BOOST_TEST(Xxh64(std::string_view(data).substr(0, i)) != hash);
+  }
+  BOOST_TEST(Xxh64(data, 1) != hash);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
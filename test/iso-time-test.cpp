@@ -0,0 +1,94 @@
+#include "iso-time.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "boost/test/unit_test.hpp"
+#include "format.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// Returned for texts ParseIsoTime() rejects, std::optional isn't printable.
+constexpr std::int64_t kInvalid = std::numeric_limits<std::int64_t>::min();
+
+std::int64_t Parse(std::string_view text) {
+  return ParseIsoTime(text).value_or(kInvalid);
+}
+
+std::string Format(std::int64_t epoch_milliseconds) {
+  std::string text;
+  AppendIsoTime(text, epoch_milliseconds);
+  return text;
+}
+
+BOOST_AUTO_TEST_SUITE(IsoTimeTest)
+
+BOOST_AUTO_TEST_CASE(CivilDaysRoundTrip) {
+  BOOST_TEST(DaysFromCivil(1970, 1, 1) == 0);
+  BOOST_TEST(DaysFromCivil(2000, 3, 1) == 11017);
+  BOOST_TEST(DaysFromCivil(1969, 12, 31) == -1);
+  for (std::int64_t days = -800000; days <= 800000; days += 37) {
+    const CivilDate date = CivilFromDays(days);
+    BOOST_TEST_REQUIRE(DaysFromCivil(date.year, date.month, date.day) == days);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Parses) {
+  BOOST_TEST(Parse("1970-01-01T00:00:00Z") == 0);
+  BOOST_TEST(Parse("2022-01-10T08:00:00Z") == 1641801600000);
+  BOOST_TEST(Parse("2022-01-10T08:00:00") == 1641801600000);
+  BOOST_TEST(Parse(" 2022-01-10T08:00:00Z\n") == 1641801600000);
+  BOOST_TEST(Parse("2022-01-10T08:00:00.5Z") == 1641801600500);
+  BOOST_TEST(Parse("2022-01-10T08:00:00.123456Z") == 1641801600123);
+  BOOST_TEST(Parse("2022-01-10T09:30:00+01:30") == 1641801600000);
+  BOOST_TEST(Parse("2022-01-10T06:00:00-0200") == 1641801600000);
+  BOOST_TEST(Parse("1969-12-31T23:59:59Z") == -1000);
+  BOOST_TEST(Parse("2020-02-29T00:00:00Z") == 1582934400000);
+  BOOST_TEST(Parse("2000-02-29T00:00:00Z") == 951782400000);
+}
+
+BOOST_AUTO_TEST_CASE(RejectsInvalid) {
+  for (const char* text : {"",
+                           "2022-01-10",
+                           "2022-01-10 08:00:00",
+                           "2022-01-10T08:00Z",
+                           "2022-1-10T08:00:00Z",
+                           "2022-01-10T08:00:00.Z",
+                           "2022-01-10T08:00:00Zx",
+                           "2022-01-10T08:00:00+1",
+                           "2022-00-10T08:00:00Z",
+                           "2022-13-10T08:00:00Z",
+                           "2022-01-00T08:00:00Z",
+                           "2022-01-32T08:00:00Z",
+                           "2021-02-29T08:00:00Z",
+                           "1900-02-29T08:00:00Z",
+                           "2021-02-31T08:00:00Z",
+                           "2021-04-31T08:00:00Z",
+                           "2021-06-31T08:00:00Z",
+                           "2021-09-31T08:00:00Z",
+                           "2021-11-31T08:00:00Z",
+                           "2022-01-10T24:00:00Z",
+                           "2022-01-10T08:60:00Z",
+                           "2022-01-10T08:00:61Z"}) {
+    BOOST_TEST(Parse(text) == kInvalid, text);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FormatsAndParsesBack) {
+  BOOST_TEST(Format(0) == "1970-01-01T00:00:00Z");
+  BOOST_TEST(Format(1641801600000) == "2022-01-10T08:00:00Z");
+  BOOST_TEST(Format(1641801600007) == "2022-01-10T08:00:00.007Z");
+  BOOST_TEST(Format(-1) == "1969-12-31T23:59:59.999Z");
+  for (std::int64_t time = -2208988800000; time < 4102444800000;
+       time += 86400000 * 17 + 3600000 * 5 + 60000 * 7 + 1000 * 11 + 13) {
+    BOOST_TEST_REQUIRE(Parse(Format(time)) == time);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
@@ -0,0 +1,73 @@
+#include "journal.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "boost/filesystem.hpp"
+#include "boost/test/unit_test.hpp"
+#include "test-data.h"
+
+namespace gpx_to_kml {
+namespace {
+
+using Entries = std::unordered_map<std::string, std::string>;
+
+BOOST_AUTO_TEST_SUITE(JournalTest)
+
+BOOST_AUTO_TEST_CASE(RoundTrips) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "journal";
+  {
+    Journal journal(path);
+    BOOST_TEST(journal.loaded().empty());
+    journal.Add("a.gpx", "2022-01-10 Hike");
+    // Skipped inputs have no output name.
+    journal.Add("dir/b.gpx", "");
+  }
+  {
+    Journal journal(path);
+    BOOST_TEST((journal.loaded() ==
+                Entries{{"a.gpx", "2022-01-10 Hike"}, {"dir/b.gpx", ""}}));
+    // Later entries win, e.g. for an input dropped as a duplicate.
+    journal.Add("a.gpx", "");
+    journal.Add("Zürich.gpx", "2022-01-11 Üetliberg");
+  }
+  BOOST_TEST((Journal(path).loaded() ==
+              Entries{{"a.gpx", ""},
+                      {"dir/b.gpx", ""},
+                      {"Zürich.gpx", "2022-01-11 Üetliberg"}}));
+}
+
+BOOST_AUTO_TEST_CASE(DropsTruncatedTail) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "journal";
+  {
+    Journal journal(path);
+    journal.Add("a.gpx", "2022-01-10 Hike");
+  }
+  const std::uintmax_t complete = boost::filesystem::file_size(path);
+  // As left by runs killed while adding an entry.
+  for (const std::string& tail : {std::string("b.g"), std::string("b.gpx\0", 6),
+                                 std::string("b.gpx\0Ru", 8)}) {
+    {
+      std::ofstream(path.string(), std::ios::binary | std::ios::app) << tail;
+    }
+    {
+      Journal journal(path);
+      BOOST_TEST((journal.loaded() == Entries{{"a.gpx", "2022-01-10 Hike"}}));
+      BOOST_TEST(boost::filesystem::file_size(path) == complete);
+      journal.Add("c.gpx", "2022-01-12 Ride");
+    }
+    BOOST_TEST((Journal(path).loaded() ==
+                Entries{{"a.gpx", "2022-01-10 Hike"},
+                        {"c.gpx", "2022-01-12 Ride"}}));
+    boost::filesystem::resize_file(path, complete);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
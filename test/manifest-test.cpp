@@ -0,0 +1,142 @@
+#include "manifest.h"
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "boost/test/unit_test.hpp"
+#include "io-backend.h"
+#include "test-data.h"
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr std::uint64_t kOptionsHash = 7;
+// Long before any test runs, so the entries count as unchanged.
+constexpr std::int64_t kMtime = 1000;
+
+// Writes a manifest with a converted and a skipped input.
+void WriteManifest(const boost::filesystem::path& path) {
+  Manifest manifest(path, kOptionsHash);
+  manifest.Listed("a.gpx", 100, kMtime);
+  manifest.Hashed("a.gpx", 42);
+  BOOST_TEST(manifest
+                 .Converted("a.gpx", "2022-01-10 Hike",
+                            {"2022-01-10 Hike.kml", "2022-01-10 Hike.geojson"})
+                 .empty());
+  manifest.Listed("dir/b.gpx", 200, kMtime);
+  manifest.Hashed("dir/b.gpx", 43);
+  manifest.Converted("dir/b.gpx", "", {});
+  manifest.Write(Durability::kNone, /*listed_all=*/true);
+}
+
+BOOST_AUTO_TEST_SUITE(ManifestTest)
+
+BOOST_AUTO_TEST_CASE(RoundTrips) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "manifest";
+  WriteManifest(path);
+
+  const Manifest manifest(path, kOptionsHash);
+  BOOST_TEST(manifest.loaded().size() == 2u);
+  const ManifestEntry& a = manifest.loaded().at("a.gpx");
+  BOOST_TEST(a.size == 100u);
+  BOOST_TEST(a.mtime == kMtime);
+  BOOST_TEST(a.content_hash == 42u);
+  BOOST_TEST(a.options_hash == kOptionsHash);
+  BOOST_TEST(a.name == "2022-01-10 Hike");
+  BOOST_TEST((a.outputs == std::vector<std::string>{
+                               "2022-01-10 Hike.kml",
+                               "2022-01-10 Hike.geojson"}));
+  const ManifestEntry& b = manifest.loaded().at("dir/b.gpx");
+  BOOST_TEST(b.content_hash == 43u);
+  BOOST_TEST(b.name.empty());
+  BOOST_TEST(b.outputs.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TellsChangedInputsApart) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "manifest";
+  WriteManifest(path);
+
+  Manifest manifest(path, kOptionsHash);
+  BOOST_TEST(manifest.Unchanged("a.gpx", 100, kMtime));
+  BOOST_TEST(!manifest.Unchanged("a.gpx", 101, kMtime));
+  BOOST_TEST(!manifest.Unchanged("a.gpx", 100, kMtime + 1));
+  BOOST_TEST(!manifest.Unchanged("c.gpx", 100, kMtime));
+  BOOST_TEST(!Manifest(path, kOptionsHash + 1).Unchanged("a.gpx", 100, kMtime));
+
+  manifest.Listed("a.gpx", 100, kMtime);
+  BOOST_TEST(manifest.KnownContentHash("a.gpx").value_or(0) == 42u);
+  manifest.Listed("dir/b.gpx", 200, kMtime + 1);
+  BOOST_TEST(!manifest.KnownContentHash("dir/b.gpx"));
+  // Touched, but the same contents.
+  BOOST_TEST(manifest.Hashed("dir/b.gpx", 43));
+  BOOST_TEST(!manifest.Hashed("a.gpx", 44));
+}
+
+BOOST_AUTO_TEST_CASE(ReturnsStaleOutputs) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "manifest";
+  WriteManifest(path);
+
+  Manifest manifest(path, kOptionsHash);
+  manifest.Listed("a.gpx", 100, kMtime + 1);
+  manifest.Hashed("a.gpx", 44);
+  BOOST_TEST((manifest.Converted("a.gpx", "2022-01-11 Run",
+                                 {"2022-01-11 Run.kml",
+                                  "2022-01-10 Hike.geojson"}) ==
+              std::vector<std::string>{"2022-01-10 Hike.kml"}));
+  // Dropped as a duplicate after converting, keeps what was recorded.
+  manifest.Converted("a.gpx", "", {});
+  manifest.Write(Durability::kNone, /*listed_all=*/true);
+
+  const Manifest written(path, kOptionsHash);
+  BOOST_TEST(written.loaded().size() == 1u);
+  const ManifestEntry& a = written.loaded().at("a.gpx");
+  BOOST_TEST(a.mtime == kMtime + 1);
+  BOOST_TEST(a.content_hash == 44u);
+  BOOST_TEST(a.outputs.empty());
+}
+
+BOOST_AUTO_TEST_CASE(KeepsUnseenEntriesOfInterruptedRuns) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "manifest";
+  WriteManifest(path);
+  {
+    Manifest manifest(path, kOptionsHash);
+    manifest.Keep("a.gpx");
+    manifest.Write(Durability::kNone, /*listed_all=*/false);
+  }
+  BOOST_TEST(Manifest(path, kOptionsHash).loaded().size() == 2u);
+  {
+    Manifest manifest(path, kOptionsHash);
+    manifest.Keep("a.gpx");
+    manifest.Write(Durability::kNone, /*listed_all=*/true);
+  }
+  BOOST_TEST(Manifest(path, kOptionsHash).loaded().size() == 1u);
+}
+
+BOOST_AUTO_TEST_CASE(RejectsCorruptFiles) {
+  TempDirectory directory;
+  const boost::filesystem::path path = directory.path() / "manifest";
+  WriteManifest(path);
+  const std::uintmax_t size = boost::filesystem::file_size(path);
+  {
+    std::ofstream(path.string(), std::ios::app) << "x";
+  }
+  BOOST_CHECK_THROW(Manifest(path, kOptionsHash), std::invalid_argument);
+  // Every truncated tail, down to a partial magic.
+  for (std::uintmax_t truncated = size; truncated-- > 0;) {
+    boost::filesystem::resize_file(path, truncated);
+    BOOST_CHECK_THROW(Manifest(path, kOptionsHash), std::invalid_argument);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
@@ -0,0 +1,125 @@
+#include "output-names.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string/trim.hpp"
+#include "boost/regex.hpp"
+#include "boost/test/unit_test.hpp"
+#include "test-data.h"
+
+namespace gpx_to_kml {
+namespace {
+
+// NormalizeFilename() as it was before the lookup table replaced the regex.
+std::string RegexNormalizeFilename(const std::string& filename) {
+  return boost::algorithm::trim_copy(
+      boost::regex_replace(filename, boost::regex(R"([<>:"\/\|\?\*])"), "_"));
+}
+
+BOOST_AUTO_TEST_SUITE(OutputNamesTest)
+
+BOOST_AUTO_TEST_CASE(NormalizesLikeTheRegex) {
+  std::vector<std::string> filenames = {
+      "",
+      "   ",
+      "2022-01-10 Hike",
+      " \t2022-01-10 Hike\r\n",
+      R"(a<b>c:d"e/f\g|h?i*j)",
+      " <> ",
+      "* leading and trailing ?",
+      "Zürich – Üetliberg",
+  };
+  // Every byte alone, surrounded by spaces and between letters.
+  for (int c = 0; c < 256; ++c) {
+    const std::string byte(1, static_cast<char>(c));
+    filenames.push_back(byte);
+    filenames.push_back(" " + byte + " ");
+    filenames.push_back("a" + byte + "b");
+  }
+  for (const std::string& filename : filenames) {
+    // The regex meant to replace backslashes too, but "\/" only escapes the
+    // slash. Windows can't take them in filenames.
+    std::string expected = RegexNormalizeFilename(filename);
+    std::replace(expected.begin(), expected.end(), '\\', '_');
+    BOOST_TEST(NormalizeFilename(filename) == expected,
+               "\"" << filename << "\"");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(UniqueNamesStayPlain) {
+  TempDirectory directory;
+  OutputNames names(directory.path());
+  names.Plan("2022-01-10 Hike", "a");
+  names.Plan("2022-01-11 Hike", "b");
+  BOOST_TEST(names.Claim("2022-01-11 Hike", "b") == "2022-01-11 Hike");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "a") == "2022-01-10 Hike");
+}
+
+BOOST_AUTO_TEST_CASE(SharedNamesAreDisambiguatedForAll) {
+  for (const bool a_first : {true, false}) {
+    TempDirectory directory;
+    OutputNames names(directory.path());
+    names.Plan("2022-01-10 Hike", "a");
+    names.Plan("2022-01-10 Hike", "b");
+    names.Plan("2022-01-10 Hike", "c");
+    const std::string first = a_first ? "a" : "c";
+    const std::string last = a_first ? "c" : "a";
+    BOOST_TEST(names.Claim("2022-01-10 Hike", first) ==
+               "2022-01-10 Hike (" + first + ")");
+    BOOST_TEST(names.Claim("2022-01-10 Hike", "b") == "2022-01-10 Hike (b)");
+    BOOST_TEST(names.Claim("2022-01-10 Hike", last) ==
+               "2022-01-10 Hike (" + last + ")");
+  }
+}
+
+BOOST_AUTO_TEST_CASE(PlanningTwiceByOneOwnerIsntShared) {
+  TempDirectory directory;
+  OutputNames names(directory.path());
+  names.Plan("2022-01-10 Hike", "a");
+  names.Plan(" 2022-01-10 Hike ", "a");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "a") == "2022-01-10 Hike");
+}
+
+BOOST_AUTO_TEST_CASE(ClaimedNamesStayWithTheirOwner) {
+  TempDirectory directory;
+  OutputNames names(directory.path());
+  names.Plan("2022-01-10 Hike", "a");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "a") == "2022-01-10 Hike");
+  // Arrives later, e.g. while watched.
+  names.Plan("2022-01-10 Hike", "b");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "b") == "2022-01-10 Hike (b)");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "a") == "2022-01-10 Hike");
+}
+
+BOOST_AUTO_TEST_CASE(ReservedNamesStayWithTheirOwner) {
+  TempDirectory directory;
+  std::ofstream(directory.path() / "2022-01-10 Hike.kml") << "<kml/>";
+  OutputNames names(directory.path());
+  names.Reserve("2022-01-10 Hike", "a");
+  names.Plan("2022-01-10 Hike", "b");
+  BOOST_TEST(names.Existed("2022-01-10 Hike.kml"));
+  BOOST_TEST(names.Owns("2022-01-10 Hike", "a"));
+  BOOST_TEST(!names.Owns("2022-01-10 Hike", "b"));
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "b") == "2022-01-10 Hike (b)");
+  BOOST_TEST(names.Claim("2022-01-10 Hike", "a") == "2022-01-10 Hike");
+}
+
+BOOST_AUTO_TEST_CASE(RemovesTemporaryOutputs) {
+  TempDirectory directory;
+  for (const char* filename : {"a.kml.tmp", "b.geojson.tmp", "c.tmp"}) {
+    std::ofstream(directory.path() / filename) << "x";
+  }
+  const OutputNames names(directory.path());
+  BOOST_TEST(!boost::filesystem::exists(directory.path() / "a.kml.tmp"));
+  BOOST_TEST(!boost::filesystem::exists(directory.path() / "b.geojson.tmp"));
+  BOOST_TEST(boost::filesystem::exists(directory.path() / "c.tmp"));
+  BOOST_TEST(names.Existed("c.tmp"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "boost/filesystem.hpp"
+
+namespace gpx_to_kml {
+
+// Path of the test input `name` in test/data.
+inline boost::filesystem::path TestData(std::string_view name) {
+  return boost::filesystem::path(__FILE__).parent_path() / "data" /
+         std::string(name);
+}
+
+// An empty directory of its own for a test, removed with all its contents on
+// destruction.
+class TempDirectory {
+ public:
+  TempDirectory()
+      : path_(boost::filesystem::temp_directory_path() /
+              boost::filesystem::unique_path("gpx-to-kml-test-%%%%-%%%%")) {
+    boost::filesystem::create_directories(path_);
+  }
+
+  ~TempDirectory() {
+    boost::system::error_code error;
+    boost::filesystem::remove_all(path_, error);
+  }
+
+  TempDirectory(const TempDirectory&) = delete;
+  TempDirectory& operator=(const TempDirectory&) = delete;
+
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  const boost::filesystem::path path_;
+};
+
+}  // namespace gpx_to_kml
@@ -0,0 +1,3 @@
+// The unit tests of all modules, linked into a single runner.
+#define BOOST_TEST_MODULE GpxToKml
+#include "boost/test/included/unit_test.hpp"
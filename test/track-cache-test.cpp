@@ -0,0 +1,122 @@
+#include "track-cache.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <optional>
+
+#include "activity.h"
+#include "boost/filesystem.hpp"
+#include "boost/format.hpp"
+#include "boost/test/unit_test.hpp"
+#include "test-data.h"
+
+namespace gpx_to_kml {
+namespace {
+
+constexpr std::uint64_t kContentHash = 0x0123456789ABCDEF;
+
+Activity TestActivity() {
+  Activity activity = {};
+  activity.name = "Zürich – Üetliberg";
+  activity.time.tm_year = 122;
+  activity.time.tm_mon = 0;
+  activity.time.tm_mday = 10;
+  activity.time.tm_hour = 8;
+  activity.coordinates = {
+      {.lat = 47.37, .lon = 8.54, .alt = 408, .time = 1641801600000},
+      {.lat = 47.36, .lon = 8.52, .alt = 450.5},
+      {.lat = 47.35, .lon = 8.49, .alt = 869, .time = 1641805200500}};
+  activity.extensions = {
+      {.name = "hr",
+       .values = {120, std::numeric_limits<double>::quiet_NaN(), 150}},
+      {.name = "cad", .values = {80, 82, 84}}};
+  return activity;
+}
+
+boost::filesystem::path CachePath(const boost::filesystem::path& directory,
+                                  std::uint64_t content_hash) {
+  return directory / boost::str(boost::format("%016x.track") % content_hash);
+}
+
+BOOST_AUTO_TEST_SUITE(TrackCacheTest)
+
+BOOST_AUTO_TEST_CASE(RoundTrips) {
+  TempDirectory directory;
+  TrackCache cache(directory.path() / "cache");
+  BOOST_TEST(!cache.Contains(kContentHash));
+  BOOST_TEST(!cache.Load(kContentHash));
+
+  const Activity stored = TestActivity();
+  cache.Store(kContentHash, stored);
+  BOOST_TEST(cache.Contains(kContentHash));
+  BOOST_TEST(!cache.Contains(kContentHash + 1));
+  const std::optional<Activity> loaded = cache.Load(kContentHash);
+  BOOST_REQUIRE(loaded);
+  BOOST_TEST(loaded->name == stored.name);
+  BOOST_TEST(loaded->time.tm_year == 122);
+  BOOST_TEST(loaded->time.tm_mday == 10);
+  BOOST_TEST(loaded->time.tm_hour == 8);
+  BOOST_REQUIRE(loaded->coordinates.size() == stored.coordinates.size());
+  for (std::size_t i = 0; i < stored.coordinates.size(); ++i) {
+    BOOST_TEST(loaded->coordinates[i].lat == stored.coordinates[i].lat);
+    BOOST_TEST(loaded->coordinates[i].lon == stored.coordinates[i].lon);
+    BOOST_TEST(loaded->coordinates[i].alt == stored.coordinates[i].alt);
+    BOOST_TEST(loaded->coordinates[i].time == stored.coordinates[i].time);
+  }
+  BOOST_REQUIRE(loaded->extensions.size() == 2u);
+  BOOST_TEST(loaded->extensions[0].name == "hr");
+  BOOST_TEST(loaded->extensions[0].values[0] == 120);
+  BOOST_TEST(std::isnan(loaded->extensions[0].values[1]));
+  BOOST_TEST(loaded->extensions[1].name == "cad");
+  BOOST_TEST(loaded->extensions[1].values == stored.extensions[1].values);
+
+  // Loads what an earlier run stored.
+  BOOST_TEST(
+      TrackCache(directory.path() / "cache").Load(kContentHash).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(EmptyActivity) {
+  TempDirectory directory;
+  TrackCache cache(directory.path());
+  cache.Store(kContentHash, Activity{});
+  const std::optional<Activity> loaded = cache.Load(kContentHash);
+  BOOST_REQUIRE(loaded);
+  BOOST_TEST(loaded->name.empty());
+  BOOST_TEST(loaded->coordinates.empty());
+  BOOST_TEST(loaded->extensions.empty());
+}
+
+BOOST_AUTO_TEST_CASE(RejectsCorruptFiles) {
+  TempDirectory directory;
+  TrackCache cache(directory.path());
+  cache.Store(kContentHash, TestActivity());
+  const boost::filesystem::path path =
+      CachePath(directory.path(), kContentHash);
+  const std::uintmax_t size = boost::filesystem::file_size(path);
+  {
+    std::ofstream(path.string(), std::ios::binary | std::ios::app) << "x";
+  }
+  BOOST_TEST(!cache.Load(kContentHash));
+  // Every truncated tail, down to an empty file.
+  for (std::uintmax_t truncated = size; truncated-- > 0;) {
+    boost::filesystem::resize_file(path, truncated);
+    BOOST_TEST(!cache.Load(kContentHash), "size " << truncated);
+  }
+
+  // Written by another version.
+  cache.Store(kContentHash + 1, TestActivity());
+  {
+    std::fstream file(CachePath(directory.path(), kContentHash + 1).string(),
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(7);
+    file << '0';
+  }
+  BOOST_TEST(!cache.Load(kContentHash + 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml
@@ -0,0 +1,115 @@
+#include "work-queue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+namespace gpx_to_kml {
+namespace {
+
+BOOST_AUTO_TEST_SUITE(WorkQueueTest)
+
+BOOST_AUTO_TEST_CASE(RoundsCapacityUp) {
+  BOOST_TEST(BoundedQueue<int>(0).capacity() == 2u);
+  BOOST_TEST(BoundedQueue<int>(5).capacity() == 8u);
+  BOOST_TEST(BoundedQueue<int>(8).capacity() == 8u);
+}
+
+BOOST_AUTO_TEST_CASE(FirstInFirstOut) {
+  BoundedQueue<std::unique_ptr<int>> queue(4);
+  for (int i = 0; i < 4; ++i) {
+    auto value = std::make_unique<int>(i);
+    BOOST_TEST(queue.TryPush(value));
+    BOOST_TEST(!value);
+  }
+  auto rejected = std::make_unique<int>(4);
+  BOOST_TEST(!queue.TryPush(rejected));
+  BOOST_TEST(*rejected == 4);
+  BOOST_TEST(queue.size() == 4u);
+
+  std::vector<std::unique_ptr<int>> values;
+  BOOST_TEST(queue.PopBatch(3, values));
+  BOOST_TEST(values.size() == 3u);
+  for (int i = 0; i < 3; ++i) {
+    BOOST_TEST(*values[i] == i);
+  }
+  queue.Close();
+  const std::optional<std::unique_ptr<int>> last = queue.Pop();
+  BOOST_TEST((last.has_value() && **last == 3));
+  BOOST_TEST(!queue.Pop());
+  BOOST_TEST(!queue.PopBatch(3, values));
+  BOOST_TEST(values.empty());
+  BOOST_TEST(queue.stats().pushes == 4u);
+  BOOST_TEST(queue.stats().max_depth == 4u);
+}
+
+BOOST_AUTO_TEST_CASE(ManyProducersAndConsumers) {
+  constexpr int kNumProducers = 4;
+  constexpr int kNumConsumers = 4;
+  constexpr int kValuesPerProducer = 20000;
+  // Small enough for producers and consumers to keep blocking on each other.
+  BoundedQueue<int> queue(8);
+
+  std::vector<std::vector<int>> popped(kNumConsumers);
+  std::vector<std::thread> consumers;
+  for (int consumer = 0; consumer < kNumConsumers; ++consumer) {
+    consumers.emplace_back([&, consumer]() {
+      std::vector<int>& values = popped[consumer];
+      if (consumer % 2 == 0) {
+        while (std::optional<int> value = queue.Pop()) {
+          values.push_back(*value);
+        }
+      } else {
+        std::vector<int> batch;
+        while (queue.PopBatch(3, batch)) {
+          values.insert(values.end(), batch.begin(), batch.end());
+        }
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kNumProducers; ++producer) {
+    producers.emplace_back([&, producer]() {
+      for (int i = 0; i < kValuesPerProducer; ++i) {
+        queue.Push(producer * kValuesPerProducer + i);
+      }
+    });
+  }
+  for (std::thread& producer : producers) {
+    producer.join();
+  }
+  queue.Close();
+  for (std::thread& consumer : consumers) {
+    consumer.join();
+  }
+
+  std::vector<int> times_popped(kNumProducers * kValuesPerProducer);
+  for (const std::vector<int>& values : popped) {
+    // Each consumer sees the values of a producer in the order pushed.
+    std::vector<int> last(kNumProducers, -1);
+    for (int value : values) {
+      ++times_popped[value];
+      int& previous = last[value / kValuesPerProducer];
+      BOOST_TEST(value > previous);
+      previous = value;
+    }
+  }
+  for (std::size_t value = 0; value < times_popped.size(); ++value) {
+    if (times_popped[value] != 1) {
+      BOOST_TEST(times_popped[value] == 1, "value " << value);
+    }
+  }
+  BOOST_TEST(queue.stats().pushes ==
+             static_cast<std::uint64_t>(kNumProducers * kValuesPerProducer));
+  BOOST_TEST(queue.stats().max_depth <= queue.capacity());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}  // namespace
+}  // namespace gpx_to_kml